@@ -0,0 +1,395 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "absorbing_chain.h"
+
+// A pivot this small (relative to 1, the diagonal of I - Q) means I - Q is
+// singular: some transient nodes are never left for an absorbing one
+#define SINGULAR_PIVOT_EPSILON 1e-12
+#define NOT_TRANSIENT (-1)
+
+#define ABS(X) (((X) < 0) ? -(X) : (X))
+
+/**
+ * @brief Returns true if walks end at the given node.
+ */
+static bool is_absorbing_node(const MarkovNode *markov_node);
+
+/**
+ * @brief Gives every transient node its row in the matrix.
+ * @param nodes The nodes of the chain, by their ids
+ * @param node_count The number of nodes
+ * @param transient_rows Set to the row of every node, NOT_TRANSIENT for the
+ * absorbing nodes
+ * @return The number of transient nodes
+ */
+static int map_transient_nodes(MarkovNode **nodes, int node_count,
+                               int *transient_rows);
+
+/**
+ * @brief Fills the matrix with I - Q, Q the transition probabilities between
+ * the transient nodes.
+ * @param nodes The nodes of the chain, by their ids
+ * @param node_count The number of nodes
+ * @param transient_rows The row of every node
+ * @param size The number of transient nodes
+ * @param matrix The size x size matrix, row-major
+ */
+static void fill_transition_matrix(MarkovNode **nodes, int node_count,
+                                   const int *transient_rows, int size,
+                                   double *matrix);
+
+/**
+ * @brief LU factorization with partial pivoting, in place: the matrix is
+ * replaced by the unit lower triangle of L below its diagonal and by U.
+ * @param matrix The size x size matrix, row-major
+ * @param size The number of rows
+ * @param pivots Set to the row swapped with every row
+ * @return false if the matrix is singular, true otherwise
+ */
+static bool factorize_matrix(double *matrix, int size, int *pivots);
+
+/**
+ * @brief Solves matrix * x = vector in place, with the factorization of
+ * factorize_matrix.
+ * @param matrix The factorized matrix
+ * @param size The number of rows
+ * @param pivots The pivots of the factorization
+ * @param vector The right hand side, set to x
+ */
+static void solve_factorized(const double *matrix, int size,
+                             const int *pivots, double *vector);
+
+/**
+ * @brief Fills the expected steps and their variance from every node.
+ * @param analysis The analysis
+ * @param matrix The factorized I - Q
+ * @param size The number of transient nodes
+ * @param pivots The pivots of the factorization
+ * @param transient_rows The row of every node
+ * @param work A vector of size doubles
+ */
+static void solve_steps(AbsorbingChainAnalysis *analysis,
+                        const double *matrix, int size, const int *pivots,
+                        const int *transient_rows, double *work);
+
+/**
+ * @brief Fills the visit probabilities from the start node, which must be
+ * transient. Solves for every column of N = (I - Q)^-1 in turn.
+ * @param analysis The analysis
+ * @param nodes The nodes of the chain, by their ids
+ * @param matrix The factorized I - Q
+ * @param size The number of transient nodes
+ * @param pivots The pivots of the factorization
+ * @param transient_rows The row of every node
+ * @param work A vector of size doubles
+ */
+static void solve_visit_probabilities(AbsorbingChainAnalysis *analysis,
+                                      MarkovNode **nodes,
+                                      const double *matrix, int size,
+                                      const int *pivots,
+                                      const int *transient_rows,
+                                      double *work);
+
+static bool is_absorbing_node(const MarkovNode *markov_node) {
+    return markov_node->is_last || markov_node->total_frequency <= 0;
+}
+
+static int map_transient_nodes(MarkovNode **nodes, int node_count,
+                               int *transient_rows) {
+    int size = 0;
+
+    for (int id = 0; id < node_count; ++id) {
+        transient_rows[id] = is_absorbing_node(nodes[id]) ? NOT_TRANSIENT
+                                                          : size++;
+    }
+
+    return size;
+}
+
+static void fill_transition_matrix(MarkovNode **nodes, int node_count,
+                                   const int *transient_rows, int size,
+                                   double *matrix) {
+    memset(matrix, 0, (size_t) size * size * sizeof *matrix);
+
+    for (int id = 0; id < node_count; ++id) {
+        int row = transient_rows[id];
+        if (row == NOT_TRANSIENT) {
+            continue;
+        }
+
+        double *matrix_row = matrix + (size_t) row * size;
+        matrix_row[row] += 1;
+
+        const MarkovNode *markov_node = nodes[id];
+        for (int i = 0; i < markov_node->frequencies_list_size; ++i) {
+            const MarkovNodeFrequency *edge =
+                    &markov_node->frequencies_list[i];
+            int column = transient_rows[edge->markov_node->id];
+
+            if (column != NOT_TRANSIENT) {
+                matrix_row[column] -= (double) edge->frequency /
+                                      markov_node->total_frequency;
+            }
+        }
+    }
+}
+
+static bool factorize_matrix(double *matrix, int size, int *pivots) {
+    for (int k = 0; k < size; ++k) {
+        int pivot = k;
+        for (int i = k + 1; i < size; ++i) {
+            if (ABS(matrix[(size_t) i * size + k]) >
+                ABS(matrix[(size_t) pivot * size + k])) {
+                pivot = i;
+            }
+        }
+
+        pivots[k] = pivot;
+        if (ABS(matrix[(size_t) pivot * size + k]) < SINGULAR_PIVOT_EPSILON) {
+            return false;
+        }
+
+        if (pivot != k) {
+            for (int j = 0; j < size; ++j) {
+                double swapped = matrix[(size_t) k * size + j];
+                matrix[(size_t) k * size + j] =
+                        matrix[(size_t) pivot * size + j];
+                matrix[(size_t) pivot * size + j] = swapped;
+            }
+        }
+
+        const double *pivot_row = matrix + (size_t) k * size;
+        for (int i = k + 1; i < size; ++i) {
+            double *row = matrix + (size_t) i * size;
+            if (row[k] == 0) {
+                // the matrix of a board is sparse, most rows are skipped
+                continue;
+            }
+
+            row[k] /= pivot_row[k];
+            for (int j = k + 1; j < size; ++j) {
+                row[j] -= row[k] * pivot_row[j];
+            }
+        }
+    }
+
+    return true;
+}
+
+static void solve_factorized(const double *matrix, int size,
+                             const int *pivots, double *vector) {
+    for (int k = 0; k < size; ++k) {
+        double swapped = vector[k];
+        vector[k] = vector[pivots[k]];
+        vector[pivots[k]] = swapped;
+    }
+
+    // L * y = P * vector, L has a unit diagonal
+    for (int i = 0; i < size; ++i) {
+        const double *row = matrix + (size_t) i * size;
+        for (int j = 0; j < i; ++j) {
+            vector[i] -= row[j] * vector[j];
+        }
+    }
+
+    // U * x = y
+    for (int i = size - 1; i >= 0; --i) {
+        const double *row = matrix + (size_t) i * size;
+        for (int j = i + 1; j < size; ++j) {
+            vector[i] -= row[j] * vector[j];
+        }
+        vector[i] /= row[i];
+    }
+}
+
+static void solve_steps(AbsorbingChainAnalysis *analysis,
+                        const double *matrix, int size, const int *pivots,
+                        const int *transient_rows, double *work) {
+    // t = N * 1
+    for (int row = 0; row < size; ++row) {
+        work[row] = 1;
+    }
+    solve_factorized(matrix, size, pivots, work);
+
+    for (int id = 0; id < analysis->node_count; ++id) {
+        int row = transient_rows[id];
+        analysis->expected_steps[id] = (row == NOT_TRANSIENT) ? 0 : work[row];
+    }
+
+    // the steps from a node are one more than the steps from its next node,
+    // so their second moments are N * (2t - 1)
+    for (int id = 0; id < analysis->node_count; ++id) {
+        int row = transient_rows[id];
+        if (row != NOT_TRANSIENT) {
+            work[row] = 2 * analysis->expected_steps[id] - 1;
+        }
+    }
+    solve_factorized(matrix, size, pivots, work);
+
+    for (int id = 0; id < analysis->node_count; ++id) {
+        int row = transient_rows[id];
+        double expected_steps = analysis->expected_steps[id];
+        analysis->steps_variance[id] =
+                (row == NOT_TRANSIENT)
+                ? 0 : work[row] - expected_steps * expected_steps;
+    }
+}
+
+static void solve_visit_probabilities(AbsorbingChainAnalysis *analysis,
+                                      MarkovNode **nodes,
+                                      const double *matrix, int size,
+                                      const int *pivots,
+                                      const int *transient_rows,
+                                      double *work) {
+    int start_row = transient_rows[analysis->start_id];
+
+    for (int id = 0; id < analysis->node_count; ++id) {
+        int column = transient_rows[id];
+        if (column == NOT_TRANSIENT) {
+            continue;
+        }
+
+        // column `column` of N, the expected visits to the node from every
+        // transient node
+        memset(work, 0, (size_t) size * sizeof *work);
+        work[column] = 1;
+        solve_factorized(matrix, size, pivots, work);
+
+        double start_visits = work[start_row];
+        analysis->visit_probabilities[id] =
+                (id == analysis->start_id) ? 1 : start_visits / work[column];
+
+        // every visit to the node leaves it for an absorbing node with the
+        // probability of that edge
+        const MarkovNode *markov_node = nodes[id];
+        for (int i = 0; i < markov_node->frequencies_list_size; ++i) {
+            const MarkovNodeFrequency *edge =
+                    &markov_node->frequencies_list[i];
+            int next_id = edge->markov_node->id;
+
+            if (transient_rows[next_id] == NOT_TRANSIENT) {
+                analysis->visit_probabilities[next_id] +=
+                        start_visits * edge->frequency /
+                        markov_node->total_frequency;
+            }
+        }
+    }
+}
+
+int analyze_absorbing_chain(MarkovChain *markov_chain,
+                            MarkovNode *start_node,
+                            AbsorbingChainAnalysis **ptr_analysis) {
+    assert(markov_chain != NULL);
+    assert(start_node != NULL);
+    assert(ptr_analysis != NULL);
+
+    *ptr_analysis = NULL;
+    AbsorbingChainAnalysis *analysis =
+            (AbsorbingChainAnalysis *) calloc(1, sizeof *analysis);
+    if (analysis == NULL) {
+        return ABSORBING_CHAIN_ALLOCATION_FAILURE;
+    }
+
+    int node_count = (markov_chain->database != NULL)
+                     ? markov_chain->database->size : 0;
+    analysis->node_count = node_count;
+    analysis->start_id = start_node->id;
+    analysis->expected_steps = (double *) calloc(node_count + 1,
+                                                 sizeof(double));
+    analysis->steps_variance = (double *) calloc(node_count + 1,
+                                                 sizeof(double));
+    analysis->visit_probabilities = (double *) calloc(node_count + 1,
+                                                      sizeof(double));
+
+    MarkovNode **nodes = (MarkovNode **) malloc(
+            (node_count + 1) * sizeof *nodes);
+    int *transient_rows = (int *) malloc(
+            (node_count + 1) * sizeof *transient_rows);
+    if (analysis->expected_steps == NULL ||
+        analysis->steps_variance == NULL ||
+        analysis->visit_probabilities == NULL || nodes == NULL ||
+        transient_rows == NULL) {
+        free(nodes);
+        free(transient_rows);
+        free_absorbing_chain_analysis(&analysis);
+        return ABSORBING_CHAIN_ALLOCATION_FAILURE;
+    }
+
+    for (Node *node = (node_count > 0) ? markov_chain->database->first : NULL;
+         node != NULL; node = node->next) {
+        nodes[node->data->id] = node->data;
+    }
+
+    int size = map_transient_nodes(nodes, node_count, transient_rows);
+    if (size > MAX_ABSORBING_CHAIN_TRANSIENT_NODES) {
+        free(nodes);
+        free(transient_rows);
+        free_absorbing_chain_analysis(&analysis);
+        return ABSORBING_CHAIN_TOO_LARGE;
+    }
+
+    if (size == 0) {
+        // every walk ends where it starts, there is nothing to solve
+        analysis->visit_probabilities[analysis->start_id] = 1;
+        free(nodes);
+        free(transient_rows);
+        *ptr_analysis = analysis;
+        return ABSORBING_CHAIN_SUCCESS;
+    }
+
+    double *matrix = (double *) malloc(
+            ((size_t) size * size + 1) * sizeof *matrix);
+    int *pivots = (int *) malloc((size + 1) * sizeof *pivots);
+    double *work = (double *) malloc((size + 1) * sizeof *work);
+
+    int result = (matrix != NULL && pivots != NULL && work != NULL)
+                 ? ABSORBING_CHAIN_SUCCESS
+                 : ABSORBING_CHAIN_ALLOCATION_FAILURE;
+    if (result == ABSORBING_CHAIN_SUCCESS) {
+        fill_transition_matrix(nodes, node_count, transient_rows, size,
+                               matrix);
+        if (!factorize_matrix(matrix, size, pivots)) {
+            result = ABSORBING_CHAIN_NOT_ABSORBING;
+        }
+    }
+
+    if (result == ABSORBING_CHAIN_SUCCESS) {
+        solve_steps(analysis, matrix, size, pivots, transient_rows, work);
+
+        if (transient_rows[analysis->start_id] == NOT_TRANSIENT) {
+            // the walk ends where it starts
+            analysis->visit_probabilities[analysis->start_id] = 1;
+        } else {
+            solve_visit_probabilities(analysis, nodes, matrix, size, pivots,
+                                      transient_rows, work);
+        }
+    }
+
+    free(nodes);
+    free(transient_rows);
+    free(matrix);
+    free(pivots);
+    free(work);
+
+    if (result != ABSORBING_CHAIN_SUCCESS) {
+        free_absorbing_chain_analysis(&analysis);
+        return result;
+    }
+
+    *ptr_analysis = analysis;
+    return ABSORBING_CHAIN_SUCCESS;
+}
+
+void free_absorbing_chain_analysis(AbsorbingChainAnalysis **ptr_analysis) {
+    if (*ptr_analysis == NULL) {
+        return;
+    }
+
+    free((*ptr_analysis)->expected_steps);
+    free((*ptr_analysis)->steps_variance);
+    free((*ptr_analysis)->visit_probabilities);
+    free(*ptr_analysis);
+    *ptr_analysis = NULL;
+}
@@ -0,0 +1,76 @@
+#ifndef _ABSORBING_CHAIN_H_
+#define _ABSORBING_CHAIN_H_
+
+#include "markov_chain.h"
+
+/** The dense solve of analyze_absorbing_chain takes O(m^2) memory and
+ * O(m^3) time for m transient nodes, chains with more are not analyzed */
+#define MAX_ABSORBING_CHAIN_TRANSIENT_NODES 2048
+
+/** The results of analyze_absorbing_chain */
+#define ABSORBING_CHAIN_SUCCESS 0
+#define ABSORBING_CHAIN_ALLOCATION_FAILURE 1
+#define ABSORBING_CHAIN_TOO_LARGE 2
+#define ABSORBING_CHAIN_NOT_ABSORBING 3
+
+/**
+ * @brief The exact statistics of the walks on a markov chain, as an
+ * absorbing chain: a walk ends at a node whose data is last or that has no
+ * next nodes (an absorbing node), and moves from any other node (a transient
+ * node) to one of its next nodes, by their frequencies. Every array is
+ * indexed by the ids of the nodes (MarkovNode::id).
+ */
+typedef struct AbsorbingChainAnalysis AbsorbingChainAnalysis;
+
+struct AbsorbingChainAnalysis
+{
+    /** The number of nodes, the length of every array */
+    int node_count;
+
+    /** The id of the node the walks of `visit_probabilities` start from */
+    int start_id;
+
+    /** The expected number of steps of a walk from every node until it
+     * ends, 0 for absorbing nodes */
+    double *expected_steps;
+
+    /** The variance of the number of steps of a walk from every node, 0 for
+     * absorbing nodes */
+    double *steps_variance;
+
+    /** The probability that a walk from the start node visits every node.
+     * 1 for the start node, and for an absorbing node the probability that
+     * the walk ends at it. */
+    double *visit_probabilities;
+};
+
+/**
+ * @brief Solves the absorbing chain equations of the given chain. With Q the
+ * transition probabilities between the transient nodes and
+ * N = (I - Q)^-1 the expected number of visits, the expected steps are
+ * t = N * 1, the second moments of the steps are N * (2t - 1), and the
+ * probability of visiting node j from node s is N[s][j] / N[j][j]. I - Q is
+ * factorized once, so the analysis takes O(m^3) time and O(m^2) memory for
+ * m transient nodes: chains of more than MAX_ABSORBING_CHAIN_TRANSIENT_NODES
+ * transient nodes are refused before the matrix is allocated.
+ * You are resposible for freeing the result with
+ * free_absorbing_chain_analysis.
+ * @param markov_chain The chain, it must not change during the analysis
+ * @param start_node The node the walks of the visit probabilities start from
+ * @param ptr_analysis Set to the analysis on success, NULL otherwise
+ * @return ABSORBING_CHAIN_SUCCESS, ABSORBING_CHAIN_TOO_LARGE if the chain
+ * has too many transient nodes, ABSORBING_CHAIN_NOT_ABSORBING if a walk from
+ * some transient node may never end (I - Q is singular), or
+ * ABSORBING_CHAIN_ALLOCATION_FAILURE if memory allocation failed.
+ */
+int analyze_absorbing_chain (MarkovChain *markov_chain,
+                             MarkovNode *start_node,
+                             AbsorbingChainAnalysis **ptr_analysis);
+
+/**
+ * @brief Frees the analysis and its arrays
+ * @param ptr_analysis Pointer to the analysis, set to NULL afterwards
+ */
+void free_absorbing_chain_analysis (AbsorbingChainAnalysis **ptr_analysis);
+
+#endif /* _ABSORBING_CHAIN_H_ */
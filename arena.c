@@ -0,0 +1,154 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <assert.h>
+
+#include "arena.h"
+
+#define ARENA_ALIGNMENT (_Alignof(max_align_t))
+
+/**
+ * @brief Rounds size up to a multiple of ARENA_ALIGNMENT
+ */
+#define ALIGN_UP(size) \
+    (((size) + ARENA_ALIGNMENT - 1) & ~((size_t) ARENA_ALIGNMENT - 1))
+
+typedef struct ArenaSlab ArenaSlab;
+
+struct ArenaSlab
+{
+    /** The previously allocated slab, NULL if this is the first one */
+    ArenaSlab *next;
+
+    /** The number of bytes in `memory` */
+    size_t size;
+
+    /** The number of bytes in `memory` that were already handed out */
+    size_t used;
+
+    /** The memory of the slab itself */
+    max_align_t memory[];
+};
+
+struct Arena
+{
+    /** The slab allocations are currently made from, NULL before the first
+     * allocation */
+    ArenaSlab *current_slab;
+
+    /** The size of a regular slab */
+    size_t slab_size;
+};
+
+/**
+ * @brief Allocates a new slab, and links it in front of the arena's slabs.
+ * @param arena The arena
+ * @param size The number of usable bytes in the slab
+ * @return The new slab, NULL if memory allocation failed.
+ */
+static ArenaSlab *add_slab(Arena *arena, size_t size);
+
+Arena *new_arena(size_t slab_size) {
+    Arena *arena = (Arena *) malloc(sizeof *arena);
+    if (arena == NULL) {
+        return NULL;
+    }
+
+    arena->current_slab = NULL;
+    arena->slab_size = ALIGN_UP(slab_size);
+
+    return arena;
+}
+
+static ArenaSlab *add_slab(Arena *arena, size_t size) {
+    ArenaSlab *slab = (ArenaSlab *) malloc(sizeof *slab + size);
+    if (slab == NULL) {
+        return NULL;
+    }
+
+    slab->size = size;
+    slab->used = 0;
+    slab->next = arena->current_slab;
+    arena->current_slab = slab;
+
+    return slab;
+}
+
+void *arena_alloc(Arena *arena, size_t size) {
+    assert(arena != NULL);
+
+    size = ALIGN_UP(size);
+    ArenaSlab *slab = arena->current_slab;
+
+    if (slab == NULL || slab->size - slab->used < size) {
+        if (size > arena->slab_size) {
+            // give big allocations a slab of their own, and keep bumping in
+            // the current one
+            ArenaSlab *big_slab = add_slab(arena, size);
+            if (big_slab == NULL) {
+                return NULL;
+            }
+
+            big_slab->used = size;
+            if (slab != NULL) {
+                big_slab->next = slab->next;
+                slab->next = big_slab;
+                arena->current_slab = slab;
+            }
+
+            return big_slab->memory;
+        }
+
+        slab = add_slab(arena, arena->slab_size);
+        if (slab == NULL) {
+            return NULL;
+        }
+    }
+
+    void *memory = (char *) slab->memory + slab->used;
+    slab->used += size;
+
+    return memory;
+}
+
+void merge_arenas(Arena *arena, Arena **ptr_source_arena) {
+    assert(arena != NULL);
+
+    if (*ptr_source_arena == NULL) {
+        return;
+    }
+
+    ArenaSlab *source_slabs = (*ptr_source_arena)->current_slab;
+    if (source_slabs != NULL) {
+        ArenaSlab *last_source_slab = source_slabs;
+        while (last_source_slab->next != NULL) {
+            last_source_slab = last_source_slab->next;
+        }
+
+        // keep bumping in the current slab, the source slabs go behind it
+        if (arena->current_slab == NULL) {
+            arena->current_slab = source_slabs;
+        } else {
+            last_source_slab->next = arena->current_slab->next;
+            arena->current_slab->next = source_slabs;
+        }
+    }
+
+    free(*ptr_source_arena);
+    *ptr_source_arena = NULL;
+}
+
+void free_arena(Arena **ptr_arena) {
+    if (*ptr_arena == NULL) {
+        return;
+    }
+
+    ArenaSlab *slab = (*ptr_arena)->current_slab;
+    while (slab != NULL) {
+        ArenaSlab *next_slab = slab->next;
+        free(slab);
+        slab = next_slab;
+    }
+
+    free(*ptr_arena);
+    *ptr_arena = NULL;
+}
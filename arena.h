@@ -0,0 +1,50 @@
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include <stddef.h> // For size_t
+
+/**
+ * @brief The default size of a single arena slab, in bytes
+ */
+#define ARENA_DEFAULT_SLAB_SIZE ((size_t) 1 << 20)
+
+/**
+ * @brief A bump allocator. Memory is carved out of large slabs, and can only
+ * be released all at once, by freeing the whole arena.
+ */
+typedef struct Arena Arena;
+
+/**
+ * @brief A "constructor" for Arena, you are resposible for freeing it with
+ * free_arena.
+ * @param slab_size The size of every slab the arena allocates, allocations
+ * bigger than it get a slab of their own.
+ * @return A new empty arena, NULL if memory allocation failed.
+ */
+Arena *new_arena (size_t slab_size);
+
+/**
+ * @brief Allocates size bytes from the arena, aligned for any type. The
+ * memory lives until the arena is freed.
+ * @param arena The arena
+ * @param size The number of bytes to allocate
+ * @return Pointer to the allocated memory, NULL if memory allocation failed.
+ */
+void *arena_alloc (Arena *arena, size_t size);
+
+/**
+ * @brief Moves every allocation of source_arena into arena, so they live
+ * until arena is freed, and frees source_arena itself.
+ * @param arena The arena to move the allocations to
+ * @param ptr_source_arena Pointer to the arena to move the allocations from,
+ * set to NULL afterwards.
+ */
+void merge_arenas (Arena *arena, Arena **ptr_source_arena);
+
+/**
+ * @brief Frees the arena and every allocation made from it.
+ * @param ptr_arena Pointer to the arena, set to NULL afterwards.
+ */
+void free_arena (Arena **ptr_arena);
+
+#endif /* _ARENA_H_ */
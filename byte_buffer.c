@@ -0,0 +1,70 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "byte_buffer.h"
+
+#define MIN_BYTE_BUFFER_CAPACITY 64
+
+bool init_byte_buffer(ByteBuffer *buffer, size_t capacity) {
+    assert(buffer != NULL);
+
+    if (capacity < MIN_BYTE_BUFFER_CAPACITY) {
+        capacity = MIN_BYTE_BUFFER_CAPACITY;
+    }
+
+    buffer->data = (char *) malloc(capacity);
+    buffer->size = 0;
+    buffer->capacity = (buffer->data != NULL) ? capacity : 0;
+
+    return buffer->data != NULL;
+}
+
+bool append_to_byte_buffer(ByteBuffer *buffer, const void *bytes,
+                           size_t size) {
+    assert(buffer != NULL);
+
+    if (buffer->capacity - buffer->size < size) {
+        size_t new_capacity = (buffer->capacity == 0)
+                              ? MIN_BYTE_BUFFER_CAPACITY : buffer->capacity;
+        while (new_capacity - buffer->size < size) {
+            new_capacity *= 2;
+        }
+
+        char *new_data = (char *) realloc(buffer->data, new_capacity);
+        if (new_data == NULL) {
+            return false;
+        }
+
+        buffer->data = new_data;
+        buffer->capacity = new_capacity;
+    }
+
+    memcpy(buffer->data + buffer->size, bytes, size);
+    buffer->size += size;
+
+    return true;
+}
+
+bool append_string_to_byte_buffer(ByteBuffer *buffer, const char *string) {
+    return append_to_byte_buffer(buffer, string, strlen(string));
+}
+
+bool flush_byte_buffer(ByteBuffer *buffer, FILE *fp) {
+    assert(buffer != NULL);
+
+    size_t written = fwrite(buffer->data, 1, buffer->size, fp);
+    bool success = written == buffer->size;
+    buffer->size = 0;
+
+    return success;
+}
+
+void free_byte_buffer(ByteBuffer *buffer) {
+    assert(buffer != NULL);
+
+    free(buffer->data);
+    buffer->data = NULL;
+    buffer->size = 0;
+    buffer->capacity = 0;
+}
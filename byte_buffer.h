@@ -0,0 +1,71 @@
+#ifndef _BYTE_BUFFER_H_
+#define _BYTE_BUFFER_H_
+
+#include <stdio.h>   // For FILE
+#include <stddef.h>  // For size_t
+#include <stdbool.h> // for bool
+
+/** The default size from which callers should flush a buffer */
+#define BYTE_BUFFER_FLUSH_SIZE ((size_t) 1 << 20)
+
+/**
+ * @brief A growable array of bytes, used to collect generated output and
+ * write it with a few large writes instead of a stdio call per token.
+ */
+typedef struct ByteBuffer ByteBuffer;
+
+struct ByteBuffer
+{
+    /** The bytes in the buffer */
+    char *data;
+
+    /** The number of bytes in `data` */
+    size_t size;
+
+    /** The number of bytes allocated for `data` */
+    size_t capacity;
+};
+
+/**
+ * @brief Initializes an empty buffer with the given capacity.
+ * @param buffer The buffer
+ * @param capacity The initial capacity, in bytes
+ * @return false if memory allocation failed, true otherwise
+ */
+bool init_byte_buffer (ByteBuffer *buffer, size_t capacity);
+
+/**
+ * @brief Appends size bytes to the end of the buffer, doubling its capacity
+ * when needed.
+ * @param buffer The buffer
+ * @param bytes The bytes to append
+ * @param size The number of bytes to append
+ * @return false if memory allocation failed, true otherwise
+ */
+bool append_to_byte_buffer (ByteBuffer *buffer, const void *bytes,
+                            size_t size);
+
+/**
+ * @brief Appends a null-terminated string, without its null-terminator.
+ * @param buffer The buffer
+ * @param string The string to append
+ * @return false if memory allocation failed, true otherwise
+ */
+bool append_string_to_byte_buffer (ByteBuffer *buffer, const char *string);
+
+/**
+ * @brief Writes the contents of the buffer to the file in one write, and
+ * empties the buffer.
+ * @param buffer The buffer
+ * @param fp The file to write to
+ * @return false if the write failed, true otherwise
+ */
+bool flush_byte_buffer (ByteBuffer *buffer, FILE *fp);
+
+/**
+ * @brief Frees the memory of the buffer.
+ * @param buffer The buffer
+ */
+void free_byte_buffer (ByteBuffer *buffer);
+
+#endif /* _BYTE_BUFFER_H_ */
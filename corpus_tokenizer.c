@@ -0,0 +1,351 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>    // For read()
+#include <sys/mman.h>  // For mmap(), munmap()
+#include <sys/stat.h>  // For fstat()
+#include <stdint.h>
+
+// The AVX2 classifier is compiled whatever the compiler targets, and used
+// only when the CPU running the program supports AVX2
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define AVX2_DISPATCH
+#endif
+
+#if defined(AVX2_DISPATCH) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "corpus_tokenizer.h"
+
+#define WORD_DELIMITER ' '
+#define SENTENCE_DELIMITER '\n'
+
+// tokenize_stream reads this many bytes at a time
+#define STREAM_CHUNK_SIZE ((size_t) 1 << 20)
+
+// The text is classified this many bytes at a time, one bit per byte
+#define SCAN_BLOCK_SIZE 64
+
+/**
+ * @brief Classifies the bytes of a block of the text. Bit i of the result
+ * is set if block[i] is a word or sentence delimiter, and bit i of
+ * sentence_mask if it is a sentence delimiter. Full blocks use AVX2 if
+ * use_avx2 is set, or else SSE2 when the compiler targets it; a scalar loop
+ * handles the rest.
+ * @param block The first byte of the block
+ * @param size The number of bytes in the block, at most SCAN_BLOCK_SIZE.
+ * Bits of missing bytes are 0.
+ * @param use_avx2 The result of cpu_supports_avx2
+ * @param sentence_mask Set to the sentence delimiters mask
+ * @return The delimiters mask
+ */
+static uint64_t classify_block(const char *block, size_t size, bool use_avx2,
+                               uint64_t *sentence_mask);
+
+/**
+ * @brief Checks if classify_block can use AVX2: it was compiled with the
+ * AVX2 classifier and the CPU running the program supports AVX2.
+ * @return true if it can, false otherwise
+ */
+static bool cpu_supports_avx2(void);
+
+#if defined(AVX2_DISPATCH)
+/**
+ * @brief classify_block for a full block, with AVX2 instructions. Must be
+ * called only if cpu_supports_avx2.
+ * @param block The first byte of the block, of SCAN_BLOCK_SIZE bytes
+ * @param sentence_mask Set to the sentence delimiters mask
+ * @return The delimiters mask
+ */
+__attribute__((target("avx2")))
+static uint64_t classify_full_block_avx2(const char *block,
+                                         uint64_t *sentence_mask);
+#endif
+
+/**
+ * @brief tokenize_corpus, for a text that may start in the middle of a line.
+ * @param start The first byte of the text, after a delimiter or at the
+ * start of the corpus
+ * @param end One past the last byte of the text
+ * @param starts_sentence true if the first word of the text starts its line.
+ * Set to whether the next word after the text starts its line.
+ * @param handler Called for every word
+ * @param context Passed to handler
+ * @return true if the whole text was tokenized, false if handler stopped it
+ */
+static bool tokenize_text(const char *start, const char *end,
+                          bool *starts_sentence, word_handler_t handler,
+                          void *context);
+
+/**
+ * @brief Returns the length of the text in [start, end) up to and including
+ * its last delimiter, so that every word in it is complete.
+ * @param start The first byte of the text
+ * @param end One past the last byte of the text
+ * @param scan_start The bytes before it are known to not be delimiters
+ * @return The length, 0 if there is no delimiter in the text
+ */
+static size_t get_complete_words_length(const char *start, const char *end,
+                                        const char *scan_start);
+
+static bool cpu_supports_avx2(void) {
+#if defined(AVX2_DISPATCH)
+    return __builtin_cpu_supports("avx2");
+#else
+    return false;
+#endif
+}
+
+#if defined(AVX2_DISPATCH)
+__attribute__((target("avx2")))
+static uint64_t classify_full_block_avx2(const char *block,
+                                         uint64_t *sentence_mask) {
+    const __m256i words_delimiter = _mm256_set1_epi8(WORD_DELIMITER);
+    const __m256i sentences_delimiter = _mm256_set1_epi8(SENTENCE_DELIMITER);
+    uint64_t delimiters = 0;
+    uint64_t sentences = 0;
+
+    for (size_t i = 0; i < SCAN_BLOCK_SIZE; i += sizeof(__m256i)) {
+        __m256i bytes = _mm256_loadu_si256((const __m256i *) (block + i));
+        __m256i is_sentence = _mm256_cmpeq_epi8(bytes, sentences_delimiter);
+        __m256i is_delimiter = _mm256_or_si256(
+                is_sentence, _mm256_cmpeq_epi8(bytes, words_delimiter));
+
+        delimiters |= (uint64_t) (uint32_t)
+                _mm256_movemask_epi8(is_delimiter) << i;
+        sentences |= (uint64_t) (uint32_t)
+                _mm256_movemask_epi8(is_sentence) << i;
+    }
+
+    *sentence_mask = sentences;
+    return delimiters;
+}
+#endif
+
+static uint64_t classify_block(const char *block, size_t size, bool use_avx2,
+                               uint64_t *sentence_mask) {
+    uint64_t delimiters = 0;
+    uint64_t sentences = 0;
+    size_t i = 0;
+
+    if (size == SCAN_BLOCK_SIZE) {
+#if defined(AVX2_DISPATCH)
+        if (use_avx2) {
+            return classify_full_block_avx2(block, sentence_mask);
+        }
+#else
+        (void) use_avx2;
+#endif
+#if defined(__SSE2__)
+        const __m128i words_delimiter = _mm_set1_epi8(WORD_DELIMITER);
+        const __m128i sentences_delimiter = _mm_set1_epi8(SENTENCE_DELIMITER);
+
+        for (; i < SCAN_BLOCK_SIZE; i += sizeof(__m128i)) {
+            __m128i bytes = _mm_loadu_si128((const __m128i *) (block + i));
+            __m128i is_sentence = _mm_cmpeq_epi8(bytes, sentences_delimiter);
+            __m128i is_delimiter = _mm_or_si128(
+                    is_sentence, _mm_cmpeq_epi8(bytes, words_delimiter));
+
+            delimiters |= (uint64_t) (uint16_t)
+                    _mm_movemask_epi8(is_delimiter) << i;
+            sentences |= (uint64_t) (uint16_t)
+                    _mm_movemask_epi8(is_sentence) << i;
+        }
+#endif
+    }
+
+    // the scalar fallback, and the last partial block
+    for (; i < size; ++i) {
+        if (block[i] == SENTENCE_DELIMITER) {
+            sentences |= (uint64_t) 1 << i;
+            delimiters |= (uint64_t) 1 << i;
+        } else if (block[i] == WORD_DELIMITER) {
+            delimiters |= (uint64_t) 1 << i;
+        }
+    }
+
+    *sentence_mask = sentences;
+    return delimiters;
+}
+
+bool tokenize_corpus(const char *start, const char *end,
+                     word_handler_t handler, void *context) {
+    assert(handler != NULL);
+
+    bool starts_sentence = true;
+    return tokenize_text(start, end, &starts_sentence, handler, context);
+}
+
+static bool tokenize_text(const char *start, const char *end,
+                          bool *starts_sentence, word_handler_t handler,
+                          void *context) {
+    bool use_avx2 = cpu_supports_avx2();
+    const char *word_start = NULL; // NULL while between words
+    // 1 if the byte before the current block is a delimiter (or there is
+    // no such byte), so a word starting the block is detected
+    uint64_t previous_delimiter = 1;
+
+    for (const char *block = start; block < end; block += SCAN_BLOCK_SIZE) {
+        size_t size = (size_t) (end - block);
+        if (size > SCAN_BLOCK_SIZE) {
+            size = SCAN_BLOCK_SIZE;
+        }
+
+        uint64_t sentence_mask;
+        uint64_t delimiters = classify_block(block, size, use_avx2,
+                                             &sentence_mask);
+        uint64_t valid_mask = (size == SCAN_BLOCK_SIZE)
+                              ? ~(uint64_t) 0 : ((uint64_t) 1 << size) - 1;
+
+        // the bytes where a word starts or ends, and the sentence ends
+        uint64_t transitions =
+                (delimiters ^ ((delimiters << 1) | previous_delimiter)) &
+                valid_mask;
+        uint64_t events = transitions | sentence_mask;
+        previous_delimiter = (delimiters >> (size - 1)) & 1;
+
+        while (events != 0) {
+            int position = __builtin_ctzll(events);
+            uint64_t bit = (uint64_t) 1 << position;
+            events &= events - 1;
+
+            if ((delimiters & bit) == 0) {
+                // a word starts here
+                word_start = block + position;
+                continue;
+            }
+
+            if (word_start != NULL) {
+                // the word ends here
+                WordView word = {word_start,
+                                 (size_t) (block + position - word_start)};
+                if (!handler(&word, *starts_sentence, context)) {
+                    return false;
+                }
+
+                word_start = NULL;
+                *starts_sentence = false;
+            }
+
+            if (sentence_mask & bit) {
+                *starts_sentence = true;
+            }
+        }
+    }
+
+    if (word_start != NULL) {
+        // the text ends in the middle of a word
+        WordView word = {word_start, (size_t) (end - word_start)};
+        return handler(&word, *starts_sentence, context);
+    }
+
+    return true;
+}
+
+static size_t get_complete_words_length(const char *start, const char *end,
+                                        const char *scan_start) {
+    for (const char *byte = end; byte > scan_start; --byte) {
+        if (byte[-1] == WORD_DELIMITER || byte[-1] == SENTENCE_DELIMITER) {
+            return (size_t) (byte - start);
+        }
+    }
+
+    return 0;
+}
+
+bool tokenize_stream(int fd, word_handler_t handler, void *context) {
+    assert(handler != NULL);
+
+    size_t capacity = STREAM_CHUNK_SIZE;
+    char *buffer = (char *) malloc(capacity);
+    if (buffer == NULL) {
+        return false;
+    }
+
+    // the buffer holds the start of a word that continues in the next chunk,
+    // followed by the bytes read after it
+    size_t size = 0;
+    bool starts_sentence = true;
+    bool completed = false;
+
+    while (true) {
+        if (size == capacity) {
+            // a word longer than the buffer, it must be whole to be handled
+            char *grown_buffer = (char *) realloc(buffer, capacity * 2);
+            if (grown_buffer == NULL) {
+                break;
+            }
+            buffer = grown_buffer;
+            capacity *= 2;
+        }
+
+        ssize_t read_size = read(fd, buffer + size, capacity - size);
+        if (read_size < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        if (read_size == 0) {
+            // the end of the stream also ends its last word
+            completed = tokenize_text(buffer, buffer + size, &starts_sentence,
+                                      handler, context);
+            break;
+        }
+
+        // the partial word before the new bytes has no delimiters
+        const char *scan_start = buffer + size;
+        size += (size_t) read_size;
+        size_t text_size = get_complete_words_length(buffer, buffer + size,
+                                                     scan_start);
+
+        if (!tokenize_text(buffer, buffer + text_size, &starts_sentence,
+                           handler, context)) {
+            break;
+        }
+
+        memmove(buffer, buffer + text_size, size - text_size);
+        size -= text_size;
+    }
+
+    free(buffer);
+    return completed;
+}
+
+bool open_corpus(FILE *fp, Corpus *corpus) {
+    assert(fp != NULL);
+    assert(corpus != NULL);
+
+    struct stat file_stat;
+    long position = ftell(fp);
+
+    if (position == 0 && fstat(fileno(fp), &file_stat) == 0 &&
+        S_ISREG(file_stat.st_mode) && file_stat.st_size > 0) {
+        void *mapping = mmap(NULL, (size_t) file_stat.st_size, PROT_READ,
+                             MAP_PRIVATE, fileno(fp), 0);
+
+        if (mapping != MAP_FAILED) {
+            // the corpus is read once from start to end
+            madvise(mapping, (size_t) file_stat.st_size, MADV_SEQUENTIAL);
+
+            corpus->text = (const char *) mapping;
+            corpus->size = (size_t) file_stat.st_size;
+            return true;
+        }
+    }
+
+    // not a regular file (or an empty one), it must be streamed
+    return false;
+}
+
+void close_corpus(Corpus *corpus) {
+    assert(corpus != NULL);
+
+    munmap((void *) corpus->text, corpus->size);
+
+    corpus->text = NULL;
+    corpus->size = 0;
+}
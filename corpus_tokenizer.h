@@ -0,0 +1,92 @@
+#ifndef _CORPUS_TOKENIZER_H_
+#define _CORPUS_TOKENIZER_H_
+
+#include <stdio.h>   // For FILE
+#include <stddef.h>  // For size_t
+#include <stdbool.h> // for bool
+
+/**
+ * @brief A word inside a larger buffer (e.g. a mapped corpus). It is not
+ * null-terminated.
+ */
+typedef struct WordView WordView;
+
+struct WordView
+{
+    /** The first character of the word */
+    const char *start;
+
+    /** The number of characters in the word */
+    size_t length;
+};
+
+/**
+ * @brief The whole text of a corpus file, mapped into memory.
+ */
+typedef struct Corpus Corpus;
+
+struct Corpus
+{
+    /** The text of the corpus, not null-terminated */
+    const char *text;
+
+    /** The number of bytes in `text` */
+    size_t size;
+};
+
+/**
+ * Called by tokenize_corpus for every word, in order.
+ * @param word The word, inside the tokenized text
+ * @param starts_sentence true if this is the first word of its line
+ * @param context The context given to tokenize_corpus
+ * @return true to continue tokenizing, false to stop
+ */
+typedef bool (*word_handler_t)(const WordView *word, bool starts_sentence,
+                               void *context);
+
+/**
+ * @brief Splits the text in [start, end) into lines (sentences), and the
+ * lines into words separated by spaces, and calls handler for every word.
+ * The text is not changed or copied, and lines can be of any length.
+ * @param start The first byte of the text
+ * @param end One past the last byte of the text
+ * @param handler Called for every word
+ * @param context Passed to handler
+ * @return true if the whole text was tokenized, false if handler stopped it
+ */
+bool tokenize_corpus (const char *start, const char *end,
+                      word_handler_t handler, void *context);
+
+/**
+ * @brief Tokenizes the text read from the given file descriptor, like
+ * tokenize_corpus, for files that can not be mapped (e.g. pipes). The text
+ * is read in chunks of a constant size, and only the start of a word that
+ * continues in the next chunk is kept between them, so the memory used does
+ * not depend on the length of the text (a word longer than a chunk is kept
+ * whole). Reading stops when handler stops the tokenizing.
+ * @param fd The file descriptor, read until its end
+ * @param handler Called for every word
+ * @param context Passed to handler
+ * @return true if the whole text was tokenized, false if handler stopped it,
+ * reading failed or memory allocation failed
+ */
+bool tokenize_stream (int fd, word_handler_t handler, void *context);
+
+/**
+ * @brief Maps the given file into memory as a corpus. Close it with
+ * close_corpus.
+ * @param fp The file, at its start
+ * @param corpus Filled with the corpus
+ * @return false if the file could not be mapped (it is not a regular file,
+ * is empty, or was read from), true otherwise. Read it with tokenize_stream
+ * then.
+ */
+bool open_corpus (FILE *fp, Corpus *corpus);
+
+/**
+ * @brief Unmaps a corpus mapped by open_corpus.
+ * @param corpus The corpus
+ */
+void close_corpus (Corpus *corpus);
+
+#endif /* _CORPUS_TOKENIZER_H_ */
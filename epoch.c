@@ -0,0 +1,166 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <sched.h> // For sched_yield()
+
+#include "epoch.h"
+
+/**
+ * @brief Returns the oldest epoch a reader is inside of, EPOCH_IDLE if no
+ * reader is inside a read section.
+ * @param domain The domain
+ * @return The epoch
+ */
+static uint64_t get_oldest_reader_epoch(EpochDomain *domain);
+
+/**
+ * @brief Waits until no reader is inside a read section that started at
+ * the given epoch or before it.
+ * @param domain The domain
+ * @param epoch The epoch
+ */
+static void wait_for_readers(EpochDomain *domain, uint64_t epoch);
+
+EpochDomain *new_epoch_domain(void) {
+    // the reader slots must be aligned to their cache lines
+    EpochDomain *domain = (EpochDomain *) aligned_alloc(
+            _Alignof(EpochDomain), sizeof *domain);
+    if (domain == NULL) {
+        return NULL;
+    }
+
+    memset(domain, 0, sizeof *domain);
+    for (int i = 0; i < EPOCH_MAX_READERS; ++i) {
+        domain->readers[i].epoch = EPOCH_IDLE;
+    }
+
+    return domain;
+}
+
+int register_epoch_reader(EpochDomain *domain) {
+    assert(domain != NULL);
+
+    for (int i = 0; i < EPOCH_MAX_READERS; ++i) {
+        bool expected = false;
+        if (__atomic_compare_exchange_n(&domain->readers[i].registered,
+                                        &expected, true, false,
+                                        __ATOMIC_ACQ_REL,
+                                        __ATOMIC_RELAXED)) {
+            return i;
+        }
+    }
+
+    return EPOCH_NO_READER;
+}
+
+void unregister_epoch_reader(EpochDomain *domain, int reader) {
+    assert(domain != NULL);
+    assert(reader >= 0 && reader < EPOCH_MAX_READERS);
+
+    __atomic_store_n(&domain->readers[reader].registered, false,
+                     __ATOMIC_RELEASE);
+}
+
+void enter_epoch(EpochDomain *domain, int reader) {
+    assert(domain != NULL);
+    assert(reader >= 0 && reader < EPOCH_MAX_READERS);
+
+    uint64_t epoch = __atomic_load_n(&domain->global_epoch, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&domain->readers[reader].epoch, epoch, __ATOMIC_SEQ_CST);
+
+    // the pointers of the read section are only loaded after the writer can
+    // see the reader's epoch
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+void exit_epoch(EpochDomain *domain, int reader) {
+    assert(domain != NULL);
+    assert(reader >= 0 && reader < EPOCH_MAX_READERS);
+
+    __atomic_store_n(&domain->readers[reader].epoch, EPOCH_IDLE,
+                     __ATOMIC_RELEASE);
+}
+
+static uint64_t get_oldest_reader_epoch(EpochDomain *domain) {
+    uint64_t oldest_epoch = EPOCH_IDLE;
+
+    for (int i = 0; i < EPOCH_MAX_READERS; ++i) {
+        uint64_t epoch = __atomic_load_n(&domain->readers[i].epoch,
+                                         __ATOMIC_SEQ_CST);
+        if (epoch < oldest_epoch) {
+            oldest_epoch = epoch;
+        }
+    }
+
+    return oldest_epoch;
+}
+
+static void wait_for_readers(EpochDomain *domain, uint64_t epoch) {
+    while (get_oldest_reader_epoch(domain) <= epoch) {
+        sched_yield();
+    }
+}
+
+void retire_to_epoch(EpochDomain *domain, void *memory) {
+    assert(domain != NULL);
+
+    if (memory == NULL) {
+        return;
+    }
+
+    // readers that enter from now on get a later epoch, and can only load
+    // the new pointers
+    uint64_t epoch = __atomic_fetch_add(&domain->global_epoch, 1,
+                                        __ATOMIC_SEQ_CST);
+
+    RetiredBlock *block = (RetiredBlock *) malloc(sizeof *block);
+    if (block == NULL) {
+        // no memory to remember the block, wait and free it right away
+        wait_for_readers(domain, epoch);
+        free(memory);
+        return;
+    }
+
+    block->memory = memory;
+    block->epoch = epoch;
+    block->next = domain->retired;
+    domain->retired = block;
+
+    reclaim_epoch_memory(domain);
+}
+
+void reclaim_epoch_memory(EpochDomain *domain) {
+    assert(domain != NULL);
+
+    uint64_t oldest_epoch = get_oldest_reader_epoch(domain);
+
+    RetiredBlock **link = &domain->retired;
+    while (*link != NULL) {
+        RetiredBlock *block = *link;
+
+        if (block->epoch < oldest_epoch) {
+            *link = block->next;
+            free(block->memory);
+            free(block);
+        } else {
+            link = &block->next;
+        }
+    }
+}
+
+void free_epoch_domain(EpochDomain **ptr_domain) {
+    if (*ptr_domain == NULL) {
+        return;
+    }
+
+    RetiredBlock *block = (*ptr_domain)->retired;
+    while (block != NULL) {
+        RetiredBlock *next_block = block->next;
+        free(block->memory);
+        free(block);
+        block = next_block;
+    }
+
+    free(*ptr_domain);
+    *ptr_domain = NULL;
+}
@@ -0,0 +1,132 @@
+#ifndef _EPOCH_H_
+#define _EPOCH_H_
+
+#include <stdint.h>  // For uint64_t
+#include <stdbool.h> // for bool
+
+/** The maximal number of readers registered to a domain at the same time */
+#define EPOCH_MAX_READERS 64
+
+/** Returned by register_epoch_reader when all the reader slots are taken */
+#define EPOCH_NO_READER ((int)(-1))
+
+/** The epoch of a reader that is not inside a read section */
+#define EPOCH_IDLE UINT64_MAX
+
+/** The size of a cache line, every reader slot takes a line of its own */
+#define EPOCH_CACHE_LINE_SIZE 64
+
+/**
+ * @brief Epoch-based memory reclamation, for structures with a single writer
+ * and lock-free readers. The writer replaces a block by publishing a new
+ * pointer to its copy, and retires the old block instead of freeing it. The
+ * block is freed once every reader that could have loaded the old pointer
+ * left its read section.
+ */
+typedef struct EpochDomain EpochDomain;
+
+/**
+ * @brief A block of memory waiting to be freed
+ */
+typedef struct RetiredBlock RetiredBlock;
+
+/**
+ * @brief The state of one reader, alone in its cache line so readers do not
+ * slow each other down
+ */
+typedef struct EpochReaderSlot EpochReaderSlot;
+
+struct RetiredBlock
+{
+    /** The memory to free */
+    void *memory;
+
+    /** The global epoch when the memory was retired */
+    uint64_t epoch;
+
+    /** The previously retired block */
+    RetiredBlock *next;
+};
+
+struct EpochReaderSlot
+{
+    /** The global epoch when the reader entered its current read section,
+     * EPOCH_IDLE outside of read sections. Accessed atomically. */
+    _Alignas(EPOCH_CACHE_LINE_SIZE) uint64_t epoch;
+
+    /** true if a reader owns this slot. Accessed atomically. */
+    bool registered;
+};
+
+struct EpochDomain
+{
+    /** Incremented by every retire. Accessed atomically. */
+    uint64_t global_epoch;
+
+    /** The slots of the readers */
+    EpochReaderSlot readers[EPOCH_MAX_READERS];
+
+    /** The blocks that were retired and not freed yet, newest first. Only
+     * accessed by the writer. */
+    RetiredBlock *retired;
+};
+
+/**
+ * @brief A "constructor" for EpochDomain, you are resposible for freeing it
+ * with free_epoch_domain.
+ * @return A new domain without readers, NULL if memory allocation failed.
+ */
+EpochDomain *new_epoch_domain (void);
+
+/**
+ * @brief Takes a reader slot, for a thread that is going to read.
+ * @param domain The domain
+ * @return The reader's slot, EPOCH_NO_READER if all the slots are taken
+ */
+int register_epoch_reader (EpochDomain *domain);
+
+/**
+ * @brief Releases a reader slot. The reader must not be in a read section.
+ * @param domain The domain
+ * @param reader The slot returned by register_epoch_reader
+ */
+void unregister_epoch_reader (EpochDomain *domain, int reader);
+
+/**
+ * @brief Starts a read section. Every pointer loaded inside it stays valid
+ * until exit_epoch.
+ * @param domain The domain
+ * @param reader The reader's slot
+ */
+void enter_epoch (EpochDomain *domain, int reader);
+
+/**
+ * @brief Ends a read section.
+ * @param domain The domain
+ * @param reader The reader's slot
+ */
+void exit_epoch (EpochDomain *domain, int reader);
+
+/**
+ * @brief Frees the given memory once no reader can use it anymore. Must be
+ * called by the writer, after the pointers to the memory were replaced.
+ * @param domain The domain
+ * @param memory The memory to free, may be NULL
+ */
+void retire_to_epoch (EpochDomain *domain, void *memory);
+
+/**
+ * @brief Frees the retired memory that no reader can use anymore. Must be
+ * called by the writer.
+ * @param domain The domain
+ */
+void reclaim_epoch_memory (EpochDomain *domain);
+
+/**
+ * @brief Frees the domain and all the retired memory. There must be no
+ * readers left.
+ * @param ptr_domain Pointer to the domain, set to NULL afterwards.
+ */
+void free_epoch_domain (EpochDomain **ptr_domain);
+
+#endif /* _EPOCH_H_ */
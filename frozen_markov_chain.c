@@ -0,0 +1,2083 @@
+#include <string.h>
+#include <assert.h>
+#include <fcntl.h>     // For open()
+#include <unistd.h>    // For close(), getpid(), unlink()
+#include <sys/mman.h>  // For mmap(), munmap()
+#include <sys/stat.h>  // For fstat()
+#include <pthread.h>
+
+#include "frozen_markov_chain.h"
+
+// Every data copy in the pool starts at a multiple of this
+#define DATA_POOL_ALIGNMENT 8
+#define MAX_WALK_THREADS 64
+// The number of walks a thread of simulate_frozen_walks advances together
+#define WALKERS_BATCH_SIZE 1024
+// The index that matches the nodes of merged snapshots is grown once more
+// than 1 / MERGE_INDEX_LOAD_FACTOR_INVERSE of its slots are used
+#define MERGE_INDEX_INITIAL_CAPACITY 16
+#define MERGE_INDEX_LOAD_FACTOR_INVERSE 2
+#define MERGE_HASH_MULTIPLIER 0x9E3779B97F4A7C15ULL
+#define MERGE_HASH_SHIFT 32
+// Snapshots are written to "<path>.<pid>.tmp" and then renamed over path
+#define SNAPSHOT_TEMP_PATH_FORMAT "%s.%ld.tmp"
+#define SNAPSHOT_FILE_MODE 0666
+
+#define ALIGN_UP(size) \
+    (((size) + DATA_POOL_ALIGNMENT - 1) & ~((uint64_t) DATA_POOL_ALIGNMENT - 1))
+
+/**
+ * @brief The header at the start of every snapshot file. Every section
+ * offset is relative to the start of the file.
+ */
+typedef struct SnapshotHeader
+{
+    char magic[FROZEN_CHAIN_MAGIC_LENGTH];
+    uint32_t version;
+    uint32_t header_size;
+    int32_t node_count;
+    int32_t edge_count;
+    int32_t start_count;
+    uint32_t weight_bits; // 0 in the snapshots of chains that were not
+                          // quantized, so their format did not change
+    uint64_t data_pool_size;
+    uint64_t file_size;
+    uint64_t edge_offsets_offset;
+    uint64_t successors_offset;
+    uint64_t cumulative_frequencies_offset;
+    uint64_t start_ids_offset;
+    uint64_t last_flags_offset;
+    uint64_t data_offsets_offset;
+    uint64_t data_pool_offset;
+} SnapshotHeader;
+
+/**
+ * @brief Computes the layout of the snapshot of the given chain, and fills
+ * the sizes and section offsets of the header.
+ * @param frozen_chain The chain
+ * @param header The header to fill
+ */
+static void layout_snapshot(const FrozenMarkovChain *frozen_chain,
+                            SnapshotHeader *header);
+
+/**
+ * @brief Writes size bytes from data at the given offset of the file,
+ * padding the file with zeros up to it.
+ * @param fp The file
+ * @param offset The offset to write at, not before the current position
+ * @param data The bytes to write
+ * @param size The number of bytes to write
+ * @return true on success, false on a write error
+ */
+static bool write_section(FILE *fp, uint64_t offset, const void *data,
+                          uint64_t size);
+
+/**
+ * @brief Creates a new temporary file next to path to write a snapshot to.
+ * Snapshots are never written in place, since path may be mapped by a
+ * loaded chain (e.g. one of the inputs of a merge), and truncating a mapped
+ * file makes its readers fault.
+ * @param path The path of the snapshot file
+ * @param temp_path Set to the allocated path of the temporary file
+ * @return The temporary file opened for writing, NULL on failure
+ */
+static FILE *open_snapshot_temp_file(const char *path, char **temp_path);
+
+/**
+ * @brief Closes the temporary file of a snapshot and, if it was fully
+ * written, renames it over path, replacing the old file at once. Otherwise
+ * the temporary file is removed and path is left as it was. Frees temp_path.
+ * @param fp The temporary file
+ * @param temp_path The path of the temporary file
+ * @param path The path of the snapshot file
+ * @param success Whether all of the snapshot was written
+ * @return true if the snapshot replaced path, false otherwise
+ */
+static bool close_snapshot_temp_file(FILE *fp, char *temp_path,
+                                     const char *path, bool success);
+
+/**
+ * @brief Checks that the header describes a snapshot that fits in a file of
+ * the given size.
+ * @param header The header, inside the mapped file
+ * @param file_size The size of the file
+ * @return true if the header is valid, false otherwise
+ */
+static bool is_valid_snapshot_header(const SnapshotHeader *header,
+                                     uint64_t file_size);
+
+/**
+ * @brief Checks that the arrays of a loaded snapshot are consistent, so
+ * walks on it never read out of them: the edges of every node are inside
+ * the edges array, every node id is in range, the cumulative weights of
+ * every node are increasing and positive, and every data offset is inside
+ * the data pool.
+ * @param frozen_chain The chain, its arrays inside the mapped file
+ * @return true if the arrays are valid, false otherwise
+ */
+static bool is_valid_snapshot_arrays(const FrozenMarkovChain *frozen_chain);
+
+/**
+ * @brief A slot of the hash index merge_frozen_markov_chain_files matches
+ * the nodes of the snapshots with
+ */
+typedef struct MergeIndexEntry
+{
+    unsigned long hash;
+    int32_t node_id; // the merged id of the node, FROZEN_NO_NODE if empty
+} MergeIndexEntry;
+
+/**
+ * @brief A node of one of the chains of a merge
+ */
+typedef struct MergeSource
+{
+    int32_t chain; // the index of the chain, FROZEN_NO_NODE for no node
+    int32_t id; // the id of the node in the chain
+} MergeSource;
+
+/**
+ * @brief The state of merge_frozen_markov_chain_files
+ */
+typedef struct SnapshotMerge
+{
+    FrozenMarkovChain **chains; // the mapped snapshots, in order
+    int num_of_chains;
+    int32_t node_count; // the number of nodes of the merged chain
+    int32_t **merged_ids; // merged_ids[i][id] is the merged id of node id of
+                          // chain i
+    MergeSource *first_sources; // first_sources[node_id] is the node of the
+                                // first chain that has a merged node
+    MergeSource **next_sources; // next_sources[i][id] is the same node as
+                                // node id of chain i in the next chain that
+                                // has it, of chain FROZEN_NO_NODE if none
+    int32_t *edge_offsets; // of the merged chain
+    int32_t *positions; // the index in `successors` of every merged node
+                        // that follows the node being merged, FROZEN_NO_NODE
+                        // for the rest
+    int32_t *successors; // the merged edges of the node being merged
+    int64_t *frequencies; // the frequency of every edge in `successors`, the
+                          // sums of the chains' frequencies may not fit in
+                          // an int32_t
+    int32_t *cumulative_frequencies; // the running sums of `frequencies`, as
+                                     // they are written
+} SnapshotMerge;
+
+/**
+ * @brief Allocates the arrays of the merge for its chains.
+ * @param merge The merge, its chains must be loaded
+ * @return false if allocation failed or the merged chain could have more
+ * nodes than fit in an int32_t, true otherwise
+ */
+static bool allocate_snapshot_merge(SnapshotMerge *merge);
+
+/**
+ * @brief Frees the arrays and the chains of the merge.
+ * @param merge The merge
+ */
+static void free_snapshot_merge(SnapshotMerge *merge);
+
+/**
+ * @brief Returns the first chain that has the given merged node, in O(1).
+ * @param merge The merge
+ * @param node_id The merged id of the node
+ * @param source_id Set to the id of the node in the returned chain
+ * @return The chain
+ */
+static const FrozenMarkovChain *get_merged_node_source(
+        const SnapshotMerge *merge, int32_t node_id, int32_t *source_id);
+
+/**
+ * @brief Matches the nodes of all the chains by their data, and gives every
+ * distinct node its merged id.
+ * @param merge The merge
+ * @param hash_func Hashes the data of a node
+ * @param comp_func Compares the data of two nodes
+ * @return false if allocation failed or two nodes of the same chain have
+ * equal data, true otherwise
+ */
+static bool map_merged_nodes(SnapshotMerge *merge, hash_func_t hash_func,
+                             comp_func_t comp_func);
+
+/**
+ * @brief Computes the edges of a merged node into the `successors` and
+ * `frequencies` of the merge: the edges of the first chain that has the
+ * node, then the new edges of the next chains, frequencies summed. Only the
+ * chains that have the node are visited, see next_sources.
+ * @param merge The merge
+ * @param node_id The merged id of the node
+ * @return The number of edges
+ */
+static int32_t merge_node_edges(SnapshotMerge *merge, int32_t node_id);
+
+/**
+ * @brief Writes the successors or the cumulative frequencies of all the
+ * merged edges, as a section of the merged snapshot.
+ * @param merge The merge
+ * @param fp The merged snapshot file
+ * @param offset The offset of the section
+ * @param cumulative true to write the cumulative frequencies, false to
+ * write the successors
+ * @return true on success, false on a write error
+ */
+static bool write_merged_edges(SnapshotMerge *merge, FILE *fp,
+                               uint64_t offset, bool cumulative);
+
+/**
+ * @brief Writes the start ids, the last flags, the data offsets and the data
+ * pool sections of the merged snapshot.
+ * @param merge The merge
+ * @param fp The merged snapshot file
+ * @param header The header of the merged snapshot
+ * @param data_size Returns the number of bytes of the data of a node
+ * @return true on success, false on a write error
+ */
+static bool write_merged_nodes(const SnapshotMerge *merge, FILE *fp,
+                               const SnapshotHeader *header,
+                               data_size_func_t data_size);
+
+/**
+ * @brief Writes the merged snapshot, once its nodes are mapped.
+ * @param merge The merge
+ * @param output_path The path of the merged snapshot file
+ * @param data_size Returns the number of bytes of the data of a node
+ * @return true on success, false if the merged chain has more edges than fit
+ * in an int32_t, a node whose summed frequencies do not fit in an int32_t,
+ * or the file could not be written
+ */
+static bool write_merged_snapshot(SnapshotMerge *merge,
+                                  const char *output_path,
+                                  data_size_func_t data_size);
+
+/**
+ * @brief The walks one thread of generate_frozen_walks generates
+ */
+typedef struct WalksJob
+{
+    const FrozenMarkovChain *frozen_chain;
+    uint64_t seed;
+    uint64_t first_stream; // the stream of walks[0]
+    int num_of_walks;
+    int32_t first_node_id;
+    int max_length;
+    int32_t *walks;
+    int *walk_lengths;
+} WalksJob;
+
+/**
+ * @brief The thread routine of generate_frozen_walks
+ * @param job The WalksJob
+ * @return NULL
+ */
+static void *generate_walks_job(void *job);
+
+/**
+ * @brief The walks a thread of simulate_frozen_walks advances together, as a
+ * structure of arrays. Walk i of the batch is at node_ids[i], and so on.
+ */
+typedef struct WalkersBatch
+{
+    int32_t node_ids[WALKERS_BATCH_SIZE];
+    int32_t lengths[WALKERS_BATCH_SIZE];
+    uint64_t keys[WALKERS_BATCH_SIZE]; // the random state of every walk
+    uint64_t counters[WALKERS_BATCH_SIZE];
+    int32_t total_weights[WALKERS_BATCH_SIZE]; // of the current node
+    int32_t random_weights[WALKERS_BATCH_SIZE];
+} WalkersBatch;
+
+/**
+ * @brief The walks one thread of simulate_frozen_walks simulates
+ */
+typedef struct SimulationJob
+{
+    const FrozenMarkovChain *frozen_chain;
+    uint64_t seed;
+    uint64_t first_stream; // the stream of the job's first walk
+    uint64_t num_of_walks;
+    int32_t first_node_id;
+    int max_length;
+    uint64_t *length_histogram; // the aggregates of the job's walks
+    uint64_t *visit_counts;
+    bool failed; // true if memory allocation failed
+} SimulationJob;
+
+/**
+ * @brief The thread routine of simulate_frozen_walks
+ * @param job The SimulationJob
+ * @return NULL
+ */
+static void *simulate_walks_job(void *job);
+
+/**
+ * @brief Starts a walk in a slot of the batch, and counts its first node.
+ * @param job The job
+ * @param batch The batch
+ * @param slot The slot of the walk
+ * @param stream The random stream of the walk
+ * @return true if the walk goes on, false if it already ended (it was
+ * counted in the histogram then)
+ */
+static bool start_batched_walk(SimulationJob *job, WalkersBatch *batch,
+                               int slot, uint64_t stream);
+
+/**
+ * @brief Moves every walk of the batch one node forward, the same way
+ * generate_frozen_walk does, and marks the walks that ended with
+ * FROZEN_NO_NODE.
+ * @param job The job
+ * @param batch The batch
+ * @param size The number of walks in the batch
+ */
+static void step_batched_walks(SimulationJob *job, WalkersBatch *batch,
+                               int size);
+
+/**
+ * @brief Replaces the walks of the batch that ended by the next walks of the
+ * job, and packs the rest at the start of the batch once no walks are left.
+ * @param job The job
+ * @param batch The batch
+ * @param size The number of walks in the batch
+ * @param next_walk The index of the next walk of the job, advanced
+ * @return The new number of walks in the batch
+ */
+static int refill_batched_walks(SimulationJob *job, WalkersBatch *batch,
+                                int size, uint64_t *next_walk);
+
+/**
+ * @brief An edge of the node being compacted
+ */
+typedef struct CompactedEdge
+{
+    int32_t edge; // the index of the edge in the chain being compacted
+    int32_t frequency;
+} CompactedEdge;
+
+/**
+ * @brief Returns the number of bytes of every cumulative weight of a chain.
+ * @param weight_bits The weight_bits of the chain
+ * @return The size of an int32_t if the weights are not quantized, the size
+ * of the quantized weight otherwise
+ */
+static size_t get_cumulative_weight_size(int32_t weight_bits);
+
+/**
+ * @brief Returns the prefix sum of the weights of the edges of a node, up
+ * to the given edge, whether they are quantized or not.
+ * @param frozen_chain The frozen chain
+ * @param edge The index of the edge
+ * @return The prefix sum
+ */
+static inline int32_t get_cumulative_weight(
+        const FrozenMarkovChain *frozen_chain, int32_t edge);
+
+/**
+ * @brief Gives every node that compact_frozen_markov_chain keeps its new id.
+ * @param frozen_chain The chain being compacted
+ * @param min_count Nodes that occur less times are dropped
+ * @param new_ids Set to the new id of every node, FROZEN_NO_NODE for the
+ * dropped nodes
+ * @return The number of kept nodes, -1 if memory allocation failed
+ */
+static int32_t map_compacted_nodes(const FrozenMarkovChain *frozen_chain,
+                                   int32_t min_count, int32_t *new_ids);
+
+/**
+ * @brief Selects the edges of a node that compact_frozen_markov_chain keeps,
+ * before their weights are quantized.
+ * @param frozen_chain The chain being compacted
+ * @param node_id The id of the node
+ * @param options The thresholds
+ * @param new_ids The new ids of the nodes
+ * @param edges Set to the kept edges, in their order in the node. Must have
+ * room for all the edges of the node.
+ * @return The number of kept edges
+ */
+static int32_t select_compacted_edges(const FrozenMarkovChain *frozen_chain,
+                                      int32_t node_id,
+                                      const CompactionOptions *options,
+                                      const int32_t *new_ids,
+                                      CompactedEdge *edges);
+
+/**
+ * @brief qsort comparator of CompactedEdges, the most frequent first, and
+ * the earliest first on ties.
+ */
+static int compare_edges_by_frequency(const void *first, const void *second);
+
+/**
+ * @brief qsort comparator of CompactedEdges, by their order in their node.
+ */
+static int compare_edges_by_order(const void *first, const void *second);
+
+/**
+ * @brief Writes the selected edges of a node into the compacted chain,
+ * quantizing their weights if it has quantized weights.
+ * @param compact_chain The compacted chain, its arrays allocated
+ * @param frozen_chain The chain being compacted
+ * @param new_ids The new ids of the nodes
+ * @param edges The selected edges
+ * @param num_of_edges The number of selected edges
+ * @param edge_idx The index of the first edge to write in compact_chain
+ * @return The index after the last written edge
+ */
+static int32_t write_compacted_edges(FrozenMarkovChain *compact_chain,
+                                     const FrozenMarkovChain *frozen_chain,
+                                     const int32_t *new_ids,
+                                     const CompactedEdge *edges,
+                                     int32_t num_of_edges, int32_t edge_idx);
+
+/**
+ * @brief Shrinks the edge arrays of the compacted chain to its edge count.
+ * @param compact_chain The compacted chain
+ */
+static void shrink_compacted_edges(FrozenMarkovChain *compact_chain);
+
+/**
+ * @brief Allocates the arrays of the frozen chain for the given sizes.
+ * @param frozen_chain The frozen chain, its sizes must be set
+ * @return false if allocation failed, true otherwise
+ */
+static bool allocate_frozen_arrays(FrozenMarkovChain *frozen_chain);
+
+/**
+ * @brief The freeze_data_func_t of freeze_markov_chain, copies the data
+ * @param data The data
+ * @param data_pool The pool
+ * @param data_offset Set to the offset of the copy
+ * @param context Pointer to the data_size_func_t of the data
+ * @return false if memory allocation failed, true otherwise
+ */
+static bool copy_frozen_data(data_ptr_t data, ByteBuffer *data_pool,
+                             uint64_t *data_offset, void *context);
+
+FrozenMarkovChain *freeze_markov_chain(MarkovChain *markov_chain,
+                                       data_size_func_t data_size) {
+    return freeze_markov_chain_with(markov_chain, copy_frozen_data,
+                                    &data_size, markov_chain->print_func);
+}
+
+static bool copy_frozen_data(data_ptr_t data, ByteBuffer *data_pool,
+                             uint64_t *data_offset, void *context) {
+    data_size_func_t data_size = *(data_size_func_t *) context;
+
+    *data_offset = data_pool->size;
+    return append_to_byte_buffer(data_pool, data, data_size(data));
+}
+
+FrozenMarkovChain *freeze_markov_chain_with(MarkovChain *markov_chain,
+                                            freeze_data_func_t freeze_data,
+                                            void *context,
+                                            print_func_t print_func) {
+    assert(markov_chain != NULL);
+    assert(freeze_data != NULL);
+
+    static const char padding[DATA_POOL_ALIGNMENT] = {0};
+
+    FrozenMarkovChain *frozen_chain =
+            (FrozenMarkovChain *) calloc(1, sizeof *frozen_chain);
+    if (frozen_chain == NULL) {
+        return NULL;
+    }
+
+    frozen_chain->print_func = print_func;
+    frozen_chain->start_count = markov_chain->start_candidates_size;
+
+    // first pass: count the nodes and the edges
+    Node *node = (markov_chain->database != NULL)
+                 ? markov_chain->database->first : NULL;
+    for (; node != NULL; node = node->next) {
+        frozen_chain->node_count++;
+        frozen_chain->edge_count += node->data->frequencies_list_size;
+    }
+
+    ByteBuffer data_pool;
+    if (!allocate_frozen_arrays(frozen_chain)) {
+        free_frozen_markov_chain(&frozen_chain);
+        return NULL;
+    }
+    if (!init_byte_buffer(&data_pool, DATA_POOL_ALIGNMENT)) {
+        free_frozen_markov_chain(&frozen_chain);
+        return NULL;
+    }
+
+    // second pass: copy the nodes and their edges
+    int32_t edge_idx = 0;
+    for (node = markov_chain->database != NULL
+                ? markov_chain->database->first : NULL;
+         node != NULL; node = node->next) {
+        MarkovNode *markov_node = node->data;
+        int32_t id = markov_node->id;
+
+        size_t pool_size = data_pool.size;
+        if (!freeze_data(markov_node->data, &data_pool,
+                         &frozen_chain->data_offsets[id], context) ||
+            // every new data in the pool starts aligned
+            (data_pool.size != pool_size &&
+             !append_to_byte_buffer(&data_pool, padding,
+                                    ALIGN_UP(data_pool.size) -
+                                    data_pool.size))) {
+            free_byte_buffer(&data_pool);
+            free_frozen_markov_chain(&frozen_chain);
+            return NULL;
+        }
+
+        frozen_chain->last_flags[id] = markov_node->is_last ? 1 : 0;
+
+        frozen_chain->edge_offsets[id] = edge_idx;
+        int32_t sum = 0;
+        for (int i = 0; i < markov_node->frequencies_list_size; ++i) {
+            MarkovNodeFrequency *edge = &markov_node->frequencies_list[i];
+            sum += edge->frequency;
+
+            frozen_chain->successors[edge_idx] = edge->markov_node->id;
+            frozen_chain->cumulative_frequencies[edge_idx] = sum;
+            edge_idx++;
+        }
+    }
+    frozen_chain->edge_offsets[frozen_chain->node_count] = edge_idx;
+
+    // the frozen chain takes the pool, without its unused capacity
+    char *shrunk_pool = (char *) realloc(
+            data_pool.data, data_pool.size + DATA_POOL_ALIGNMENT);
+    frozen_chain->data_pool = (shrunk_pool != NULL) ? shrunk_pool
+                                                    : data_pool.data;
+    frozen_chain->data_pool_size = data_pool.size;
+
+    for (int i = 0; i < frozen_chain->start_count; ++i) {
+        frozen_chain->start_ids[i] = markov_chain->start_candidates[i]->id;
+    }
+
+    return frozen_chain;
+}
+
+static bool allocate_frozen_arrays(FrozenMarkovChain *frozen_chain) {
+    int32_t node_count = frozen_chain->node_count;
+    int32_t edge_count = frozen_chain->edge_count;
+    size_t weight_size = get_cumulative_weight_size(frozen_chain->weight_bits);
+
+    // +1 so that empty chains still get valid (non-NULL) arrays
+    frozen_chain->edge_offsets = (int32_t *) malloc(
+            (node_count + 1) * sizeof *frozen_chain->edge_offsets);
+    frozen_chain->successors = (int32_t *) malloc(
+            (edge_count + 1) * sizeof *frozen_chain->successors);
+    if (frozen_chain->weight_bits == 0) {
+        frozen_chain->cumulative_frequencies = (int32_t *) malloc(
+                (edge_count + 1) * weight_size);
+    } else {
+        frozen_chain->cumulative_weights = malloc((edge_count + 1) *
+                                                  weight_size);
+    }
+    frozen_chain->start_ids = (int32_t *) malloc(
+            (frozen_chain->start_count + 1) * sizeof *frozen_chain->start_ids);
+    frozen_chain->last_flags = (uint8_t *) malloc(
+            (node_count + 1) * sizeof *frozen_chain->last_flags);
+    frozen_chain->data_offsets = (uint64_t *) malloc(
+            (node_count + 1) * sizeof *frozen_chain->data_offsets);
+
+    return frozen_chain->edge_offsets != NULL &&
+           frozen_chain->successors != NULL &&
+           (frozen_chain->cumulative_frequencies != NULL ||
+            frozen_chain->cumulative_weights != NULL) &&
+           frozen_chain->start_ids != NULL &&
+           frozen_chain->last_flags != NULL &&
+           frozen_chain->data_offsets != NULL;
+}
+
+static size_t get_cumulative_weight_size(int32_t weight_bits) {
+    switch (weight_bits) {
+        case QUANTIZED_WEIGHT_BITS_8:
+            return sizeof(uint8_t);
+        case QUANTIZED_WEIGHT_BITS_16:
+            return sizeof(uint16_t);
+        default:
+            return sizeof(int32_t);
+    }
+}
+
+static inline int32_t get_cumulative_weight(
+        const FrozenMarkovChain *frozen_chain, int32_t edge) {
+    switch (frozen_chain->weight_bits) {
+        case QUANTIZED_WEIGHT_BITS_8:
+            return ((const uint8_t *) frozen_chain->cumulative_weights)[edge];
+        case QUANTIZED_WEIGHT_BITS_16:
+            return ((const uint16_t *) frozen_chain->cumulative_weights)[edge];
+        default:
+            return frozen_chain->cumulative_frequencies[edge];
+    }
+}
+
+FrozenMarkovChain *compact_frozen_markov_chain(
+        const FrozenMarkovChain *frozen_chain,
+        const CompactionOptions *options) {
+    assert(frozen_chain != NULL);
+    assert(options != NULL);
+    assert(frozen_chain->weight_bits == 0);
+    assert(options->weight_bits == 0 ||
+           options->weight_bits == QUANTIZED_WEIGHT_BITS_8 ||
+           options->weight_bits == QUANTIZED_WEIGHT_BITS_16);
+
+    FrozenMarkovChain *compact_chain =
+            (FrozenMarkovChain *) calloc(1, sizeof *compact_chain);
+    int32_t *new_ids = (int32_t *) malloc(
+            (frozen_chain->node_count + 1) * sizeof *new_ids);
+    if (compact_chain == NULL || new_ids == NULL) {
+        free(compact_chain);
+        free(new_ids);
+        return NULL;
+    }
+
+    int32_t max_degree = 0;
+    for (int32_t id = 0; id < frozen_chain->node_count; ++id) {
+        int32_t degree = frozen_chain->edge_offsets[id + 1] -
+                         frozen_chain->edge_offsets[id];
+        if (degree > max_degree) {
+            max_degree = degree;
+        }
+    }
+
+    // the arrays are allocated for all the edges and starts, and the edges
+    // shrunk once they are counted
+    compact_chain->node_count = map_compacted_nodes(
+            frozen_chain, options->min_count, new_ids);
+    compact_chain->edge_count = frozen_chain->edge_count;
+    compact_chain->start_count = frozen_chain->start_count;
+    compact_chain->weight_bits = options->weight_bits;
+    compact_chain->print_func = frozen_chain->print_func;
+
+    CompactedEdge *edges = (CompactedEdge *) malloc(
+            (max_degree + 1) * sizeof *edges);
+    compact_chain->data_pool = (char *) malloc(
+            frozen_chain->data_pool_size + DATA_POOL_ALIGNMENT);
+    if (compact_chain->node_count < 0 || edges == NULL ||
+        compact_chain->data_pool == NULL ||
+        !allocate_frozen_arrays(compact_chain)) {
+        free(new_ids);
+        free(edges);
+        free_frozen_markov_chain(&compact_chain);
+        return NULL;
+    }
+
+    memcpy(compact_chain->data_pool, frozen_chain->data_pool,
+           frozen_chain->data_pool_size);
+    compact_chain->data_pool_size = frozen_chain->data_pool_size;
+
+    int32_t edge_idx = 0;
+    for (int32_t id = 0; id < frozen_chain->node_count; ++id) {
+        int32_t new_id = new_ids[id];
+        if (new_id == FROZEN_NO_NODE) {
+            continue;
+        }
+
+        compact_chain->last_flags[new_id] = frozen_chain->last_flags[id];
+        compact_chain->data_offsets[new_id] = frozen_chain->data_offsets[id];
+        compact_chain->edge_offsets[new_id] = edge_idx;
+
+        int32_t num_of_edges = select_compacted_edges(
+                frozen_chain, id, options, new_ids, edges);
+        edge_idx = write_compacted_edges(compact_chain, frozen_chain, new_ids,
+                                         edges, num_of_edges, edge_idx);
+    }
+    compact_chain->edge_offsets[compact_chain->node_count] = edge_idx;
+    compact_chain->edge_count = edge_idx;
+    shrink_compacted_edges(compact_chain);
+
+    compact_chain->start_count = 0;
+    for (int32_t i = 0; i < frozen_chain->start_count; ++i) {
+        int32_t new_id = new_ids[frozen_chain->start_ids[i]];
+        if (new_id != FROZEN_NO_NODE) {
+            compact_chain->start_ids[compact_chain->start_count++] = new_id;
+        }
+    }
+
+    free(new_ids);
+    free(edges);
+    return compact_chain;
+}
+
+static int32_t map_compacted_nodes(const FrozenMarkovChain *frozen_chain,
+                                   int32_t min_count, int32_t *new_ids) {
+    int32_t node_count = frozen_chain->node_count;
+
+    if (min_count <= 1) {
+        for (int32_t id = 0; id < node_count; ++id) {
+            new_ids[id] = id;
+        }
+        return node_count;
+    }
+
+    // every occurrence of a node but the last in its sentence is followed by
+    // an edge, and every one but the first is preceded by one
+    int64_t *in_counts = (int64_t *) calloc(node_count + 1,
+                                            sizeof *in_counts);
+    if (in_counts == NULL) {
+        return -1;
+    }
+
+    for (int32_t id = 0; id < node_count; ++id) {
+        int32_t prev_sum = 0;
+        for (int32_t edge = frozen_chain->edge_offsets[id];
+             edge < frozen_chain->edge_offsets[id + 1]; ++edge) {
+            int32_t sum = frozen_chain->cumulative_frequencies[edge];
+            in_counts[frozen_chain->successors[edge]] += sum - prev_sum;
+            prev_sum = sum;
+        }
+    }
+
+    int32_t kept_count = 0;
+    for (int32_t id = 0; id < node_count; ++id) {
+        int32_t first_edge = frozen_chain->edge_offsets[id];
+        int32_t last_edge = frozen_chain->edge_offsets[id + 1] - 1;
+        int64_t out_count = (last_edge >= first_edge)
+                            ? frozen_chain->cumulative_frequencies[last_edge]
+                            : 0;
+        int64_t count = (in_counts[id] > out_count) ? in_counts[id]
+                                                    : out_count;
+
+        new_ids[id] = (count >= min_count) ? kept_count++ : FROZEN_NO_NODE;
+    }
+
+    free(in_counts);
+    return kept_count;
+}
+
+static int32_t select_compacted_edges(const FrozenMarkovChain *frozen_chain,
+                                      int32_t node_id,
+                                      const CompactionOptions *options,
+                                      const int32_t *new_ids,
+                                      CompactedEdge *edges) {
+    int32_t num_of_edges = 0;
+    int32_t prev_sum = 0;
+
+    for (int32_t edge = frozen_chain->edge_offsets[node_id];
+         edge < frozen_chain->edge_offsets[node_id + 1]; ++edge) {
+        int32_t sum = frozen_chain->cumulative_frequencies[edge];
+        int32_t frequency = sum - prev_sum;
+        prev_sum = sum;
+
+        if (frequency >= options->min_count &&
+            new_ids[frozen_chain->successors[edge]] != FROZEN_NO_NODE) {
+            edges[num_of_edges++] = (CompactedEdge) {edge, frequency};
+        }
+    }
+
+    if (options->top_k > 0 && num_of_edges > options->top_k) {
+        qsort(edges, num_of_edges, sizeof *edges, compare_edges_by_frequency);
+        num_of_edges = options->top_k;
+        // the kept edges are sampled in their original order
+        qsort(edges, num_of_edges, sizeof *edges, compare_edges_by_order);
+    }
+
+    return num_of_edges;
+}
+
+static int compare_edges_by_frequency(const void *first, const void *second) {
+    const CompactedEdge *first_edge = (const CompactedEdge *) first;
+    const CompactedEdge *second_edge = (const CompactedEdge *) second;
+
+    if (first_edge->frequency != second_edge->frequency) {
+        return (first_edge->frequency > second_edge->frequency) ? -1 : 1;
+    }
+
+    return compare_edges_by_order(first, second);
+}
+
+static int compare_edges_by_order(const void *first, const void *second) {
+    const CompactedEdge *first_edge = (const CompactedEdge *) first;
+    const CompactedEdge *second_edge = (const CompactedEdge *) second;
+
+    return (first_edge->edge > second_edge->edge) -
+           (first_edge->edge < second_edge->edge);
+}
+
+static int32_t write_compacted_edges(FrozenMarkovChain *compact_chain,
+                                     const FrozenMarkovChain *frozen_chain,
+                                     const int32_t *new_ids,
+                                     const CompactedEdge *edges,
+                                     int32_t num_of_edges, int32_t edge_idx) {
+    int64_t total_frequency = 0;
+    for (int32_t i = 0; i < num_of_edges; ++i) {
+        total_frequency += edges[i].frequency;
+    }
+
+    int64_t max_weight = ((int64_t) 1 << compact_chain->weight_bits) - 1;
+    int64_t sum = 0;
+    int64_t prev_weight = 0;
+
+    for (int32_t i = 0; i < num_of_edges; ++i) {
+        sum += edges[i].frequency;
+        int32_t successor = new_ids[frozen_chain->successors[edges[i].edge]];
+
+        if (compact_chain->weight_bits == 0) {
+            compact_chain->successors[edge_idx] = successor;
+            compact_chain->cumulative_frequencies[edge_idx] = (int32_t) sum;
+            edge_idx++;
+            continue;
+        }
+
+        // round the prefix sums, not the weights, so every weight is off by
+        // less than one unit and the last prefix sum is exactly max_weight
+        int64_t weight = (2 * sum * max_weight + total_frequency) /
+                         (2 * total_frequency);
+        if (weight == prev_weight) {
+            // a share too small for a unit of weight, never sampled
+            continue;
+        }
+        prev_weight = weight;
+
+        compact_chain->successors[edge_idx] = successor;
+        if (compact_chain->weight_bits == QUANTIZED_WEIGHT_BITS_8) {
+            ((uint8_t *) compact_chain->cumulative_weights)[edge_idx] =
+                    (uint8_t) weight;
+        } else {
+            ((uint16_t *) compact_chain->cumulative_weights)[edge_idx] =
+                    (uint16_t) weight;
+        }
+        edge_idx++;
+    }
+
+    return edge_idx;
+}
+
+static void shrink_compacted_edges(FrozenMarkovChain *compact_chain) {
+    // shrinking can not fail in practice, keep the old arrays if it does
+    int32_t *shrunk_successors = (int32_t *) realloc(
+            compact_chain->successors,
+            (compact_chain->edge_count + 1) *
+            sizeof *compact_chain->successors);
+    if (shrunk_successors != NULL) {
+        compact_chain->successors = shrunk_successors;
+    }
+
+    size_t weight_size = get_cumulative_weight_size(compact_chain->weight_bits);
+    if (compact_chain->weight_bits == 0) {
+        int32_t *shrunk_frequencies = (int32_t *) realloc(
+                compact_chain->cumulative_frequencies,
+                (compact_chain->edge_count + 1) * weight_size);
+        if (shrunk_frequencies != NULL) {
+            compact_chain->cumulative_frequencies = shrunk_frequencies;
+        }
+    } else {
+        void *shrunk_weights = realloc(
+                compact_chain->cumulative_weights,
+                (compact_chain->edge_count + 1) * weight_size);
+        if (shrunk_weights != NULL) {
+            compact_chain->cumulative_weights = shrunk_weights;
+        }
+    }
+}
+
+size_t get_frozen_markov_chain_size(const FrozenMarkovChain *frozen_chain) {
+    assert(frozen_chain != NULL);
+
+    size_t node_count = (size_t) frozen_chain->node_count;
+    size_t edge_count = (size_t) frozen_chain->edge_count;
+
+    return (node_count + 1) * sizeof *frozen_chain->edge_offsets +
+           edge_count * sizeof *frozen_chain->successors +
+           edge_count *
+           get_cumulative_weight_size(frozen_chain->weight_bits) +
+           (size_t) frozen_chain->start_count *
+           sizeof *frozen_chain->start_ids +
+           node_count * sizeof *frozen_chain->last_flags +
+           node_count * sizeof *frozen_chain->data_offsets +
+           frozen_chain->data_pool_size;
+}
+
+data_ptr_t get_frozen_node_data(const FrozenMarkovChain *frozen_chain,
+                                int32_t node_id) {
+    assert(frozen_chain != NULL);
+    assert(node_id >= 0 && node_id < frozen_chain->node_count);
+
+    return frozen_chain->data_pool + frozen_chain->data_offsets[node_id];
+}
+
+int32_t get_first_random_frozen_node(const FrozenMarkovChain *frozen_chain,
+                                     RandomState *random_state) {
+    assert(frozen_chain != NULL);
+
+    if (frozen_chain->start_count == 0) {
+        return FROZEN_NO_NODE;
+    }
+
+    return frozen_chain->start_ids[
+            get_random_number_from_state(random_state,
+                                         frozen_chain->start_count)];
+}
+
+int32_t get_next_random_frozen_node(const FrozenMarkovChain *frozen_chain,
+                                    int32_t node_id,
+                                    RandomState *random_state) {
+    assert(frozen_chain != NULL);
+
+    int32_t low = frozen_chain->edge_offsets[node_id];
+    int32_t high = frozen_chain->edge_offsets[node_id + 1] - 1;
+
+    if (high < low) {
+        return FROZEN_NO_NODE;
+    }
+
+    int32_t random_weight = get_random_number_from_state(
+            random_state, get_cumulative_weight(frozen_chain, high));
+
+    // find the first edge whose prefix sum is bigger than random_weight
+    while (low < high) {
+        int32_t middle = low + (high - low) / 2;
+
+        if (get_cumulative_weight(frozen_chain, middle) > random_weight) {
+            high = middle;
+        } else {
+            low = middle + 1;
+        }
+    }
+
+    return frozen_chain->successors[low];
+}
+
+int generate_frozen_walk(const FrozenMarkovChain *frozen_chain,
+                         int32_t first_node_id, int max_length,
+                         RandomState *random_state, int32_t *walk) {
+    assert(frozen_chain != NULL);
+
+    if (first_node_id == FROZEN_NO_NODE) {
+        first_node_id = get_first_random_frozen_node(frozen_chain,
+                                                     random_state);
+    }
+
+    if (first_node_id == FROZEN_NO_NODE || max_length <= 0) {
+        // there is no node a sequence can start from
+        return 0;
+    }
+
+    walk[0] = first_node_id;
+    int length = 1;
+
+    int32_t node_id = first_node_id;
+    while (length < max_length) {
+        node_id = get_next_random_frozen_node(frozen_chain, node_id,
+                                              random_state);
+
+        if (node_id == FROZEN_NO_NODE) {
+            break;
+        }
+
+        walk[length++] = node_id;
+
+        if (frozen_chain->last_flags[node_id]) {
+            break;
+        }
+    }
+
+    return length;
+}
+
+static void *generate_walks_job(void *job) {
+    WalksJob *walks_job = (WalksJob *) job;
+
+    for (int i = 0; i < walks_job->num_of_walks; ++i) {
+        RandomState random_state;
+        init_random_state(&random_state, walks_job->seed,
+                          walks_job->first_stream + (uint64_t) i);
+
+        walks_job->walk_lengths[i] = generate_frozen_walk(
+                walks_job->frozen_chain, walks_job->first_node_id,
+                walks_job->max_length, &random_state,
+                walks_job->walks + (size_t) i * walks_job->max_length);
+    }
+
+    return NULL;
+}
+
+void generate_frozen_walks(const FrozenMarkovChain *frozen_chain,
+                           uint64_t seed, uint64_t first_stream,
+                           int num_of_walks, int32_t first_node_id,
+                           int max_length, int32_t *walks,
+                           int *walk_lengths, int num_of_threads) {
+    assert(frozen_chain != NULL);
+
+    if (num_of_threads > MAX_WALK_THREADS) {
+        num_of_threads = MAX_WALK_THREADS;
+    }
+    if (num_of_threads > num_of_walks) {
+        num_of_threads = num_of_walks;
+    }
+    if (num_of_threads < 1) {
+        num_of_threads = 1;
+    }
+
+    WalksJob jobs[MAX_WALK_THREADS];
+    pthread_t threads[MAX_WALK_THREADS];
+    bool started[MAX_WALK_THREADS];
+
+    int walks_done = 0;
+    for (int i = 0; i < num_of_threads; ++i) {
+        // split the walks as evenly as possible between the threads
+        int job_size = (num_of_walks - walks_done) / (num_of_threads - i);
+
+        jobs[i] = (WalksJob) {frozen_chain, seed,
+                              first_stream + (uint64_t) walks_done, job_size,
+                              first_node_id, max_length,
+                              walks + (size_t) walks_done * max_length,
+                              walk_lengths + walks_done};
+        walks_done += job_size;
+
+        // the first job runs on the calling thread
+        started[i] = i > 0 && pthread_create(&threads[i], NULL,
+                                             generate_walks_job,
+                                             &jobs[i]) == 0;
+    }
+
+    for (int i = 0; i < num_of_threads; ++i) {
+        if (!started[i]) {
+            generate_walks_job(&jobs[i]);
+        }
+    }
+
+    for (int i = 0; i < num_of_threads; ++i) {
+        if (started[i]) {
+            pthread_join(threads[i], NULL);
+        }
+    }
+}
+
+static bool start_batched_walk(SimulationJob *job, WalkersBatch *batch,
+                               int slot, uint64_t stream) {
+    RandomState random_state;
+    init_random_state(&random_state, job->seed, stream);
+
+    int32_t node_id = job->first_node_id;
+    if (node_id == FROZEN_NO_NODE) {
+        node_id = get_first_random_frozen_node(job->frozen_chain,
+                                               &random_state);
+    }
+
+    if (node_id == FROZEN_NO_NODE || job->max_length <= 0) {
+        job->length_histogram[0]++;
+        return false;
+    }
+
+    job->visit_counts[node_id]++;
+    if (job->max_length == 1) {
+        job->length_histogram[1]++;
+        return false;
+    }
+
+    batch->node_ids[slot] = node_id;
+    batch->lengths[slot] = 1;
+    batch->keys[slot] = random_state.key;
+    batch->counters[slot] = random_state.counter;
+    return true;
+}
+
+static void step_batched_walks(SimulationJob *job, WalkersBatch *batch,
+                               int size) {
+    const FrozenMarkovChain *frozen_chain = job->frozen_chain;
+    const int32_t *edge_offsets = frozen_chain->edge_offsets;
+
+    for (int i = 0; i < size; ++i) {
+        int32_t last_edge = edge_offsets[batch->node_ids[i] + 1] - 1;
+        batch->total_weights[i] =
+                (last_edge >= edge_offsets[batch->node_ids[i]])
+                ? get_cumulative_weight(frozen_chain, last_edge) : 0;
+    }
+
+    // a walk at a node without edges ends, and its draw is never used
+    get_random_numbers_from_states(batch->keys, batch->counters,
+                                   batch->total_weights,
+                                   batch->random_weights, size);
+
+    for (int i = 0; i < size; ++i) {
+        int32_t low = edge_offsets[batch->node_ids[i]];
+        int32_t high = edge_offsets[batch->node_ids[i] + 1] - 1;
+
+        if (high < low) {
+            job->length_histogram[batch->lengths[i]]++;
+            batch->node_ids[i] = FROZEN_NO_NODE;
+            continue;
+        }
+
+        while (low < high) {
+            int32_t middle = low + (high - low) / 2;
+
+            if (get_cumulative_weight(frozen_chain, middle) >
+                batch->random_weights[i]) {
+                high = middle;
+            } else {
+                low = middle + 1;
+            }
+        }
+
+        int32_t node_id = frozen_chain->successors[low];
+        job->visit_counts[node_id]++;
+        batch->lengths[i]++;
+
+        if (frozen_chain->last_flags[node_id] ||
+            batch->lengths[i] == job->max_length) {
+            job->length_histogram[batch->lengths[i]]++;
+            node_id = FROZEN_NO_NODE;
+        }
+        batch->node_ids[i] = node_id;
+    }
+}
+
+static int refill_batched_walks(SimulationJob *job, WalkersBatch *batch,
+                                int size, uint64_t *next_walk) {
+    int slot = 0;
+
+    while (slot < size) {
+        if (batch->node_ids[slot] != FROZEN_NO_NODE) {
+            slot++;
+            continue;
+        }
+
+        bool started = false;
+        while (!started && *next_walk < job->num_of_walks) {
+            started = start_batched_walk(job, batch, slot,
+                                         job->first_stream + *next_walk);
+            (*next_walk)++;
+        }
+
+        if (!started) {
+            // no walks are left, move the last walk of the batch here
+            size--;
+            batch->node_ids[slot] = batch->node_ids[size];
+            batch->lengths[slot] = batch->lengths[size];
+            batch->keys[slot] = batch->keys[size];
+            batch->counters[slot] = batch->counters[size];
+        }
+    }
+
+    return size;
+}
+
+static void *simulate_walks_job(void *job) {
+    SimulationJob *simulation_job = (SimulationJob *) job;
+    const FrozenMarkovChain *frozen_chain = simulation_job->frozen_chain;
+
+    WalkersBatch *batch = (WalkersBatch *) malloc(sizeof *batch);
+    simulation_job->length_histogram = (uint64_t *) calloc(
+            simulation_job->max_length + 1,
+            sizeof *simulation_job->length_histogram);
+    simulation_job->visit_counts = (uint64_t *) calloc(
+            frozen_chain->node_count + 1,
+            sizeof *simulation_job->visit_counts);
+    if (batch == NULL || simulation_job->length_histogram == NULL ||
+        simulation_job->visit_counts == NULL) {
+        simulation_job->failed = true;
+        free(batch);
+        return NULL;
+    }
+
+    // every slot starts empty, and is filled with the first walks
+    for (int i = 0; i < WALKERS_BATCH_SIZE; ++i) {
+        batch->node_ids[i] = FROZEN_NO_NODE;
+    }
+
+    uint64_t next_walk = 0;
+    int size = refill_batched_walks(simulation_job, batch,
+                                    WALKERS_BATCH_SIZE, &next_walk);
+    while (size > 0) {
+        step_batched_walks(simulation_job, batch, size);
+        size = refill_batched_walks(simulation_job, batch, size, &next_walk);
+    }
+
+    free(batch);
+    return NULL;
+}
+
+WalkStatistics *simulate_frozen_walks(const FrozenMarkovChain *frozen_chain,
+                                      uint64_t seed, uint64_t first_stream,
+                                      uint64_t num_of_walks,
+                                      int32_t first_node_id, int max_length,
+                                      int num_of_threads) {
+    assert(frozen_chain != NULL);
+
+    if (max_length < 0) {
+        max_length = 0;
+    }
+    if (num_of_threads > MAX_WALK_THREADS) {
+        num_of_threads = MAX_WALK_THREADS;
+    }
+    if ((uint64_t) num_of_threads > num_of_walks) {
+        num_of_threads = (int) num_of_walks;
+    }
+    if (num_of_threads < 1) {
+        num_of_threads = 1;
+    }
+
+    WalkStatistics *statistics =
+            (WalkStatistics *) calloc(1, sizeof *statistics);
+    if (statistics == NULL) {
+        return NULL;
+    }
+
+    SimulationJob jobs[MAX_WALK_THREADS];
+    pthread_t threads[MAX_WALK_THREADS];
+    bool started[MAX_WALK_THREADS];
+
+    uint64_t walks_done = 0;
+    for (int i = 0; i < num_of_threads; ++i) {
+        // split the walks as evenly as possible between the threads
+        uint64_t job_size = (num_of_walks - walks_done) /
+                            (uint64_t) (num_of_threads - i);
+
+        jobs[i] = (SimulationJob) {frozen_chain, seed,
+                                   first_stream + walks_done, job_size,
+                                   first_node_id, max_length, NULL, NULL,
+                                   false};
+        walks_done += job_size;
+
+        // the first job runs on the calling thread
+        started[i] = i > 0 && pthread_create(&threads[i], NULL,
+                                             simulate_walks_job,
+                                             &jobs[i]) == 0;
+    }
+
+    for (int i = 0; i < num_of_threads; ++i) {
+        if (!started[i]) {
+            simulate_walks_job(&jobs[i]);
+        }
+    }
+
+    for (int i = 0; i < num_of_threads; ++i) {
+        if (started[i]) {
+            pthread_join(threads[i], NULL);
+        }
+    }
+
+    // the aggregates of the first job become the result, the rest are
+    // added to them
+    bool failed = false;
+    for (int i = 0; i < num_of_threads; ++i) {
+        failed = failed || jobs[i].failed;
+    }
+
+    if (!failed) {
+        statistics->num_of_walks = num_of_walks;
+        statistics->max_length = max_length;
+        statistics->node_count = frozen_chain->node_count;
+        statistics->length_histogram = jobs[0].length_histogram;
+        statistics->visit_counts = jobs[0].visit_counts;
+        jobs[0].length_histogram = NULL;
+        jobs[0].visit_counts = NULL;
+
+        for (int i = 1; i < num_of_threads; ++i) {
+            for (int length = 0; length <= max_length; ++length) {
+                statistics->length_histogram[length] +=
+                        jobs[i].length_histogram[length];
+            }
+            for (int32_t id = 0; id < frozen_chain->node_count; ++id) {
+                statistics->visit_counts[id] += jobs[i].visit_counts[id];
+            }
+        }
+    }
+
+    for (int i = 0; i < num_of_threads; ++i) {
+        free(jobs[i].length_histogram);
+        free(jobs[i].visit_counts);
+    }
+
+    if (failed) {
+        free(statistics);
+        return NULL;
+    }
+
+    return statistics;
+}
+
+void free_walk_statistics(WalkStatistics **ptr_statistics) {
+    if (*ptr_statistics == NULL) {
+        return;
+    }
+
+    free((*ptr_statistics)->length_histogram);
+    free((*ptr_statistics)->visit_counts);
+    free(*ptr_statistics);
+    *ptr_statistics = NULL;
+}
+
+void print_frozen_walk(const FrozenMarkovChain *frozen_chain,
+                       const int32_t *walk, int length) {
+    assert(frozen_chain != NULL);
+
+    for (int i = 0; i < length; ++i) {
+        if (i > 0) {
+            printf(" ");
+        }
+
+        frozen_chain->print_func(get_frozen_node_data(frozen_chain, walk[i]));
+    }
+
+    printf("\n");
+}
+
+bool serialize_frozen_walk(const FrozenMarkovChain *frozen_chain,
+                           const int32_t *walk, int length,
+                           serialize_func_t serialize_func,
+                           ByteBuffer *buffer) {
+    assert(frozen_chain != NULL);
+    assert(buffer != NULL);
+
+    for (int i = 0; i < length; ++i) {
+        if (i > 0 && !append_string_to_byte_buffer(buffer, " ")) {
+            return false;
+        }
+
+        if (!serialize_func(get_frozen_node_data(frozen_chain, walk[i]),
+                            buffer)) {
+            return false;
+        }
+    }
+
+    return append_string_to_byte_buffer(buffer, "\n");
+}
+
+void generate_frozen_tweet(const FrozenMarkovChain *frozen_chain,
+                           int32_t first_node_id, int max_length,
+                           RandomState *random_state) {
+    assert(frozen_chain != NULL);
+
+    int32_t *walk = (max_length > 0)
+                    ? (int32_t *) malloc(max_length * sizeof *walk) : NULL;
+    if (walk == NULL) {
+        printf("\n");
+        return;
+    }
+
+    int length = generate_frozen_walk(frozen_chain, first_node_id, max_length,
+                                      random_state, walk);
+    print_frozen_walk(frozen_chain, walk, length);
+
+    free(walk);
+}
+
+static void layout_snapshot(const FrozenMarkovChain *frozen_chain,
+                            SnapshotHeader *header) {
+    memset(header, 0, sizeof *header);
+    memcpy(header->magic, FROZEN_CHAIN_MAGIC, FROZEN_CHAIN_MAGIC_LENGTH);
+    header->version = FROZEN_CHAIN_FORMAT_VERSION;
+    header->header_size = sizeof *header;
+    header->node_count = frozen_chain->node_count;
+    header->edge_count = frozen_chain->edge_count;
+    header->start_count = frozen_chain->start_count;
+    header->weight_bits = (uint32_t) frozen_chain->weight_bits;
+    header->data_pool_size = frozen_chain->data_pool_size;
+
+    uint64_t node_count = (uint64_t) frozen_chain->node_count;
+    uint64_t edge_count = (uint64_t) frozen_chain->edge_count;
+
+    uint64_t offset = ALIGN_UP((uint64_t) sizeof *header);
+    header->edge_offsets_offset = offset;
+    offset = ALIGN_UP(offset + (node_count + 1) * sizeof(int32_t));
+    header->successors_offset = offset;
+    offset = ALIGN_UP(offset + edge_count * sizeof(int32_t));
+    header->cumulative_frequencies_offset = offset;
+    offset = ALIGN_UP(offset + edge_count * get_cumulative_weight_size(
+            frozen_chain->weight_bits));
+    header->start_ids_offset = offset;
+    offset = ALIGN_UP(offset +
+                      (uint64_t) frozen_chain->start_count * sizeof(int32_t));
+    header->last_flags_offset = offset;
+    offset = ALIGN_UP(offset + node_count * sizeof(uint8_t));
+    header->data_offsets_offset = offset;
+    offset = ALIGN_UP(offset + node_count * sizeof(uint64_t));
+    header->data_pool_offset = offset;
+    header->file_size = offset + frozen_chain->data_pool_size;
+}
+
+static bool write_section(FILE *fp, uint64_t offset, const void *data,
+                          uint64_t size) {
+    long position = ftell(fp);
+    if (position < 0) {
+        return false;
+    }
+
+    for (uint64_t i = (uint64_t) position; i < offset; ++i) {
+        if (fputc(0, fp) == EOF) {
+            return false;
+        }
+    }
+
+    return size == 0 || fwrite(data, 1, size, fp) == size;
+}
+
+static FILE *open_snapshot_temp_file(const char *path, char **temp_path) {
+    long pid = (long) getpid();
+    int length = snprintf(NULL, 0, SNAPSHOT_TEMP_PATH_FORMAT, path, pid);
+    *temp_path = (char *) malloc((size_t) length + 1);
+    if (*temp_path == NULL) {
+        return NULL;
+    }
+    snprintf(*temp_path, (size_t) length + 1, SNAPSHOT_TEMP_PATH_FORMAT,
+             path, pid);
+
+    int fd = open(*temp_path, O_WRONLY | O_CREAT | O_EXCL, SNAPSHOT_FILE_MODE);
+    FILE *fp = (fd < 0) ? NULL : fdopen(fd, "wb");
+    if (fp == NULL) {
+        if (fd >= 0) {
+            close(fd);
+            unlink(*temp_path);
+        }
+        free(*temp_path);
+        *temp_path = NULL;
+    }
+    return fp;
+}
+
+static bool close_snapshot_temp_file(FILE *fp, char *temp_path,
+                                     const char *path, bool success) {
+    success = (fclose(fp) == 0) && success &&
+              rename(temp_path, path) == 0;
+    if (!success) {
+        unlink(temp_path);
+    }
+    free(temp_path);
+    return success;
+}
+
+bool save_frozen_markov_chain(const FrozenMarkovChain *frozen_chain,
+                              const char *path) {
+    assert(frozen_chain != NULL);
+
+    SnapshotHeader header;
+    layout_snapshot(frozen_chain, &header);
+
+    char *temp_path = NULL;
+    FILE *fp = open_snapshot_temp_file(path, &temp_path);
+    if (fp == NULL) {
+        return false;
+    }
+
+    uint64_t node_count = (uint64_t) frozen_chain->node_count;
+    uint64_t edge_count = (uint64_t) frozen_chain->edge_count;
+
+    bool success =
+            write_section(fp, 0, &header, sizeof header) &&
+            write_section(fp, header.edge_offsets_offset,
+                          frozen_chain->edge_offsets,
+                          (node_count + 1) * sizeof(int32_t)) &&
+            write_section(fp, header.successors_offset,
+                          frozen_chain->successors,
+                          edge_count * sizeof(int32_t)) &&
+            write_section(fp, header.cumulative_frequencies_offset,
+                          (frozen_chain->weight_bits == 0)
+                          ? (const void *) frozen_chain->cumulative_frequencies
+                          : frozen_chain->cumulative_weights,
+                          edge_count * get_cumulative_weight_size(
+                                  frozen_chain->weight_bits)) &&
+            write_section(fp, header.start_ids_offset,
+                          frozen_chain->start_ids,
+                          (uint64_t) frozen_chain->start_count *
+                          sizeof(int32_t)) &&
+            write_section(fp, header.last_flags_offset,
+                          frozen_chain->last_flags,
+                          node_count * sizeof(uint8_t)) &&
+            write_section(fp, header.data_offsets_offset,
+                          frozen_chain->data_offsets,
+                          node_count * sizeof(uint64_t)) &&
+            write_section(fp, header.data_pool_offset,
+                          frozen_chain->data_pool,
+                          frozen_chain->data_pool_size);
+
+    return close_snapshot_temp_file(fp, temp_path, path, success);
+}
+
+bool is_frozen_markov_chain_file(FILE *fp) {
+    if (fseek(fp, 0, SEEK_CUR) != 0) {
+        // a pipe can not be rewound after peeking into it, and can not be
+        // mapped anyway
+        return false;
+    }
+
+    char magic[FROZEN_CHAIN_MAGIC_LENGTH];
+    size_t read_size = fread(magic, 1, sizeof magic, fp);
+    rewind(fp);
+
+    return read_size == sizeof magic &&
+           memcmp(magic, FROZEN_CHAIN_MAGIC, FROZEN_CHAIN_MAGIC_LENGTH) == 0;
+}
+
+static bool is_valid_snapshot_header(const SnapshotHeader *header,
+                                     uint64_t file_size) {
+    if (file_size < sizeof *header ||
+        memcmp(header->magic, FROZEN_CHAIN_MAGIC,
+               FROZEN_CHAIN_MAGIC_LENGTH) != 0 ||
+        header->version != FROZEN_CHAIN_FORMAT_VERSION ||
+        header->header_size != sizeof *header ||
+        header->node_count < 0 || header->edge_count < 0 ||
+        header->start_count < 0 ||
+        (header->weight_bits != 0 &&
+         header->weight_bits != QUANTIZED_WEIGHT_BITS_8 &&
+         header->weight_bits != QUANTIZED_WEIGHT_BITS_16)) {
+        return false;
+    }
+
+    // the layout is fully determined by the counts, recompute and compare
+    FrozenMarkovChain sizes = {0};
+    sizes.node_count = header->node_count;
+    sizes.edge_count = header->edge_count;
+    sizes.start_count = header->start_count;
+    sizes.weight_bits = (int32_t) header->weight_bits;
+    sizes.data_pool_size = header->data_pool_size;
+
+    SnapshotHeader expected;
+    layout_snapshot(&sizes, &expected);
+
+    return memcmp(&expected, header, sizeof expected) == 0 &&
+           header->file_size <= file_size;
+}
+
+static bool is_valid_snapshot_arrays(const FrozenMarkovChain *frozen_chain) {
+    int32_t node_count = frozen_chain->node_count;
+    uint64_t data_pool_size = frozen_chain->data_pool_size;
+
+    // the data are strings, read up to their NUL by the walks and the merge,
+    // the last one must end inside the pool for all of them to
+    if (frozen_chain->edge_offsets[0] != 0 ||
+        frozen_chain->edge_offsets[node_count] != frozen_chain->edge_count ||
+        (data_pool_size > 0 &&
+         frozen_chain->data_pool[data_pool_size - 1] != '\0')) {
+        return false;
+    }
+
+    for (int32_t id = 0; id < node_count; ++id) {
+        int32_t first_edge = frozen_chain->edge_offsets[id];
+        int32_t end_edge = frozen_chain->edge_offsets[id + 1];
+        if (end_edge < first_edge || end_edge > frozen_chain->edge_count ||
+            frozen_chain->data_offsets[id] >= data_pool_size) {
+            return false;
+        }
+
+        int32_t prev_weight = 0;
+        for (int32_t edge = first_edge; edge < end_edge; ++edge) {
+            int32_t weight = get_cumulative_weight(frozen_chain, edge);
+            int32_t successor = frozen_chain->successors[edge];
+
+            if (weight <= prev_weight || successor < 0 ||
+                successor >= node_count) {
+                return false;
+            }
+            prev_weight = weight;
+        }
+    }
+
+    for (int32_t i = 0; i < frozen_chain->start_count; ++i) {
+        if (frozen_chain->start_ids[i] < 0 ||
+            frozen_chain->start_ids[i] >= node_count) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+FrozenMarkovChain *load_frozen_markov_chain(const char *path,
+                                            print_func_t print_func) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0 ||
+        (uint64_t) file_stat.st_size < sizeof(SnapshotHeader)) {
+        close(fd);
+        return NULL;
+    }
+
+    size_t mapping_size = (size_t) file_stat.st_size;
+    char *mapping = (char *) mmap(NULL, mapping_size, PROT_READ, MAP_PRIVATE,
+                                  fd, 0);
+    // the mapping stays valid after the file is closed
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        return NULL;
+    }
+
+    const SnapshotHeader *header = (const SnapshotHeader *) mapping;
+    FrozenMarkovChain *frozen_chain =
+            (FrozenMarkovChain *) calloc(1, sizeof *frozen_chain);
+    if (frozen_chain == NULL ||
+        !is_valid_snapshot_header(header, mapping_size)) {
+        free(frozen_chain);
+        munmap(mapping, mapping_size);
+        return NULL;
+    }
+
+    frozen_chain->node_count = header->node_count;
+    frozen_chain->edge_count = header->edge_count;
+    frozen_chain->start_count = header->start_count;
+    frozen_chain->data_pool_size = header->data_pool_size;
+    frozen_chain->edge_offsets =
+            (int32_t *) (mapping + header->edge_offsets_offset);
+    frozen_chain->successors =
+            (int32_t *) (mapping + header->successors_offset);
+    frozen_chain->weight_bits = (int32_t) header->weight_bits;
+    if (frozen_chain->weight_bits == 0) {
+        frozen_chain->cumulative_frequencies =
+                (int32_t *) (mapping + header->cumulative_frequencies_offset);
+    } else {
+        frozen_chain->cumulative_weights =
+                mapping + header->cumulative_frequencies_offset;
+    }
+    frozen_chain->start_ids = (int32_t *) (mapping + header->start_ids_offset);
+    frozen_chain->last_flags =
+            (uint8_t *) (mapping + header->last_flags_offset);
+    frozen_chain->data_offsets =
+            (uint64_t *) (mapping + header->data_offsets_offset);
+    frozen_chain->data_pool = mapping + header->data_pool_offset;
+    frozen_chain->print_func = print_func;
+    frozen_chain->mapping = mapping;
+    frozen_chain->mapping_size = mapping_size;
+
+    // the arrays are used as they are, a corrupt file must not make walks
+    // read out of them
+    if (!is_valid_snapshot_arrays(frozen_chain)) {
+        free_frozen_markov_chain(&frozen_chain);
+        return NULL;
+    }
+
+    return frozen_chain;
+}
+
+void free_frozen_markov_chain(FrozenMarkovChain **ptr_frozen_chain) {
+    if (*ptr_frozen_chain == NULL) {
+        return;
+    }
+
+    FrozenMarkovChain *frozen_chain = *ptr_frozen_chain;
+    if (frozen_chain->mapping != NULL) {
+        // the arrays point into the mapped snapshot
+        munmap(frozen_chain->mapping, frozen_chain->mapping_size);
+        free(frozen_chain);
+        *ptr_frozen_chain = NULL;
+        return;
+    }
+
+    free(frozen_chain->edge_offsets);
+    free(frozen_chain->successors);
+    free(frozen_chain->cumulative_frequencies);
+    free(frozen_chain->cumulative_weights);
+    free(frozen_chain->start_ids);
+    free(frozen_chain->last_flags);
+    free(frozen_chain->data_offsets);
+    free(frozen_chain->data_pool);
+
+    free(frozen_chain);
+    *ptr_frozen_chain = NULL;
+}
+
+bool merge_frozen_markov_chain_files(const char *output_path,
+                                     const char *const *paths,
+                                     int num_of_paths,
+                                     hash_func_t hash_func,
+                                     comp_func_t comp_func,
+                                     data_size_func_t data_size) {
+    assert(paths != NULL && num_of_paths > 0);
+
+    SnapshotMerge merge = {0};
+    merge.num_of_chains = num_of_paths;
+    merge.chains = (FrozenMarkovChain **) calloc(num_of_paths,
+                                                 sizeof *merge.chains);
+    if (merge.chains == NULL) {
+        return false;
+    }
+
+    // the snapshots are mapped, only the pages the merge touches are read
+    bool success = true;
+    for (int i = 0; i < num_of_paths && success; ++i) {
+        merge.chains[i] = load_frozen_markov_chain(paths[i], NULL);
+        // the frequencies of quantized chains are lost, they can not be
+        // summed
+        success = merge.chains[i] != NULL &&
+                  merge.chains[i]->weight_bits == 0;
+    }
+
+    success = success && allocate_snapshot_merge(&merge) &&
+              map_merged_nodes(&merge, hash_func, comp_func) &&
+              write_merged_snapshot(&merge, output_path, data_size);
+
+    free_snapshot_merge(&merge);
+    return success;
+}
+
+static bool allocate_snapshot_merge(SnapshotMerge *merge) {
+    int64_t max_node_count = 0;
+    int64_t max_edges_per_node = 0;
+
+    for (int i = 0; i < merge->num_of_chains; ++i) {
+        const FrozenMarkovChain *chain = merge->chains[i];
+        max_node_count += chain->node_count;
+
+        int32_t max_degree = 0;
+        for (int32_t id = 0; id < chain->node_count; ++id) {
+            int32_t degree = chain->edge_offsets[id + 1] -
+                             chain->edge_offsets[id];
+            if (degree > max_degree) {
+                max_degree = degree;
+            }
+        }
+        max_edges_per_node += max_degree;
+    }
+
+    if (max_node_count >= INT32_MAX || max_edges_per_node >= INT32_MAX) {
+        return false;
+    }
+
+    merge->merged_ids = (int32_t **) calloc(merge->num_of_chains,
+                                            sizeof *merge->merged_ids);
+    merge->next_sources = (MergeSource **) calloc(
+            merge->num_of_chains, sizeof *merge->next_sources);
+    merge->first_sources = (MergeSource *) malloc(
+            (max_node_count + 1) * sizeof *merge->first_sources);
+    merge->edge_offsets = (int32_t *) malloc(
+            (max_node_count + 1) * sizeof *merge->edge_offsets);
+    merge->positions = (int32_t *) malloc(
+            (max_node_count + 1) * sizeof *merge->positions);
+    merge->successors = (int32_t *) malloc(
+            (max_edges_per_node + 1) * sizeof *merge->successors);
+    merge->frequencies = (int64_t *) malloc(
+            (max_edges_per_node + 1) * sizeof *merge->frequencies);
+    merge->cumulative_frequencies = (int32_t *) malloc(
+            (max_edges_per_node + 1) * sizeof *merge->cumulative_frequencies);
+    if (merge->merged_ids == NULL || merge->next_sources == NULL ||
+        merge->first_sources == NULL || merge->edge_offsets == NULL ||
+        merge->positions == NULL || merge->successors == NULL ||
+        merge->frequencies == NULL || merge->cumulative_frequencies == NULL) {
+        return false;
+    }
+
+    // the maps of every chain are sized to it, the memory of the merge is
+    // linear in the total number of nodes
+    for (int i = 0; i < merge->num_of_chains; ++i) {
+        size_t node_count = (size_t) merge->chains[i]->node_count + 1;
+
+        merge->merged_ids[i] = (int32_t *) malloc(
+                node_count * sizeof *merge->merged_ids[i]);
+        merge->next_sources[i] = (MergeSource *) malloc(
+                node_count * sizeof *merge->next_sources[i]);
+        if (merge->merged_ids[i] == NULL || merge->next_sources[i] == NULL) {
+            return false;
+        }
+    }
+
+    for (int64_t node_id = 0; node_id < max_node_count; ++node_id) {
+        merge->positions[node_id] = FROZEN_NO_NODE;
+    }
+
+    return true;
+}
+
+static void free_snapshot_merge(SnapshotMerge *merge) {
+    for (int i = 0; i < merge->num_of_chains; ++i) {
+        free_frozen_markov_chain(&merge->chains[i]);
+        if (merge->merged_ids != NULL) {
+            free(merge->merged_ids[i]);
+        }
+        if (merge->next_sources != NULL) {
+            free(merge->next_sources[i]);
+        }
+    }
+
+    free(merge->chains);
+    free(merge->merged_ids);
+    free(merge->next_sources);
+    free(merge->first_sources);
+    free(merge->edge_offsets);
+    free(merge->positions);
+    free(merge->successors);
+    free(merge->frequencies);
+    free(merge->cumulative_frequencies);
+}
+
+static const FrozenMarkovChain *get_merged_node_source(
+        const SnapshotMerge *merge, int32_t node_id, int32_t *source_id) {
+    MergeSource source = merge->first_sources[node_id];
+
+    *source_id = source.id;
+    return merge->chains[source.chain];
+}
+
+static bool map_merged_nodes(SnapshotMerge *merge, hash_func_t hash_func,
+                             comp_func_t comp_func) {
+    size_t max_node_count = 0;
+    for (int i = 0; i < merge->num_of_chains; ++i) {
+        max_node_count += (size_t) merge->chains[i]->node_count;
+    }
+
+    size_t capacity = MERGE_INDEX_INITIAL_CAPACITY;
+    while (capacity < max_node_count * MERGE_INDEX_LOAD_FACTOR_INVERSE) {
+        capacity *= 2;
+    }
+
+    MergeIndexEntry *index = (MergeIndexEntry *) malloc(
+            capacity * sizeof *index);
+    // the node of the last chain that has every merged node so far, to link
+    // the next one after it
+    MergeSource *last_sources = (MergeSource *) malloc(
+            (max_node_count + 1) * sizeof *last_sources);
+    if (index == NULL || last_sources == NULL) {
+        free(index);
+        free(last_sources);
+        return false;
+    }
+
+    for (size_t slot = 0; slot < capacity; ++slot) {
+        index[slot].node_id = FROZEN_NO_NODE;
+    }
+
+    for (int i = 0; i < merge->num_of_chains; ++i) {
+        const FrozenMarkovChain *chain = merge->chains[i];
+
+        for (int32_t id = 0; id < chain->node_count; ++id) {
+            data_ptr_t data = get_frozen_node_data(chain, id);
+            unsigned long hash = hash_func(data);
+
+            // linear probing on the mixed hash, like the database index
+            uint64_t mixed = hash * MERGE_HASH_MULTIPLIER;
+            size_t slot = (size_t) (mixed ^ (mixed >> MERGE_HASH_SHIFT)) &
+                          (capacity - 1);
+            int32_t node_id = FROZEN_NO_NODE;
+
+            while (index[slot].node_id != FROZEN_NO_NODE) {
+                int32_t source_id;
+                const FrozenMarkovChain *source = get_merged_node_source(
+                        merge, index[slot].node_id, &source_id);
+
+                if (index[slot].hash == hash &&
+                    comp_func(get_frozen_node_data(source, source_id),
+                              data) == 0) {
+                    node_id = index[slot].node_id;
+                    break;
+                }
+
+                slot = (slot + 1) & (capacity - 1);
+            }
+
+            MergeSource source = {i, id};
+            if (node_id == FROZEN_NO_NODE) {
+                node_id = merge->node_count++;
+                index[slot].hash = hash;
+                index[slot].node_id = node_id;
+                merge->first_sources[node_id] = source;
+            } else if (last_sources[node_id].chain == i) {
+                // the data does not tell the states of this chain apart
+                free(index);
+                free(last_sources);
+                return false;
+            } else {
+                MergeSource last_source = last_sources[node_id];
+                merge->next_sources[last_source.chain][last_source.id] =
+                        source;
+            }
+
+            last_sources[node_id] = source;
+            merge->next_sources[i][id] = (MergeSource) {FROZEN_NO_NODE, 0};
+            merge->merged_ids[i][id] = node_id;
+        }
+    }
+
+    free(index);
+    free(last_sources);
+    return true;
+}
+
+static int32_t merge_node_edges(SnapshotMerge *merge, int32_t node_id) {
+    int32_t count = 0;
+
+    for (MergeSource source = merge->first_sources[node_id];
+         source.chain != FROZEN_NO_NODE;
+         source = merge->next_sources[source.chain][source.id]) {
+        int i = source.chain;
+        int32_t source_id = source.id;
+        const FrozenMarkovChain *chain = merge->chains[i];
+        int32_t prev_sum = 0;
+
+        for (int32_t edge = chain->edge_offsets[source_id];
+             edge < chain->edge_offsets[source_id + 1]; ++edge) {
+            int32_t frequency = chain->cumulative_frequencies[edge] - prev_sum;
+            prev_sum = chain->cumulative_frequencies[edge];
+
+            int32_t successor = merge->merged_ids[i][chain->successors[edge]];
+            int32_t position = merge->positions[successor];
+            if (position == FROZEN_NO_NODE) {
+                // a new edge, after the edges of the chains before
+                position = count++;
+                merge->positions[successor] = position;
+                merge->successors[position] = successor;
+                merge->frequencies[position] = 0;
+            }
+
+            merge->frequencies[position] += frequency;
+        }
+    }
+
+    // leave the scratch array clean for the next node
+    for (int32_t i = 0; i < count; ++i) {
+        merge->positions[merge->successors[i]] = FROZEN_NO_NODE;
+    }
+
+    return count;
+}
+
+static bool write_merged_edges(SnapshotMerge *merge, FILE *fp,
+                               uint64_t offset, bool cumulative) {
+    if (!write_section(fp, offset, NULL, 0)) {
+        return false;
+    }
+
+    for (int32_t node_id = 0; node_id < merge->node_count; ++node_id) {
+        int32_t count = merge_node_edges(merge, node_id);
+
+        // write_merged_snapshot checked that the sums fit in an int32_t
+        int64_t sum = 0;
+        for (int32_t i = 0; cumulative && i < count; ++i) {
+            sum += merge->frequencies[i];
+            merge->cumulative_frequencies[i] = (int32_t) sum;
+        }
+
+        const int32_t *section = cumulative ? merge->cumulative_frequencies
+                                            : merge->successors;
+        if (count > 0 &&
+            fwrite(section, sizeof *section, count, fp) != (size_t) count) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool write_merged_nodes(const SnapshotMerge *merge, FILE *fp,
+                               const SnapshotHeader *header,
+                               data_size_func_t data_size) {
+    const FrozenMarkovChain *first_chain = merge->chains[0];
+    int32_t first_count = first_chain->node_count;
+    int32_t source_id;
+
+    // the nodes of the first chain are copied as they are, the new nodes
+    // are appended after them
+    if (!write_section(fp, header->start_ids_offset, first_chain->start_ids,
+                       (uint64_t) first_chain->start_count *
+                       sizeof(int32_t))) {
+        return false;
+    }
+    for (int32_t node_id = first_count; node_id < merge->node_count;
+         ++node_id) {
+        const FrozenMarkovChain *source =
+                get_merged_node_source(merge, node_id, &source_id);
+        if (!source->last_flags[source_id] &&
+            fwrite(&node_id, sizeof node_id, 1, fp) != 1) {
+            return false;
+        }
+    }
+
+    if (!write_section(fp, header->last_flags_offset, first_chain->last_flags,
+                       (uint64_t) first_count * sizeof(uint8_t))) {
+        return false;
+    }
+    for (int32_t node_id = first_count; node_id < merge->node_count;
+         ++node_id) {
+        const FrozenMarkovChain *source =
+                get_merged_node_source(merge, node_id, &source_id);
+        if (fputc(source->last_flags[source_id], fp) == EOF) {
+            return false;
+        }
+    }
+
+    if (!write_section(fp, header->data_offsets_offset,
+                       first_chain->data_offsets,
+                       (uint64_t) first_count * sizeof(uint64_t))) {
+        return false;
+    }
+    uint64_t data_offset = ALIGN_UP(first_chain->data_pool_size);
+    for (int32_t node_id = first_count; node_id < merge->node_count;
+         ++node_id) {
+        const FrozenMarkovChain *source =
+                get_merged_node_source(merge, node_id, &source_id);
+        if (fwrite(&data_offset, sizeof data_offset, 1, fp) != 1) {
+            return false;
+        }
+        data_offset += ALIGN_UP(data_size(get_frozen_node_data(source,
+                                                               source_id)));
+    }
+
+    if (!write_section(fp, header->data_pool_offset, first_chain->data_pool,
+                       first_chain->data_pool_size)) {
+        return false;
+    }
+    data_offset = ALIGN_UP(first_chain->data_pool_size);
+    for (int32_t node_id = first_count; node_id < merge->node_count;
+         ++node_id) {
+        const FrozenMarkovChain *source =
+                get_merged_node_source(merge, node_id, &source_id);
+        data_ptr_t data = get_frozen_node_data(source, source_id);
+        size_t size = data_size(data);
+
+        // every data starts aligned, write_section pads up to it
+        if (!write_section(fp, header->data_pool_offset + data_offset, data,
+                           size)) {
+            return false;
+        }
+        data_offset += ALIGN_UP(size);
+    }
+
+    return write_section(fp, header->file_size, NULL, 0);
+}
+
+static bool write_merged_snapshot(SnapshotMerge *merge,
+                                  const char *output_path,
+                                  data_size_func_t data_size) {
+    const FrozenMarkovChain *first_chain = merge->chains[0];
+    FrozenMarkovChain sizes = {0};
+    int32_t source_id;
+
+    sizes.node_count = merge->node_count;
+    sizes.start_count = first_chain->start_count;
+    sizes.data_pool_size = ALIGN_UP(first_chain->data_pool_size);
+
+    // count the merged edges of every node, and the new nodes' data
+    int64_t edge_count = 0;
+    merge->edge_offsets[0] = 0;
+    for (int32_t node_id = 0; node_id < merge->node_count; ++node_id) {
+        int32_t count = merge_node_edges(merge, node_id);
+        int64_t frequencies_sum = 0;
+        for (int32_t i = 0; i < count; ++i) {
+            frequencies_sum += merge->frequencies[i];
+        }
+
+        edge_count += count;
+        if (edge_count >= INT32_MAX || frequencies_sum > INT32_MAX) {
+            return false;
+        }
+        merge->edge_offsets[node_id + 1] = (int32_t) edge_count;
+
+        if (node_id >= first_chain->node_count) {
+            const FrozenMarkovChain *source =
+                    get_merged_node_source(merge, node_id, &source_id);
+            sizes.start_count += source->last_flags[source_id] ? 0 : 1;
+            sizes.data_pool_size += ALIGN_UP(
+                    data_size(get_frozen_node_data(source, source_id)));
+        }
+    }
+    sizes.edge_count = (int32_t) edge_count;
+
+    SnapshotHeader header;
+    layout_snapshot(&sizes, &header);
+
+    char *temp_path = NULL;
+    FILE *fp = open_snapshot_temp_file(output_path, &temp_path);
+    if (fp == NULL) {
+        return false;
+    }
+
+    bool success =
+            write_section(fp, 0, &header, sizeof header) &&
+            write_section(fp, header.edge_offsets_offset, merge->edge_offsets,
+                          ((uint64_t) merge->node_count + 1) *
+                          sizeof(int32_t)) &&
+            write_merged_edges(merge, fp, header.successors_offset, false) &&
+            write_merged_edges(merge, fp,
+                               header.cumulative_frequencies_offset, true) &&
+            write_merged_nodes(merge, fp, &header, data_size);
+
+    return close_snapshot_temp_file(fp, temp_path, output_path, success);
+}
@@ -0,0 +1,422 @@
+#ifndef _FROZEN_MARKOV_CHAIN_H_
+#define _FROZEN_MARKOV_CHAIN_H_
+
+#include <stdint.h> // For int32_t, uint8_t
+#include <stddef.h> // For size_t
+
+#include "markov_chain.h"
+
+/** Returned instead of a node id when there is no such node */
+#define FROZEN_NO_NODE ((int32_t)(-1))
+
+/** The first bytes of every snapshot file written by
+ * save_frozen_markov_chain */
+#define FROZEN_CHAIN_MAGIC "MKVCHAIN"
+#define FROZEN_CHAIN_MAGIC_LENGTH 8
+
+/** The version of the snapshot format, bumped on every incompatible change */
+#define FROZEN_CHAIN_FORMAT_VERSION 1
+
+/** The sizes compact_frozen_markov_chain can quantize the weights into */
+#define QUANTIZED_WEIGHT_BITS_8 8
+#define QUANTIZED_WEIGHT_BITS_16 16
+
+/**
+ * @brief A read-only MarkovChain in compressed-sparse-row layout. Nodes are
+ * identified by their dense ids (MarkovNode::id), and every array is
+ * contiguous, so a walk on the chain touches a few cache lines per step
+ * instead of chasing pointers between heap blocks.
+ */
+typedef struct FrozenMarkovChain FrozenMarkovChain;
+
+/**
+ * @brief Writes the frozen form of a state's data into the data pool of a
+ * frozen chain, e.g. only the part of the state that is printed.
+ * @param data The data of a node of the chain being frozen
+ * @param data_pool The pool to append the frozen data to
+ * @param data_offset Set to the offset of the frozen data in data_pool
+ * @param context The context given to freeze_markov_chain_with
+ * @return false if memory allocation failed, true otherwise
+ */
+typedef bool (*freeze_data_func_t)(data_ptr_t data, ByteBuffer *data_pool,
+                                   uint64_t *data_offset, void *context);
+
+/**
+ * @brief The thresholds of compact_frozen_markov_chain
+ */
+typedef struct CompactionOptions CompactionOptions;
+
+struct CompactionOptions
+{
+    /** Edges of a lower frequency are dropped, and so are the nodes that
+     * occur less times. 1 or less to keep them all. */
+    int32_t min_count;
+
+    /** Only the top_k most frequent edges of every node are kept, 0 to keep
+     * them all */
+    int32_t top_k;
+
+    /** 8 or 16 to store the weights of the edges in that many bits, 0 to
+     * keep their frequencies */
+    int32_t weight_bits;
+};
+
+/**
+ * @brief The aggregates of the walks of simulate_frozen_walks
+ */
+typedef struct WalkStatistics WalkStatistics;
+
+struct WalkStatistics
+{
+    /** The number of walks */
+    uint64_t num_of_walks;
+
+    /** The maximal length of a walk */
+    int max_length;
+
+    /** length_histogram[l] is the number of walks of l nodes. max_length + 1
+     * entries. */
+    uint64_t *length_histogram;
+
+    /** The number of nodes in the chain */
+    int32_t node_count;
+
+    /** visit_counts[id] is the number of times the walks visited the node
+     * with that id, counting every visit of every walk */
+    uint64_t *visit_counts;
+};
+
+struct FrozenMarkovChain
+{
+    /** The number of nodes in the chain */
+    int32_t node_count;
+
+    /** The total number of edges (next nodes) of all the nodes */
+    int32_t edge_count;
+
+    /** The number of nodes a sequence can start from */
+    int32_t start_count;
+
+    /** The edges of node i are at [edge_offsets[i], edge_offsets[i + 1]) in
+     * `successors` and `cumulative_frequencies`. node_count + 1 entries. */
+    int32_t *edge_offsets;
+
+    /** The id of the next node of every edge */
+    int32_t *successors;
+
+    /** Prefix sums of the edge frequencies, restarting at every node. NULL
+     * if the weights are quantized. */
+    int32_t *cumulative_frequencies;
+
+    /** The number of bits of every quantized weight in
+     * `cumulative_weights`, 8 or 16. 0 if the weights are not quantized. */
+    int32_t weight_bits;
+
+    /** Prefix sums of the quantized edge weights, as uint8_t or uint16_t by
+     * `weight_bits`, restarting at every node and ending at the maximal
+     * value of their type. NULL if the weights are not quantized. */
+    void *cumulative_weights;
+
+    /** The ids of the nodes a sequence can start from */
+    int32_t *start_ids;
+
+    /** Non-zero for every node whose data is last */
+    uint8_t *last_flags;
+
+    /** The offset of every node's data inside `data_pool` */
+    uint64_t *data_offsets;
+
+    /** A copy of the data of all the nodes, in one block */
+    char *data_pool;
+
+    /** The size of `data_pool` in bytes */
+    uint64_t data_pool_size;
+
+    // pointer to a func that receives data from a generic type and prints it
+    // returns void.
+    print_func_t print_func;
+
+    /** If the chain was loaded from a snapshot, the mapping of the file that
+     * all the arrays above point into. NULL if the arrays were malloced. */
+    void *mapping;
+
+    /** The size of `mapping` in bytes */
+    size_t mapping_size;
+};
+
+/**
+ * @brief Converts the given markov chain into a FrozenMarkovChain. The data
+ * of the nodes is copied, so markov_chain can be freed afterwards. You are
+ * resposible for freeing the result with free_frozen_markov_chain.
+ * @param markov_chain The chain to freeze
+ * @param data_size Returns the number of bytes to copy for a given data
+ * @return The frozen chain, NULL if memory allocation failed.
+ */
+FrozenMarkovChain *freeze_markov_chain (MarkovChain *markov_chain,
+                                        data_size_func_t data_size);
+
+/**
+ * @brief Same as freeze_markov_chain, but the frozen data of every node is
+ * written by freeze_data instead of being a copy of the node's data, so it
+ * can be of a different type.
+ * @param markov_chain The chain to freeze
+ * @param freeze_data Writes the frozen data of a node
+ * @param context Passed to freeze_data
+ * @param print_func Prints the frozen data
+ * @return The frozen chain, NULL if memory allocation failed.
+ */
+FrozenMarkovChain *freeze_markov_chain_with (MarkovChain *markov_chain,
+                                             freeze_data_func_t freeze_data,
+                                             void *context,
+                                             print_func_t print_func);
+
+/**
+ * @brief Compacts the frozen chain into a smaller one, for chains with a
+ * long tail of rare edges:
+ * - The edges of a frequency below min_count are dropped, and so are the
+ *   nodes that occur less than min_count times (by the larger of the sums of
+ *   the frequencies of their edges and of the edges into them), with all
+ *   their edges.
+ * - Of the rest, only the top_k most frequent edges of every node are kept,
+ *   the earlier edges first on ties.
+ * - The frequencies of the kept edges are quantized into weight_bits bits.
+ *   Every edge gets the rounded share of 2^weight_bits - 1 of its node's
+ *   weight, so the probability of an edge differs by at most
+ *   1 / (2^weight_bits - 1) from its probability among the kept edges, and
+ *   edges with a share of 0 are dropped.
+ * The ids of the kept nodes stay in the same order. The data pool is copied
+ * whole, since nodes may share their frozen data. A chain with quantized
+ * weights can not be compacted or merged again.
+ * You are resposible for freeing the result with free_frozen_markov_chain.
+ * @param frozen_chain The chain to compact, its weights must not be
+ * quantized
+ * @param options The thresholds
+ * @return The compacted chain, NULL if memory allocation failed.
+ */
+FrozenMarkovChain *compact_frozen_markov_chain (
+        const FrozenMarkovChain *frozen_chain,
+        const CompactionOptions *options);
+
+/**
+ * @brief Returns the number of bytes of the arrays of the frozen chain, the
+ * memory it takes (and about the size of its snapshot file).
+ * @param frozen_chain The frozen chain
+ * @return The size
+ */
+size_t get_frozen_markov_chain_size (const FrozenMarkovChain *frozen_chain);
+
+/**
+ * @brief Returns the data of the node with the given id
+ * @param frozen_chain The frozen chain
+ * @param node_id The node's id
+ * @return Pointer to the node's data inside the data pool
+ */
+data_ptr_t get_frozen_node_data (const FrozenMarkovChain *frozen_chain,
+                                 int32_t node_id);
+
+/**
+ * Get one random node that a sequence can start from.
+ * @param frozen_chain
+ * @param random_state The random state to draw from, NULL to use rand()
+ * @return The id of the node, FROZEN_NO_NODE if there is none
+ */
+int32_t get_first_random_frozen_node (const FrozenMarkovChain *frozen_chain,
+                                      RandomState *random_state);
+
+/**
+ * Choose randomly the next node, depending on the edge frequencies. Picks
+ * exactly the node get_next_random_node would pick for the same random
+ * number.
+ * @param frozen_chain
+ * @param node_id The id of the current node
+ * @param random_state The random state to draw from, NULL to use rand()
+ * @return The id of the chosen node, FROZEN_NO_NODE if the node has no edges
+ */
+int32_t get_next_random_frozen_node (const FrozenMarkovChain *frozen_chain,
+                                     int32_t node_id,
+                                     RandomState *random_state);
+
+/**
+ * Generate a random sequence of node ids out of the frozen chain, the same
+ * way generate_tweet chooses its nodes. The chain is only read, so several
+ * threads can generate walks at once, each with its own random state.
+ * @param frozen_chain
+ * @param first_node_id The id of the node to start with, FROZEN_NO_NODE to
+ *                      choose a random one
+ * @param max_length maximum length of chain to generate
+ * @param random_state The random state to draw from, NULL to use rand()
+ * @param walk Filled with the ids of the nodes, must have room for
+ *             max_length ids
+ * @return The number of ids written to walk, 0 if there is no node to start
+ * from
+ */
+int generate_frozen_walk (const FrozenMarkovChain *frozen_chain,
+                          int32_t first_node_id, int max_length,
+                          RandomState *random_state, int32_t *walk);
+
+/**
+ * Generate num_of_walks walks on several threads. Walk i is generated from
+ * the random stream (seed, first_stream + i), so the walks are the same for
+ * any number of threads.
+ * @param frozen_chain
+ * @param seed The seed of the random streams
+ * @param first_stream The stream of the first walk
+ * @param num_of_walks The number of walks to generate
+ * @param first_node_id The id of the node to start every walk with,
+ *                      FROZEN_NO_NODE to choose a random one
+ * @param max_length maximum length of a walk
+ * @param walks Walk i is written at walks + i * max_length
+ * @param walk_lengths Set to the length of every walk
+ * @param num_of_threads The number of threads to use
+ */
+void generate_frozen_walks (const FrozenMarkovChain *frozen_chain,
+                            uint64_t seed, uint64_t first_stream,
+                            int num_of_walks, int32_t first_node_id,
+                            int max_length, int32_t *walks,
+                            int *walk_lengths, int num_of_threads);
+
+/**
+ * Simulate num_of_walks walks on several threads, and aggregate them instead
+ * of storing them. Walk i is generated from the random stream
+ * (seed, first_stream + i), so the aggregates are those of the walks
+ * generate_frozen_walks generates, for any number of threads. Every thread
+ * advances a batch of walks together, one step of all of them at a time, in
+ * a structure of arrays: the random numbers of a step are drawn for the
+ * whole batch at once, and a walk that ends is replaced by the next one.
+ * You are resposible for freeing the result with free_walk_statistics.
+ * @param frozen_chain
+ * @param seed The seed of the random streams
+ * @param first_stream The stream of the first walk
+ * @param num_of_walks The number of walks to simulate
+ * @param first_node_id The id of the node to start every walk with,
+ *                      FROZEN_NO_NODE to choose a random one
+ * @param max_length maximum length of a walk
+ * @param num_of_threads The number of threads to use
+ * @return The aggregates, NULL if memory allocation failed
+ */
+WalkStatistics *simulate_frozen_walks (const FrozenMarkovChain *frozen_chain,
+                                       uint64_t seed, uint64_t first_stream,
+                                       uint64_t num_of_walks,
+                                       int32_t first_node_id, int max_length,
+                                       int num_of_threads);
+
+/**
+ * Free the walk statistics and their arrays
+ * @param ptr_statistics Pointer to the statistics, set to NULL afterwards
+ */
+void free_walk_statistics (WalkStatistics **ptr_statistics);
+
+/**
+ * Print a walk generated by generate_frozen_walk, separating the nodes with
+ * spaces, and end the line.
+ * @param frozen_chain
+ * @param walk The ids of the nodes
+ * @param length The number of ids in walk
+ */
+void print_frozen_walk (const FrozenMarkovChain *frozen_chain,
+                        const int32_t *walk, int length);
+
+/**
+ * Append a walk generated by generate_frozen_walk to the buffer, in the same
+ * format print_frozen_walk prints it.
+ * @param frozen_chain
+ * @param walk The ids of the nodes
+ * @param length The number of ids in walk
+ * @param serialize_func Appends the data of a node to the buffer, returns
+ *                       false if memory allocation failed
+ * @param buffer The buffer to append to
+ * @return false if memory allocation failed, true otherwise
+ */
+bool serialize_frozen_walk (const FrozenMarkovChain *frozen_chain,
+                            const int32_t *walk, int length,
+                            serialize_func_t serialize_func,
+                            ByteBuffer *buffer);
+
+/**
+ * Generate and print a random sentence out of the frozen chain, the same
+ * way generate_tweet does.
+ * @param frozen_chain
+ * @param first_node_id The id of the node to start with, FROZEN_NO_NODE to
+ *                      choose a random one
+ * @param max_length maximum length of chain to generate
+ * @param random_state The random state to draw from, NULL to use rand()
+ */
+void generate_frozen_tweet (const FrozenMarkovChain *frozen_chain,
+                            int32_t first_node_id, int max_length,
+                            RandomState *random_state);
+
+/**
+ * @brief Writes the frozen chain to a binary snapshot file: a versioned
+ * header followed by the chain's arrays, each at an 8-byte aligned offset
+ * from the start of the file. The snapshot holds no pointers, so it can be
+ * used in place wherever it is mapped. Integers are in native byte order.
+ * The snapshot is written to a temporary file next to path and renamed over
+ * it, so path may be the file of a loaded chain, and is left as it was if
+ * the write fails.
+ * @param frozen_chain The chain to write
+ * @param path The path of the snapshot file
+ * @return true on success, false if the file could not be written
+ */
+bool save_frozen_markov_chain (const FrozenMarkovChain *frozen_chain,
+                               const char *path);
+
+/**
+ * @brief Checks if the given file starts with FROZEN_CHAIN_MAGIC. Leaves the
+ * file position at the start of the file. Files that are not seekable (e.g.
+ * pipes) are never snapshots.
+ * @param fp The file
+ * @return true if fp is a snapshot file, false otherwise
+ */
+bool is_frozen_markov_chain_file (FILE *fp);
+
+/**
+ * @brief Maps a snapshot file written by save_frozen_markov_chain into
+ * memory, and returns a frozen chain that uses it in place, with no
+ * deserialization. The arrays are validated before they are used: the edges
+ * of every node must be in range with increasing cumulative weights, the
+ * successors and the start nodes must be nodes, and the data of every node
+ * must start inside the data pool, which must end with a NUL as the data are
+ * strings. You are resposible for freeing it with free_frozen_markov_chain.
+ * @param path The path of the snapshot file
+ * @param print_func Prints the data of a node
+ * @return The frozen chain, NULL if the file could not be mapped or is not
+ * a valid snapshot.
+ */
+FrozenMarkovChain *load_frozen_markov_chain (const char *path,
+                                             print_func_t print_func);
+
+/**
+ * @brief Merges snapshot files into a new snapshot, the same way
+ * merge_markov_chains merges chains: the nodes of the first snapshot keep
+ * their ids, the nodes of the next snapshots that are not in the ones before
+ * them are appended in their order, and the frequencies of the edges between
+ * the same nodes are summed. Nodes are matched by their frozen data, so it
+ * must tell the states of the chains apart.
+ * The inputs are mapped and streamed into the output, only a few integers
+ * per node are kept in memory, and the merge takes O(nodes + edges).
+ * @param output_path The path of the merged snapshot file
+ * @param paths The paths of the snapshot files to merge, in order
+ * @param num_of_paths The number of snapshot files
+ * @param hash_func Hashes the frozen data of a node
+ * @param comp_func Compares the frozen data of two nodes, returns 0 if they
+ * are equal
+ * @param data_size Returns the number of bytes of the frozen data of a node
+ * @return true on success, false if a snapshot could not be loaded or has
+ * quantized weights, two nodes of the same snapshot have equal data, the
+ * merged chain is too big, the summed frequencies of a node do not fit in an
+ * int32_t, memory allocation failed or the output could not be written
+ */
+bool merge_frozen_markov_chain_files (const char *output_path,
+                                      const char *const *paths,
+                                      int num_of_paths,
+                                      hash_func_t hash_func,
+                                      comp_func_t comp_func,
+                                      data_size_func_t data_size);
+
+/**
+ * Free the frozen chain and all of its content from memory
+ * @param ptr_frozen_chain Pointer to the chain, set to NULL afterwards
+ */
+void free_frozen_markov_chain (FrozenMarkovChain **ptr_frozen_chain);
+
+#endif /* _FROZEN_MARKOV_CHAIN_H_ */
@@ -0,0 +1,225 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "intern_table.h"
+
+#define INTERN_POOL_INITIAL_CAPACITY ((size_t) 1 << 12)
+#define OFFSETS_INITIAL_CAPACITY 16
+#define INDEX_INITIAL_CAPACITY 16
+// The index is grown once more than 1 / INDEX_LOAD_FACTOR_INVERSE of its
+// slots are used
+#define INDEX_LOAD_FACTOR_INVERSE 2
+
+#define FNV_64_OFFSET_BASIS 0xCBF29CE484222325UL
+#define FNV_64_PRIME 0x100000001B3UL
+#define HASH_FOLD_SHIFT 32
+
+/**
+ * @brief FNV-1a hash of the given characters, folded to 32 bits
+ */
+static uint32_t hash_characters(const char *characters, size_t length);
+
+/**
+ * @brief Returns the slot of the index that holds the given string, or the
+ * empty slot where it should be inserted.
+ * @param table The table, its index must be allocated
+ * @param characters The characters of the string
+ * @param length The number of characters
+ * @param hash The hash of the characters
+ * @return The slot
+ */
+static InternIndexEntry *find_index_slot(const InternTable *table,
+                                         const char *characters,
+                                         size_t length, uint32_t hash);
+
+/**
+ * @brief Makes sure the index has room for one more string, rehashing it
+ * into twice as many slots when it is too full.
+ * @param table The table
+ * @return false if memory allocation failed, true otherwise
+ */
+static bool reserve_index(InternTable *table);
+
+/**
+ * @brief Makes sure `offsets` has room for one more string.
+ * @param table The table
+ * @return false if memory allocation failed, true otherwise
+ */
+static bool reserve_offsets(InternTable *table);
+
+InternTable *new_intern_table(void) {
+    InternTable *table = (InternTable *) calloc(1, sizeof *table);
+    if (table == NULL) {
+        return NULL;
+    }
+
+    if (!init_byte_buffer(&table->pool, INTERN_POOL_INITIAL_CAPACITY) ||
+        !reserve_offsets(table)) {
+        free_intern_table(&table);
+        return NULL;
+    }
+
+    table->offsets[0] = 0;
+    return table;
+}
+
+static uint32_t hash_characters(const char *characters, size_t length) {
+    uint64_t hash = FNV_64_OFFSET_BASIS;
+    for (size_t i = 0; i < length; ++i) {
+        hash ^= (unsigned char) characters[i];
+        hash *= FNV_64_PRIME;
+    }
+
+    return (uint32_t) (hash ^ (hash >> HASH_FOLD_SHIFT));
+}
+
+static InternIndexEntry *find_index_slot(const InternTable *table,
+                                         const char *characters,
+                                         size_t length, uint32_t hash) {
+    uint32_t mask = table->index_capacity - 1;
+
+    for (uint32_t slot = hash & mask;; slot = (slot + 1) & mask) {
+        InternIndexEntry *entry = &table->index[slot];
+        if (entry->id == INTERN_NO_ID) {
+            return entry;
+        }
+
+        // the hash rules out almost every other string before the memcmp
+        if (entry->hash == hash &&
+            get_interned_length(table, entry->id) == length &&
+            memcmp(table->pool.data + table->offsets[entry->id], characters,
+                   length) == 0) {
+            return entry;
+        }
+    }
+}
+
+static bool reserve_index(InternTable *table) {
+    if ((uint64_t) (table->size + 1) * INDEX_LOAD_FACTOR_INVERSE <=
+        table->index_capacity) {
+        return true;
+    }
+
+    uint32_t new_capacity = (table->index_capacity == 0)
+                            ? INDEX_INITIAL_CAPACITY
+                            : table->index_capacity * 2;
+    InternIndexEntry *new_index =
+            (InternIndexEntry *) malloc(new_capacity * sizeof *new_index);
+    if (new_index == NULL) {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < new_capacity; ++i) {
+        new_index[i].id = INTERN_NO_ID;
+    }
+
+    // every string is distinct, so only its hash is needed to rehash it
+    uint32_t mask = new_capacity - 1;
+    for (uint32_t i = 0; i < table->index_capacity; ++i) {
+        InternIndexEntry entry = table->index[i];
+        if (entry.id == INTERN_NO_ID) {
+            continue;
+        }
+
+        uint32_t slot = entry.hash & mask;
+        while (new_index[slot].id != INTERN_NO_ID) {
+            slot = (slot + 1) & mask;
+        }
+        new_index[slot] = entry;
+    }
+
+    free(table->index);
+    table->index = new_index;
+    table->index_capacity = new_capacity;
+    return true;
+}
+
+static bool reserve_offsets(InternTable *table) {
+    // one entry for the new string and one for the end of the pool
+    if (table->size + 2 <= table->offsets_capacity) {
+        return true;
+    }
+
+    uint32_t new_capacity = (table->offsets_capacity == 0)
+                            ? OFFSETS_INITIAL_CAPACITY
+                            : table->offsets_capacity * 2;
+    uint64_t *new_offsets = (uint64_t *) realloc(
+            table->offsets, new_capacity * sizeof *new_offsets);
+    if (new_offsets == NULL) {
+        return false;
+    }
+
+    table->offsets = new_offsets;
+    table->offsets_capacity = new_capacity;
+    return true;
+}
+
+uint32_t intern_string(InternTable *table, const char *characters,
+                       size_t length) {
+    assert(table != NULL);
+
+    // the last id is reserved for INTERN_NO_ID
+    if (table->size == INTERN_NO_ID - 1 || !reserve_index(table) ||
+        !reserve_offsets(table)) {
+        return INTERN_NO_ID;
+    }
+
+    uint32_t hash = hash_characters(characters, length);
+    InternIndexEntry *entry = find_index_slot(table, characters, length, hash);
+    if (entry->id != INTERN_NO_ID) {
+        return entry->id;
+    }
+
+    // a new string, copy it to the end of the pool
+    if (!append_to_byte_buffer(&table->pool, characters, length) ||
+        !append_to_byte_buffer(&table->pool, "", 1)) {
+        table->pool.size = table->offsets[table->size];
+        return INTERN_NO_ID;
+    }
+
+    entry->hash = hash;
+    entry->id = table->size;
+    table->size++;
+    table->offsets[table->size] = table->pool.size;
+
+    return entry->id;
+}
+
+uint32_t find_interned_string(const InternTable *table,
+                              const char *characters, size_t length) {
+    assert(table != NULL);
+
+    if (table->index == NULL) {
+        return INTERN_NO_ID;
+    }
+
+    uint32_t hash = hash_characters(characters, length);
+    return find_index_slot(table, characters, length, hash)->id;
+}
+
+const char *get_interned_string(const InternTable *table, uint32_t id) {
+    assert(table != NULL);
+    assert(id < table->size);
+
+    return table->pool.data + table->offsets[id];
+}
+
+size_t get_interned_length(const InternTable *table, uint32_t id) {
+    assert(table != NULL);
+    assert(id < table->size);
+
+    return table->offsets[id + 1] - table->offsets[id] - 1;
+}
+
+void free_intern_table(InternTable **ptr_table) {
+    if (*ptr_table == NULL) {
+        return;
+    }
+
+    free_byte_buffer(&(*ptr_table)->pool);
+    free((*ptr_table)->offsets);
+    free((*ptr_table)->index);
+    free(*ptr_table);
+    *ptr_table = NULL;
+}
@@ -0,0 +1,112 @@
+#ifndef _INTERN_TABLE_H_
+#define _INTERN_TABLE_H_
+
+#include <stddef.h>  // For size_t
+#include <stdint.h>  // For uint32_t
+#include <stdbool.h> // for bool
+
+#include "byte_buffer.h"
+
+/** Returned instead of an id when there is no such string, or when memory
+ * allocation failed */
+#define INTERN_NO_ID UINT32_MAX
+
+/**
+ * @brief A set of distinct strings, each stored once in a contiguous pool
+ * and identified by a dense 32-bit id, given in the order the strings were
+ * interned. Once interned, a string can be compared by its id alone.
+ */
+typedef struct InternTable InternTable;
+
+/**
+ * @brief A single slot of the hash index of an InternTable
+ */
+typedef struct InternIndexEntry InternIndexEntry;
+
+struct InternIndexEntry
+{
+    /** The low bits of the hash of the string in this slot */
+    uint32_t hash;
+
+    /** The id of the string in this slot, INTERN_NO_ID if it is empty */
+    uint32_t id;
+};
+
+struct InternTable
+{
+    /** All the strings, null-terminated, one after the other in the order of
+     * their ids */
+    ByteBuffer pool;
+
+    /** The offset of every string in `pool`, by its id. Has `size` + 1
+     * entries, the last is the size of the pool, so string i is
+     * offsets[i + 1] - offsets[i] - 1 characters long. */
+    uint64_t *offsets;
+
+    /** The number of strings in the table */
+    uint32_t size;
+
+    /** The number of entries allocated for `offsets` */
+    uint32_t offsets_capacity;
+
+    /** Open-addressing (linear probing) hash index over the strings */
+    InternIndexEntry *index;
+
+    /** The number of slots in `index`, always a power of two */
+    uint32_t index_capacity;
+};
+
+/**
+ * @brief A "constructor" for InternTable, you are resposible for freeing it
+ * with free_intern_table.
+ * @return A new empty table, NULL if memory allocation failed.
+ */
+InternTable *new_intern_table (void);
+
+/**
+ * @brief Returns the id of the given characters, adding a copy of them to
+ * the table if they are new.
+ * @param table The table
+ * @param characters The characters of the string, not necessarily
+ * null-terminated
+ * @param length The number of characters
+ * @return The id of the string, INTERN_NO_ID if memory allocation failed.
+ */
+uint32_t intern_string (InternTable *table, const char *characters,
+                        size_t length);
+
+/**
+ * @brief Returns the id of the given characters, if they were interned.
+ * @param table The table
+ * @param characters The characters of the string, not necessarily
+ * null-terminated
+ * @param length The number of characters
+ * @return The id of the string, INTERN_NO_ID if it is not in the table.
+ */
+uint32_t find_interned_string (const InternTable *table,
+                               const char *characters, size_t length);
+
+/**
+ * @brief Returns the string with the given id. The pointer is valid until
+ * the next string is interned.
+ * @param table The table
+ * @param id The id, less than the size of the table
+ * @return The null-terminated string
+ */
+const char *get_interned_string (const InternTable *table, uint32_t id);
+
+/**
+ * @brief Returns the length of the string with the given id.
+ * @param table The table
+ * @param id The id, less than the size of the table
+ * @return The number of characters, without the null-terminator
+ */
+size_t get_interned_length (const InternTable *table, uint32_t id);
+
+/**
+ * @brief Frees the table and all of its strings.
+ * @param ptr_table Pointer to the table, set to NULL afterwards.
+ */
+void free_intern_table (InternTable **ptr_table);
+
+#endif /* _INTERN_TABLE_H_ */
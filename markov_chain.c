@@ -5,17 +5,251 @@
 
 #define STRCMP_EQUAL  0
 
-#define LINKED_LIST_ADD_FAILED  1
-
 #define NOT_IN_ARRAY ((int)(-1))
 
+#define DATABASE_INDEX_INITIAL_CAPACITY 16
+// The index is grown once more than 1/2 of its slots are taken
+#define DATABASE_INDEX_LOAD_FACTOR_INVERSE 2
+// The shard of a state is picked by the top bits of its mixed hash, the slot
+// inside the shard by the bottom bits
+#define DATABASE_SHARD_SHIFT 58
+
+#define START_CANDIDATES_INITIAL_CAPACITY 16
+
+// SplitMix64 constants, used by the counter-based random state
+#define SPLITMIX_INCREMENT 0x9E3779B97F4A7C15ULL
+#define SPLITMIX_MULTIPLIER_1 0xBF58476D1CE4E5B9ULL
+#define SPLITMIX_MULTIPLIER_2 0x94D049BB133111EBULL
+#define RANDOM_BITS_SHIFT 32
+
+#define FREQUENCIES_LIST_INITIAL_CAPACITY 4
+// Frequencies lists up to this size are scanned linearly, longer ones are
+// indexed by a successor index
+#define SUCCESSOR_INDEX_MIN_LIST_SIZE 8
+// The successor index has at least this many slots per frequencies list place
+#define SUCCESSOR_INDEX_LOAD_FACTOR_INVERSE 2
+
+/**
+ * @brief The SplitMix64 finalizer, a bijection of 64 bit numbers whose
+ * output looks random for consecutive inputs.
+ */
+static uint64_t mix_bits(uint64_t bits);
+
+/**
+ * @brief Returns the slot of the index that holds a node matching the key.
+ * @param index The index
+ * @param capacity The capacity of index, 0 if it is not allocated
+ * @param key The key to look for
+ * @param hash The hash of key
+ * @param key_comp_func compares a data (first) with a key (second)
+ * @return The database node of the matching state, NULL if there is none
+ */
+static Node *probe_database_index(const DatabaseIndexEntry *index,
+                                  int capacity, data_ptr_t key,
+                                  unsigned long hash,
+                                  comp_func_t key_comp_func);
+
+
+/**
+ * @brief Places the given node in the first free slot for its hash. The
+ * index must have at least one free slot.
+ * @param index The index to insert into
+ * @param capacity The capacity of index
+ * @param hash The hash of the node's data
+ * @param node The node to insert
+ */
+static void insert_to_database_index(DatabaseIndexEntry *index, int capacity,
+                                     unsigned long hash, Node *node);
+
+/**
+ * @brief Allocates a database index if needed, and doubles it if adding
+ * one more node would pass the maximal load factor.
+ * @param index Pointer to the index, NULL if it is not allocated yet
+ * @param capacity Pointer to the capacity of the index
+ * @param size The number of nodes in the index
+ * @return false if allocation failed, true otherwise
+ */
+static bool reserve_database_index(DatabaseIndexEntry **index, int *capacity,
+                                   int size);
+
+/**
+ * @brief Initializes the fields of a new MarkovNode.
+ * @param markov_node The node to initialize
+ */
+static void init_markov_node(MarkovNode *markov_node);
+
+/**
+ * @brief Creates a MarkovNode wrapping a copy of data_ptr, and the database
+ * Node holding it, not linked to any list yet.
+ * @param markov_chain The markov chain
+ * @param arena The arena to allocate from, NULL to use malloc and copy_func
+ * @param data_ptr The data to copy into the node
+ * @return The new database Node, NULL if memory allocation failed.
+ */
+static Node *new_database_node(MarkovChain *markov_chain, Arena *arena,
+                               data_ptr_t data_ptr);
+
+/**
+ * @brief Creates a MarkovNode wrapping a copy of data_ptr, and appends it to
+ * the end of the database. Uses the chain's arena if it has one.
+ * @param markov_chain The markov chain, its database must be allocated
+ * @param data_ptr The data to copy into the node
+ * @return The new MarkovNode, NULL if memory allocation failed.
+ */
+static MarkovNode *append_markov_node(MarkovChain *markov_chain,
+                                      data_ptr_t data_ptr);
+
+/**
+ * @brief Returns the shard of the database a state with the given hash
+ * belongs to.
+ * @param writers The concurrent writers of the chain
+ * @param hash The hash of the state
+ * @return The shard
+ */
+static DatabaseShard *get_database_shard(ConcurrentWriters *writers,
+                                         unsigned long hash);
+
+/**
+ * @brief add_to_database_with_hash, for a chain with concurrent writers.
+ * Only takes the lock of the state's shard.
+ * @param markov_chain The markov chain
+ * @param data_ptr The state to look for
+ * @param hash The hash of data_ptr
+ * @return The Node of the state, NULL if memory allocation failed.
+ */
+static Node *add_to_database_shard(MarkovChain *markov_chain,
+                                   data_ptr_t data_ptr, unsigned long hash);
+
+/**
+ * @brief Appends the states of all the shards to the database, shard by
+ * shard, and releases the concurrent writers of the chain.
+ * @param markov_chain The markov chain, with concurrent writers
+ * @param index A database index big enough for all the states, to insert
+ * them into. NULL if they are only linked, e.g. before they are freed.
+ * @param capacity The capacity of index
+ * @param start_candidates An array big enough for all the states, to append
+ * the non-last ones to. NULL if they are only linked.
+ */
+static void link_database_shards(MarkovChain *markov_chain,
+                                 DatabaseIndexEntry *index, int capacity,
+                                 MarkovNode **start_candidates);
+
+/**
+ * @brief Appends the given node to the start candidates of the chain,
+ * doubling the array when it is full.
+ * @param markov_chain The markov chain
+ * @param markov_node The node to append
+ * @return false if allocation failed, true otherwise
+ */
+static bool add_start_candidate(MarkovChain *markov_chain,
+                                MarkovNode *markov_node);
+
+/**
+ * @brief Makes sure the successor index of the node can take one more entry
+ * without passing its maximal load factor, (re)building it from the
+ * frequencies list if needed. Does nothing for short frequencies lists.
+ * @param markov_node The node
+ * @return false if allocation failed, true otherwise
+ */
+static bool reserve_successor_index(MarkovNode *markov_node);
+
+/**
+ * @brief Places the frequencies list index of the given next node in the
+ * first free slot of the successor index.
+ * @param index The successor index
+ * @param capacity The capacity of index
+ * @param frequencies_list The frequencies list index refers to
+ * @param list_idx The index inside frequencies_list to insert
+ */
+static void insert_to_successor_index(int *index, int capacity,
+                                      MarkovNodeFrequency *frequencies_list,
+                                      int list_idx);
+
+/**
+ * @brief Makes sure there is room for one more place in the frequencies
+ * list and the frequency tree of the node. Without an epoch domain the
+ * arrays are realloced, with one they are copied, the copies are published
+ * and the old arrays are retired, so concurrent readers can keep using them.
+ * @param epoch The epoch domain of the node's chain, NULL if it has none
+ * @param markov_node The node
+ * @return false if allocation failed, true otherwise
+ */
+static bool grow_frequencies_list(EpochDomain *epoch,
+                                  MarkovNode *markov_node);
+
+/**
+ * @brief add_frequency_to_frequencies_list, for a node of a chain with the
+ * given epoch domain.
+ * @param epoch The epoch domain of the node's chain, NULL if it has none
+ * @param first_node
+ * @param second_node
+ * @param frequency How many times second_node followed first_node
+ * @return false if allocation failed, true otherwise
+ */
+static bool add_frequency_to_node(EpochDomain *epoch, MarkovNode *first_node,
+                                  MarkovNode *second_node, int frequency);
+
+/**
+ * @brief Returns the sum of the first `count` frequencies of the node.
+ * @param markov_node The node
+ * @param count The number of frequencies to sum, up to the list's size
+ * @return The sum
+ */
+static int sum_frequency_tree(const MarkovNode *markov_node, int count);
+
+/**
+ * @brief Adds frequency to the entry in the given index of the node's
+ * frequencies list, in the frequency tree.
+ * @param markov_node The node
+ * @param idx An index in the frequencies list
+ * @param frequency The frequency to add
+ */
+static void add_to_frequency_tree(MarkovNode *markov_node, int idx,
+                                  int frequency);
+
+/**
+ * @brief Adds the last entry of the node's frequencies list to the
+ * frequency tree.
+ * @param markov_node The node, the new entry must already be in the list
+ */
+static void append_to_frequency_tree(MarkovNode *markov_node);
+
+/**
+ * @brief Finds the first entry in a frequencies list whose cumulative
+ * frequency is bigger than random_weight.
+ * @param frequency_tree The frequency tree of the list
+ * @param size The size of the list
+ * @param random_weight A weight in [0, total weight)
+ * @return The index of the chosen entry in the frequencies list
+ */
+static int search_frequency_tree(const int *frequency_tree, int size,
+                                 int random_weight);
+
 MarkovChain *new_markov_chain(print_func_t print_func, comp_func_t
-comp_func, copy_func_t copy_func, free_data_t free_data, is_last_t is_last) {
+comp_func, hash_func_t hash_func, copy_func_t copy_func, free_data_t
+free_data, is_last_t is_last) {
     MarkovChain *markov_chain = (MarkovChain *) malloc(sizeof *markov_chain);
+    if (markov_chain == NULL) {
+        return NULL;
+    }
+
     markov_chain->database = NULL;
+    markov_chain->database_index = NULL;
+    markov_chain->database_index_capacity = 0;
+    markov_chain->start_candidates = NULL;
+    markov_chain->start_candidates_size = 0;
+    markov_chain->start_candidates_max_size = 0;
+    markov_chain->arena = NULL;
+    markov_chain->data_size = NULL;
+    markov_chain->epoch = NULL;
+    markov_chain->writers = NULL;
+    markov_chain->dense_nodes = NULL;
+    markov_chain->packed_frequencies_lists = NULL;
+    markov_chain->packed_frequency_trees = NULL;
 
     markov_chain->print_func = print_func;
     markov_chain->comp_func = comp_func;
+    markov_chain->hash_func = hash_func;
     markov_chain->copy_func = copy_func;
     markov_chain->free_data = free_data;
     markov_chain->is_last = is_last;
@@ -23,14 +257,167 @@ comp_func, copy_func_t copy_func, free_data_t free_data, is_last_t is_last) {
     return markov_chain;
 }
 
+Arena *allocate_arena(MarkovChain *markov_chain, data_size_func_t data_size) {
+    assert(markov_chain != NULL);
+
+    if (markov_chain->arena != NULL) {
+        return markov_chain->arena;
+    }
+
+    if (markov_chain->database != NULL && markov_chain->database->size > 0) {
+        // the existing nodes were allocated with malloc
+        return NULL;
+    }
+
+    markov_chain->arena = new_arena(ARENA_DEFAULT_SLAB_SIZE);
+    markov_chain->data_size = data_size;
+
+    return markov_chain->arena;
+}
+
+bool allocate_dense_states(MarkovChain *markov_chain, data_ptr_t states,
+                           size_t state_size, int num_of_states) {
+    assert(markov_chain != NULL);
+    assert(states != NULL);
+
+    if (num_of_states < 1 || markov_chain->writers != NULL ||
+        (markov_chain->database != NULL &&
+         markov_chain->database->size > 0) ||
+        allocate_database(markov_chain) == NULL ||
+        allocate_arena(markov_chain, markov_chain->data_size) == NULL) {
+        return false;
+    }
+
+    Arena *arena = markov_chain->arena;
+    MarkovNode *markov_nodes = (MarkovNode *) arena_alloc(
+            arena, (size_t) num_of_states * sizeof *markov_nodes);
+    Node *list_nodes = (Node *) arena_alloc(
+            arena, (size_t) num_of_states * sizeof *list_nodes);
+    char *data = (char *) arena_alloc(arena,
+                                      (size_t) num_of_states * state_size);
+    if (markov_nodes == NULL || list_nodes == NULL || data == NULL) {
+        return false;
+    }
+
+    memcpy(data, states, (size_t) num_of_states * state_size);
+
+    for (int id = 0; id < num_of_states; ++id) {
+        MarkovNode *markov_node = &markov_nodes[id];
+
+        init_markov_node(markov_node);
+        markov_node->data = data + (size_t) id * state_size;
+        markov_node->id = id;
+        markov_node->is_last = markov_chain->is_last(markov_node->data);
+
+        list_nodes[id].data = markov_node;
+        list_nodes[id].next = (id + 1 < num_of_states) ? &list_nodes[id + 1]
+                                                       : NULL;
+
+        if (!markov_node->is_last &&
+            !add_start_candidate(markov_chain, markov_node)) {
+            return false;
+        }
+    }
+
+    markov_chain->database->first = &list_nodes[0];
+    markov_chain->database->last = &list_nodes[num_of_states - 1];
+    markov_chain->database->size = num_of_states;
+    markov_chain->dense_nodes = markov_nodes;
+
+    return true;
+}
+
+MarkovNode *get_dense_node(MarkovChain *markov_chain, int state_id) {
+    assert(markov_chain != NULL);
+    assert(markov_chain->dense_nodes != NULL);
+    assert(state_id >= 0 && state_id < markov_chain->database->size);
+
+    return &markov_chain->dense_nodes[state_id];
+}
+
+bool reserve_dense_successors(MarkovChain *markov_chain,
+                              const int *successor_counts) {
+    assert(markov_chain != NULL);
+    assert(successor_counts != NULL);
+
+    if (markov_chain->dense_nodes == NULL ||
+        markov_chain->packed_frequencies_lists != NULL) {
+        return false;
+    }
+
+    int num_of_states = markov_chain->database->size;
+    size_t total_count = 0, total_tree_size = 0;
+
+    for (int id = 0; id < num_of_states; ++id) {
+        if (markov_chain->dense_nodes[id].frequencies_list != NULL) {
+            return false;
+        }
+
+        if (successor_counts[id] > 0) {
+            total_count += successor_counts[id];
+            // the frequency tree is 1-based, one more entry than the list
+            total_tree_size += successor_counts[id] + 1;
+        }
+    }
+
+    MarkovNodeFrequency *packed_frequencies_lists =
+            (MarkovNodeFrequency *) malloc(
+                    (total_count + 1) * sizeof *packed_frequencies_lists);
+    int *packed_frequency_trees = (int *) malloc(
+            (total_tree_size + 1) * sizeof *packed_frequency_trees);
+    if (packed_frequencies_lists == NULL || packed_frequency_trees == NULL) {
+        free(packed_frequencies_lists);
+        free(packed_frequency_trees);
+        return false;
+    }
+
+    MarkovNodeFrequency *frequencies_list = packed_frequencies_lists;
+    int *frequency_tree = packed_frequency_trees;
+
+    for (int id = 0; id < num_of_states; ++id) {
+        int count = successor_counts[id];
+        if (count <= 0) {
+            continue;
+        }
+
+        MarkovNode *markov_node = &markov_chain->dense_nodes[id];
+        markov_node->frequencies_list = frequencies_list;
+        markov_node->frequency_tree = frequency_tree;
+        markov_node->frequencies_list_max_size = count;
+        markov_node->packed_successors = true;
+
+        frequencies_list += count;
+        frequency_tree += count + 1;
+    }
+
+    markov_chain->packed_frequencies_lists = packed_frequencies_lists;
+    markov_chain->packed_frequency_trees = packed_frequency_trees;
+
+    return true;
+}
+
 MarkovNode *new_markov_node() {
     MarkovNode *markov_node = (MarkovNode *) malloc(sizeof *markov_node);
+    if (markov_node == NULL) {
+        return NULL;
+    }
+
+    init_markov_node(markov_node);
+    return markov_node;
+}
+
+static void init_markov_node(MarkovNode *markov_node) {
     markov_node->data = NULL;
+    markov_node->id = 0;
+    markov_node->is_last = false;
+    markov_node->packed_successors = false;
     markov_node->frequencies_list = NULL;
     markov_node->frequencies_list_size = 0;
     markov_node->frequencies_list_max_size = 0;
-
-    return markov_node;
+    markov_node->successor_index = NULL;
+    markov_node->successor_index_capacity = 0;
+    markov_node->frequency_tree = NULL;
+    markov_node->total_frequency = 0;
 }
 
 LinkedList *allocate_database(MarkovChain *markov_chain) {
@@ -57,99 +444,410 @@ Node *add_to_database(MarkovChain *markov_chain, data_ptr_t data_ptr) {
     assert (markov_chain != NULL);
     assert(data_ptr != NULL);
 
+    if (markov_chain->dense_nodes != NULL) {
+        // the set of dense states is fixed, and may have no hash_func
+        return NULL;
+    }
+
+    return add_to_database_with_hash(markov_chain, data_ptr,
+                                     markov_chain->hash_func(data_ptr));
+}
+
+Node *add_to_database_with_hash(MarkovChain *markov_chain,
+                                data_ptr_t data_ptr, unsigned long hash) {
+    assert (markov_chain != NULL);
+    assert(data_ptr != NULL);
+
+    if (markov_chain->writers != NULL) {
+        return add_to_database_shard(markov_chain, data_ptr, hash);
+    }
+
+    if (markov_chain->dense_nodes != NULL) {
+        // the set of dense states is fixed
+        return NULL;
+    }
+
     if (allocate_database(markov_chain) == NULL) {
         return NULL;
     }
 
-    Node *existing_node = get_node_from_database(markov_chain, data_ptr);
+    Node *existing_node = find_in_database(markov_chain, data_ptr, hash,
+                                           markov_chain->comp_func);
 
     if (existing_node != NULL) {
         return existing_node;
     }
 
+    // make room for the new node before anything is allocated for it
+    if (!reserve_database_index(&markov_chain->database_index,
+                                &markov_chain->database_index_capacity,
+                                markov_chain->database->size)) {
+        return NULL;
+    }
+
     // The node does not exist, create it
-    MarkovNode *markov_node = new_markov_node();
+    MarkovNode *markov_node = append_markov_node(markov_chain, data_ptr);
     if (markov_node == NULL) {
         return NULL;
     }
 
-    // duplicate the data
-    markov_node->data = markov_chain->copy_func(data_ptr);
-    if (markov_node->data == NULL) {
+    insert_to_database_index(markov_chain->database_index,
+                             markov_chain->database_index_capacity, hash,
+                             markov_chain->database->last);
+
+    if (!markov_node->is_last &&
+        !add_start_candidate(markov_chain, markov_node)) {
         return NULL;
     }
 
-    if (add(markov_chain->database, markov_node) == LINKED_LIST_ADD_FAILED) {
+    return markov_chain->database->last;
+}
+
+static Node *new_database_node(MarkovChain *markov_chain, Arena *arena,
+                               data_ptr_t data_ptr) {
+    if (arena == NULL) {
+        MarkovNode *markov_node = new_markov_node();
+        Node *list_node = (Node *) malloc(sizeof *list_node);
+        if (markov_node == NULL || list_node == NULL) {
+            free(markov_node);
+            free(list_node);
+            return NULL;
+        }
+
+        // duplicate the data
+        markov_node->data = markov_chain->copy_func(data_ptr);
+        if (markov_node->data == NULL) {
+            free(markov_node);
+            free(list_node);
+            return NULL;
+        }
+
+        markov_node->is_last = markov_chain->is_last(markov_node->data);
+        list_node->data = markov_node;
+        list_node->next = NULL;
+        return list_node;
+    }
+
+    // bump-allocate the node, its list Node and the data copy together
+    size_t data_size = markov_chain->data_size(data_ptr);
+    MarkovNode *markov_node =
+            (MarkovNode *) arena_alloc(arena, sizeof *markov_node);
+    Node *list_node = (Node *) arena_alloc(arena, sizeof *list_node);
+    data_ptr_t data = arena_alloc(arena, data_size);
+    if (markov_node == NULL || list_node == NULL || data == NULL) {
         return NULL;
     }
 
-    return markov_chain->database->last;
+    init_markov_node(markov_node);
+    markov_node->data = memcpy(data, data_ptr, data_size);
+    markov_node->is_last = markov_chain->is_last(markov_node->data);
+
+    list_node->data = markov_node;
+    list_node->next = NULL;
+    return list_node;
+}
+
+static MarkovNode *append_markov_node(MarkovChain *markov_chain,
+                                      data_ptr_t data_ptr) {
+    Node *list_node = new_database_node(markov_chain, markov_chain->arena,
+                                        data_ptr);
+    if (list_node == NULL) {
+        return NULL;
+    }
+
+    LinkedList *database = markov_chain->database;
+    list_node->data->id = database->size;
+
+    if (database->first == NULL) {
+        database->first = list_node;
+    } else {
+        database->last->next = list_node;
+    }
+    database->last = list_node;
+    database->size++;
+
+    return list_node->data;
+}
+
+static DatabaseShard *get_database_shard(ConcurrentWriters *writers,
+                                         unsigned long hash) {
+    unsigned long long mixed = hash * HASH_MIX_MULTIPLIER;
+    return &writers->shards[mixed >> DATABASE_SHARD_SHIFT];
+}
+
+static Node *add_to_database_shard(MarkovChain *markov_chain,
+                                   data_ptr_t data_ptr, unsigned long hash) {
+    DatabaseShard *shard = get_database_shard(markov_chain->writers, hash);
+
+    pthread_mutex_lock(&shard->lock);
+
+    Node *list_node = probe_database_index(shard->index, shard->index_capacity,
+                                           data_ptr, hash,
+                                           markov_chain->comp_func);
+
+    if (list_node == NULL &&
+        reserve_database_index(&shard->index, &shard->index_capacity,
+                               shard->size)) {
+        // a new state, its id is given when it is linked to the database
+        list_node = new_database_node(markov_chain, shard->arena, data_ptr);
+
+        if (list_node != NULL) {
+            if (shard->first == NULL) {
+                shard->first = list_node;
+            } else {
+                shard->last->next = list_node;
+            }
+            shard->last = list_node;
+            shard->size++;
+
+            insert_to_database_index(shard->index, shard->index_capacity,
+                                     hash, list_node);
+        }
+    }
+
+    pthread_mutex_unlock(&shard->lock);
+    return list_node;
+}
+
+static bool add_start_candidate(MarkovChain *markov_chain,
+                                MarkovNode *markov_node) {
+    if (markov_chain->start_candidates_size ==
+        markov_chain->start_candidates_max_size) {
+        int new_max_size = (markov_chain->start_candidates_max_size == 0)
+                           ? START_CANDIDATES_INITIAL_CAPACITY
+                           : markov_chain->start_candidates_max_size * 2;
+        MarkovNode **old_candidates = markov_chain->start_candidates;
+
+        // readers may be using the array, publish a grown copy of it
+        MarkovNode **new_candidates = (MarkovNode **) (
+                (markov_chain->epoch != NULL)
+                ? malloc(new_max_size * sizeof *new_candidates)
+                : realloc(old_candidates,
+                          new_max_size * sizeof *new_candidates));
+        if (new_candidates == NULL) {
+            return false;
+        }
+
+        if (markov_chain->epoch != NULL && old_candidates != NULL) {
+            memcpy(new_candidates, old_candidates,
+                   markov_chain->start_candidates_size *
+                   sizeof *new_candidates);
+        }
+
+        __atomic_store_n(&markov_chain->start_candidates, new_candidates,
+                         __ATOMIC_RELEASE);
+        markov_chain->start_candidates_max_size = new_max_size;
+
+        if (markov_chain->epoch != NULL) {
+            retire_to_epoch(markov_chain->epoch, old_candidates);
+        }
+    }
+
+    // the size is published after the node, a reader never sees a hole
+    markov_chain->start_candidates[markov_chain->start_candidates_size] =
+            markov_node;
+    __atomic_store_n(&markov_chain->start_candidates_size,
+                     markov_chain->start_candidates_size + 1,
+                     __ATOMIC_RELEASE);
+    return true;
 }
 
 Node *get_node_from_database(MarkovChain *markov_chain, data_ptr_t data_ptr) {
     assert(markov_chain != NULL);
 
-    if (markov_chain->database == NULL) {
+    if (markov_chain->database == NULL || markov_chain->dense_nodes != NULL) {
         return NULL;
     }
 
-    Node *current_node = markov_chain->database->first;
+    return find_in_database(markov_chain, data_ptr,
+                            markov_chain->hash_func(data_ptr),
+                            markov_chain->comp_func);
+}
+
+Node *find_in_database(MarkovChain *markov_chain, data_ptr_t key,
+                       unsigned long hash, comp_func_t key_comp_func) {
+    assert(markov_chain != NULL);
+
+    if (markov_chain->writers != NULL) {
+        DatabaseShard *shard = get_database_shard(markov_chain->writers, hash);
 
-    // Try to find the node inside the linked list
-    while (current_node != NULL) {
-        MarkovNode *current_markov_node = current_node->data;
+        pthread_mutex_lock(&shard->lock);
+        Node *node = probe_database_index(shard->index, shard->index_capacity,
+                                          key, hash, key_comp_func);
+        pthread_mutex_unlock(&shard->lock);
 
-        if (markov_chain->comp_func(current_markov_node->data, data_ptr) ==
-            STRCMP_EQUAL) {
-            return current_node;
+        return node;
+    }
+
+    return probe_database_index(markov_chain->database_index,
+                                markov_chain->database_index_capacity, key,
+                                hash, key_comp_func);
+}
+
+static Node *probe_database_index(const DatabaseIndexEntry *index,
+                                  int capacity, data_ptr_t key,
+                                  unsigned long hash,
+                                  comp_func_t key_comp_func) {
+    if (index == NULL) {
+        return NULL;
+    }
+
+    int mask = capacity - 1;
+    int slot = get_database_index_slot(hash, capacity);
+
+    // linear probing, the index always has free slots so this terminates
+    while (index[slot].node != NULL) {
+        const DatabaseIndexEntry *entry = &index[slot];
+
+        if (entry->hash == hash &&
+            key_comp_func(entry->node->data->data, key) == STRCMP_EQUAL) {
+            return entry->node;
         }
 
-        current_node = current_node->next;
+        slot = (slot + 1) & mask;
     }
 
     return NULL;
 }
 
+static void insert_to_database_index(DatabaseIndexEntry *index, int capacity,
+                                     unsigned long hash, Node *node) {
+    int slot = get_database_index_slot(hash, capacity);
+
+    while (index[slot].node != NULL) {
+        slot = (slot + 1) & (capacity - 1);
+    }
+
+    index[slot].hash = hash;
+    index[slot].node = node;
+}
+
+static bool reserve_database_index(DatabaseIndexEntry **index, int *capacity,
+                                   int size) {
+    int old_capacity = *capacity;
+    int needed_size = size + 1;
+
+    if (*index != NULL &&
+        needed_size * DATABASE_INDEX_LOAD_FACTOR_INVERSE <= old_capacity) {
+        return true;
+    }
+
+    int new_capacity = (old_capacity == 0) ? DATABASE_INDEX_INITIAL_CAPACITY
+                                           : old_capacity * 2;
+    DatabaseIndexEntry *new_index =
+            (DatabaseIndexEntry *) calloc(new_capacity, sizeof *new_index);
+    if (new_index == NULL) {
+        return false;
+    }
+
+    // re-insert the existing nodes using their stored hashes
+    for (int i = 0; i < old_capacity; ++i) {
+        DatabaseIndexEntry *entry = &(*index)[i];
+        if (entry->node != NULL) {
+            insert_to_database_index(new_index, new_capacity, entry->hash,
+                                     entry->node);
+        }
+    }
+
+    free(*index);
+    *index = new_index;
+    *capacity = new_capacity;
+
+    return true;
+}
+
 MarkovNodeFrequency *
 increase_markov_node_frequency_size(MarkovNode *markov_node) {
     assert(markov_node != NULL);
 
-    // Allocate frequencies list if it does not exist
-    if (markov_node->frequencies_list == NULL) {
-        markov_node->frequencies_list =
+    if (!grow_frequencies_list(NULL, markov_node)) {
+        return NULL;
+    }
+
+    return markov_node->frequencies_list;
+}
+
+static bool grow_frequencies_list(EpochDomain *epoch,
+                                  MarkovNode *markov_node) {
+    if (markov_node->frequencies_list != NULL &&
+        markov_node->frequencies_list_size <
+        markov_node->frequencies_list_max_size) {
+        // there is still room in the frequencies list
+        return true;
+    }
+
+    // Double the capacity of the frequencies list (realloc of NULL allocates)
+    int new_max_size = (markov_node->frequencies_list_max_size == 0)
+                       ? FREQUENCIES_LIST_INITIAL_CAPACITY
+                       : markov_node->frequencies_list_max_size * 2;
+
+    if (epoch != NULL || markov_node->packed_successors) {
+        // readers may be using the arrays, or they are slices of the packed
+        // arrays of the chain, publish grown copies of them
+        int *new_frequency_tree = (int *) malloc(
+                (new_max_size + 1) * sizeof *new_frequency_tree);
+        MarkovNodeFrequency *new_frequencies_list =
                 (MarkovNodeFrequency *) malloc(
-                        sizeof *markov_node->frequencies_list);
+                        new_max_size * sizeof *new_frequencies_list);
+        if (new_frequency_tree == NULL || new_frequencies_list == NULL) {
+            free(new_frequency_tree);
+            free(new_frequencies_list);
+            return false;
+        }
+
+        int size = markov_node->frequencies_list_size;
+        if (size > 0) {
+            memcpy(new_frequency_tree, markov_node->frequency_tree,
+                   (size + 1) * sizeof *new_frequency_tree);
+            memcpy(new_frequencies_list, markov_node->frequencies_list,
+                   size * sizeof *new_frequencies_list);
+        }
 
-        if (markov_node->frequencies_list != NULL) {
-            markov_node->frequencies_list_max_size = 1;
-            markov_node->frequencies_list_size = 0;
-            markov_node->frequencies_list->frequency = 0;
-            markov_node->frequencies_list->markov_node = NULL;
+        int *old_frequency_tree = markov_node->frequency_tree;
+        MarkovNodeFrequency *old_frequencies_list =
+                markov_node->frequencies_list;
+
+        __atomic_store_n(&markov_node->frequency_tree, new_frequency_tree,
+                         __ATOMIC_RELEASE);
+        __atomic_store_n(&markov_node->frequencies_list, new_frequencies_list,
+                         __ATOMIC_RELEASE);
+        markov_node->frequencies_list_max_size = new_max_size;
+
+        if (markov_node->packed_successors) {
+            // the packed arrays are freed with the chain
+            markov_node->packed_successors = false;
+            return true;
         }
 
-        return markov_node->frequencies_list;
+        retire_to_epoch(epoch, old_frequency_tree);
+        retire_to_epoch(epoch, old_frequencies_list);
+        return true;
     }
 
-    // If it exists, resize it
+    // the frequency tree is 1-based, it has one more entry than the list
+    int *realloced_frequency_tree =
+            (int *) realloc(markov_node->frequency_tree,
+                            (new_max_size + 1) *
+                            sizeof *markov_node->frequency_tree);
+    if (realloced_frequency_tree == NULL) {
+        return false;
+    }
+    markov_node->frequency_tree = realloced_frequency_tree;
 
-    // Increase frequencies_list_size by one
-    MarkovNodeFrequency *realloced_markov_node =
+    MarkovNodeFrequency *realloced_frequencies_list =
             (MarkovNodeFrequency *) realloc(markov_node->frequencies_list,
-                                            (markov_node->frequencies_list_size +
-                                             1)
-                                            * (sizeof *markov_node
-                                                    ->frequencies_list
-                                            ));
+                                            new_max_size * (sizeof
+                                                    *markov_node
+                                                    ->frequencies_list));
 
-    if (realloced_markov_node == NULL) {
-        return NULL;
+    if (realloced_frequencies_list == NULL) {
+        return false;
     }
 
-    markov_node->frequencies_list = realloced_markov_node;
-
-    markov_node->frequencies_list_max_size += 1;
+    markov_node->frequencies_list = realloced_frequencies_list;
+    markov_node->frequencies_list_max_size = new_max_size;
 
-    return markov_node->frequencies_list;
+    return true;
 }
 
 int get_node_from_frequencies_list(MarkovNode *first_node,
@@ -161,6 +859,25 @@ int get_node_from_frequencies_list(MarkovNode *first_node,
         return NOT_IN_ARRAY;
     }
 
+    if (first_node->successor_index != NULL) {
+        int mask = first_node->successor_index_capacity - 1;
+        int slot = get_database_index_slot(
+                (unsigned long) (uintptr_t) second_node,
+                first_node->successor_index_capacity);
+
+        while (first_node->successor_index[slot] != NOT_IN_ARRAY) {
+            int list_idx = first_node->successor_index[slot];
+            if (first_node->frequencies_list[list_idx].markov_node ==
+                second_node) {
+                return list_idx;
+            }
+
+            slot = (slot + 1) & mask;
+        }
+
+        return NOT_IN_ARRAY;
+    }
+
     for (int i = 0; i < first_node->frequencies_list_size; ++i) {
         // The node in the frequencies array, and the second_node should be in
         // the same place in memory
@@ -172,20 +889,114 @@ int get_node_from_frequencies_list(MarkovNode *first_node,
     return NOT_IN_ARRAY;
 }
 
+static void insert_to_successor_index(int *index, int capacity,
+                                      MarkovNodeFrequency *frequencies_list,
+                                      int list_idx) {
+    int slot = get_database_index_slot(
+            (unsigned long) (uintptr_t) frequencies_list[list_idx].markov_node,
+            capacity);
+
+    while (index[slot] != NOT_IN_ARRAY) {
+        slot = (slot + 1) & (capacity - 1);
+    }
+
+    index[slot] = list_idx;
+}
+
+static bool reserve_successor_index(MarkovNode *markov_node) {
+    int needed_size = markov_node->frequencies_list_size + 1;
+
+    if (needed_size <= SUCCESSOR_INDEX_MIN_LIST_SIZE ||
+        needed_size * SUCCESSOR_INDEX_LOAD_FACTOR_INVERSE <=
+        markov_node->successor_index_capacity) {
+        return true;
+    }
+
+    int new_capacity = markov_node->successor_index_capacity;
+    if (new_capacity == 0) {
+        new_capacity = DATABASE_INDEX_INITIAL_CAPACITY;
+    }
+    while (needed_size * SUCCESSOR_INDEX_LOAD_FACTOR_INVERSE > new_capacity) {
+        new_capacity *= 2;
+    }
+
+    int *new_index = (int *) malloc(new_capacity * sizeof *new_index);
+    if (new_index == NULL) {
+        return false;
+    }
+
+    for (int i = 0; i < new_capacity; ++i) {
+        new_index[i] = NOT_IN_ARRAY;
+    }
+
+    for (int i = 0; i < markov_node->frequencies_list_size; ++i) {
+        insert_to_successor_index(new_index, new_capacity,
+                                  markov_node->frequencies_list, i);
+    }
+
+    free(markov_node->successor_index);
+    markov_node->successor_index = new_index;
+    markov_node->successor_index_capacity = new_capacity;
+
+    return true;
+}
+
 bool
 add_node_to_frequencies_list(MarkovNode *first_node, MarkovNode *second_node) {
+    return add_frequency_to_frequencies_list(first_node, second_node, 1);
+}
+
+bool add_frequency_to_frequencies_list(MarkovNode *first_node,
+                                       MarkovNode *second_node,
+                                       int frequency) {
+    return add_frequency_to_node(NULL, first_node, second_node, frequency);
+}
+
+bool add_transition_to_markov_chain(MarkovChain *markov_chain,
+                                    MarkovNode *first_node,
+                                    MarkovNode *second_node, int frequency) {
+    assert(markov_chain != NULL);
+
+    if (markov_chain->writers == NULL) {
+        return add_frequency_to_node(markov_chain->epoch, first_node,
+                                     second_node, frequency);
+    }
+
+    // finding the entry reads arrays another writer may be growing, so the
+    // whole update is done under the node's lock
+    pthread_mutex_t *node_lock = &markov_chain->writers->node_locks[
+            get_database_index_slot((unsigned long) (uintptr_t) first_node,
+                                    NODE_LOCK_STRIPES)];
+
+    pthread_mutex_lock(node_lock);
+    bool added = add_frequency_to_node(NULL, first_node, second_node,
+                                       frequency);
+    pthread_mutex_unlock(node_lock);
+
+    return added;
+}
+
+static bool add_frequency_to_node(EpochDomain *epoch, MarkovNode *first_node,
+                                  MarkovNode *second_node, int frequency) {
     assert(first_node != NULL);
     assert(second_node != NULL);
 
+    // the total is published last, a reader that sees it also sees the tree
+    // and the list it sums
     int node_idx = get_node_from_frequencies_list(first_node, second_node);
     if (node_idx != NOT_IN_ARRAY) {
         // node exists, increase its frequency
-        first_node->frequencies_list[node_idx].frequency++;
+        first_node->frequencies_list[node_idx].frequency += frequency;
+        add_to_frequency_tree(first_node, node_idx, frequency);
+        __atomic_store_n(&first_node->total_frequency,
+                         first_node->total_frequency + frequency,
+                         __ATOMIC_RELEASE);
         return true;
     }
 
     // node does not exist, add it
-    if (increase_markov_node_frequency_size(first_node) == NULL) {
+    if (!grow_frequencies_list(epoch, first_node) ||
+        !reserve_successor_index(first_node)) {
         // allocation error
         return false;
     }
@@ -194,11 +1005,300 @@ add_node_to_frequencies_list(MarkovNode *first_node, MarkovNode *second_node) {
     MarkovNodeFrequency *node_frequency =
             &first_node->frequencies_list[node_idx];
 
-    node_frequency->frequency = 1;
+    node_frequency->frequency = frequency;
     node_frequency->markov_node = second_node;
 
-    first_node->frequencies_list_size++;
+    append_to_frequency_tree(first_node);
+    __atomic_store_n(&first_node->frequencies_list_size, node_idx + 1,
+                     __ATOMIC_RELEASE);
+    __atomic_store_n(&first_node->total_frequency,
+                     first_node->total_frequency + frequency,
+                     __ATOMIC_RELEASE);
+
+    if (first_node->successor_index != NULL) {
+        insert_to_successor_index(first_node->successor_index,
+                                  first_node->successor_index_capacity,
+                                  first_node->frequencies_list, node_idx);
+    }
+
+    return true;
+}
+
+static int sum_frequency_tree(const MarkovNode *markov_node, int count) {
+    int sum = 0;
+    for (int i = count; i > 0; i -= i & -i) {
+        sum += markov_node->frequency_tree[i];
+    }
+
+    return sum;
+}
+
+static void add_to_frequency_tree(MarkovNode *markov_node, int idx,
+                                  int frequency) {
+    int *frequency_tree = markov_node->frequency_tree;
+
+    // entries are only read concurrently, never written, so a single
+    // atomic store per entry is enough
+    for (int i = idx + 1; i <= markov_node->frequencies_list_size;
+         i += i & -i) {
+        __atomic_store_n(&frequency_tree[i], frequency_tree[i] + frequency,
+                         __ATOMIC_RELAXED);
+    }
+}
+
+static void append_to_frequency_tree(MarkovNode *markov_node) {
+    // the new entry is at the end of the list, not counted in its size yet
+    int i = markov_node->frequencies_list_size + 1;
+
+    // entry i covers the new frequency and the ones in (i - lowbit(i), i)
+    __atomic_store_n(&markov_node->frequency_tree[i],
+                     markov_node->frequencies_list[i - 1].frequency +
+                     sum_frequency_tree(markov_node, i - 1) -
+                     sum_frequency_tree(markov_node, i - (i & -i)),
+                     __ATOMIC_RELAXED);
+}
+
+static int search_frequency_tree(const int *frequency_tree, int size,
+                                 int random_weight) {
+    int step = 1;
+    while (step * 2 <= size) {
+        step *= 2;
+    }
+
+    // the longest prefix whose sum is at most random_weight
+    int position = 0;
+    for (; step > 0; step /= 2) {
+        int entry = (position + step <= size)
+                    ? __atomic_load_n(&frequency_tree[position + step],
+                                      __ATOMIC_RELAXED)
+                    : 0;
+        if (position + step <= size && entry <= random_weight) {
+            position += step;
+            random_weight -= entry;
+        }
+    }
+
+    return position;
+}
+
+EpochDomain *enable_concurrent_readers(MarkovChain *markov_chain) {
+    assert(markov_chain != NULL);
+
+    if (markov_chain->writers != NULL) {
+        return NULL;
+    }
+
+    if (markov_chain->epoch == NULL) {
+        markov_chain->epoch = new_epoch_domain();
+    }
+
+    return markov_chain->epoch;
+}
+
+bool enable_concurrent_writers(MarkovChain *markov_chain) {
+    assert(markov_chain != NULL);
+
+    if (markov_chain->writers != NULL) {
+        return true;
+    }
+
+    if (markov_chain->epoch != NULL ||
+        allocate_database(markov_chain) == NULL ||
+        markov_chain->database->size > 0) {
+        return false;
+    }
+
+    // the shards must be aligned to their cache lines
+    ConcurrentWriters *writers = (ConcurrentWriters *) aligned_alloc(
+            _Alignof(ConcurrentWriters), sizeof *writers);
+    if (writers == NULL) {
+        return false;
+    }
+
+    memset(writers, 0, sizeof *writers);
+    for (int i = 0; i < DATABASE_SHARDS; ++i) {
+        pthread_mutex_init(&writers->shards[i].lock, NULL);
+    }
+    for (int i = 0; i < NODE_LOCK_STRIPES; ++i) {
+        pthread_mutex_init(&writers->node_locks[i], NULL);
+    }
+
+    markov_chain->writers = writers;
+
+    if (markov_chain->arena != NULL) {
+        // every shard bumps in an arena of its own, under its own lock
+        for (int i = 0; i < DATABASE_SHARDS; ++i) {
+            writers->shards[i].arena = new_arena(ARENA_DEFAULT_SLAB_SIZE);
+            if (writers->shards[i].arena == NULL) {
+                link_database_shards(markov_chain, NULL, 0, NULL);
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+bool disable_concurrent_writers(MarkovChain *markov_chain) {
+    assert(markov_chain != NULL);
+
+    if (markov_chain->writers == NULL) {
+        return true;
+    }
+
+    int size = 0;
+    for (int i = 0; i < DATABASE_SHARDS; ++i) {
+        size += markov_chain->writers->shards[i].size;
+    }
+
+    int capacity = DATABASE_INDEX_INITIAL_CAPACITY;
+    while ((size + 1) * DATABASE_INDEX_LOAD_FACTOR_INVERSE > capacity) {
+        capacity *= 2;
+    }
+
+    // allocate everything first, so a failure leaves the chain as it was
+    DatabaseIndexEntry *index =
+            (DatabaseIndexEntry *) calloc(capacity, sizeof *index);
+    MarkovNode **start_candidates = (MarkovNode **) malloc(
+            (size + 1) * sizeof *start_candidates);
+    if (index == NULL || start_candidates == NULL) {
+        free(index);
+        free(start_candidates);
+        return false;
+    }
+
+    free(markov_chain->database_index);
+    markov_chain->database_index = index;
+    markov_chain->database_index_capacity = capacity;
+
+    free(markov_chain->start_candidates);
+    markov_chain->start_candidates = start_candidates;
+    markov_chain->start_candidates_size = 0;
+    markov_chain->start_candidates_max_size = size + 1;
+
+    link_database_shards(markov_chain, index, capacity, start_candidates);
+    return true;
+}
+
+static void link_database_shards(MarkovChain *markov_chain,
+                                 DatabaseIndexEntry *index, int capacity,
+                                 MarkovNode **start_candidates) {
+    ConcurrentWriters *writers = markov_chain->writers;
+    LinkedList *database = markov_chain->database;
+
+    for (int i = 0; i < DATABASE_SHARDS; ++i) {
+        DatabaseShard *shard = &writers->shards[i];
+
+        int id = database->size;
+        for (Node *node = shard->first; node != NULL; node = node->next) {
+            node->data->id = id++;
+            if (start_candidates != NULL && !node->data->is_last) {
+                start_candidates[markov_chain->start_candidates_size++] =
+                        node->data;
+            }
+        }
+
+        if (shard->first != NULL) {
+            if (database->first == NULL) {
+                database->first = shard->first;
+            } else {
+                database->last->next = shard->first;
+            }
+            database->last = shard->last;
+            database->size += shard->size;
+        }
+
+        // the hashes stored in the shard index save calling hash_func again
+        for (int j = 0; index != NULL && j < shard->index_capacity; ++j) {
+            if (shard->index[j].node != NULL) {
+                insert_to_database_index(index, capacity, shard->index[j].hash,
+                                         shard->index[j].node);
+            }
+        }
+
+        free(shard->index);
+        if (markov_chain->arena != NULL) {
+            merge_arenas(markov_chain->arena, &shard->arena);
+        }
+        pthread_mutex_destroy(&shard->lock);
+    }
+
+    for (int i = 0; i < NODE_LOCK_STRIPES; ++i) {
+        pthread_mutex_destroy(&writers->node_locks[i]);
+    }
+
+    free(writers);
+    markov_chain->writers = NULL;
+}
+
+bool append_sequence_to_markov_chain(MarkovChain *markov_chain,
+                                     data_ptr_t *sequence, int length) {
+    assert(markov_chain != NULL);
+    assert(sequence != NULL || length == 0);
+
+    MarkovNode *prev_node = NULL;
+    for (int i = 0; i < length; ++i) {
+        Node *node = add_to_database(markov_chain, sequence[i]);
+        if (node == NULL) {
+            return false;
+        }
+
+        if (prev_node != NULL &&
+            !add_transition_to_markov_chain(markov_chain, prev_node,
+                                            node->data, 1)) {
+            return false;
+        }
+
+        prev_node = node->data;
+    }
+
+    return true;
+}
+
+bool merge_markov_chains(MarkovChain *markov_chain, MarkovChain *source_chain) {
+    assert(markov_chain != NULL);
+    assert(source_chain != NULL);
+
+    if (source_chain->database == NULL || source_chain->database->size == 0) {
+        return true;
+    }
+
+    // the node in markov_chain of every source node, by the source node's id
+    MarkovNode **merged_nodes = (MarkovNode **) malloc(
+            source_chain->database->size * sizeof *merged_nodes);
+    if (merged_nodes == NULL) {
+        return false;
+    }
+
+    // add all the states first, so they keep their order of appearance
+    for (Node *node = source_chain->database->first; node != NULL;
+         node = node->next) {
+        Node *merged_node = add_to_database(markov_chain, node->data->data);
+        if (merged_node == NULL) {
+            free(merged_nodes);
+            return false;
+        }
+
+        merged_nodes[node->data->id] = merged_node->data;
+    }
+
+    for (Node *node = source_chain->database->first; node != NULL;
+         node = node->next) {
+        MarkovNode *source_node = node->data;
 
+        for (int i = 0; i < source_node->frequencies_list_size; ++i) {
+            MarkovNodeFrequency *edge = &source_node->frequencies_list[i];
+
+            if (!add_transition_to_markov_chain(
+                    markov_chain, merged_nodes[source_node->id],
+                    merged_nodes[edge->markov_node->id], edge->frequency)) {
+                free(merged_nodes);
+                return false;
+            }
+        }
+    }
+
+    free(merged_nodes);
     return true;
 }
 
@@ -207,11 +1307,15 @@ void free_database(MarkovChain **ptr_chain) {
         return;
     }
 
-    if ((*ptr_chain)->database == NULL) {
-        return;
+    // states still in the shards are freed with the rest of the database
+    if ((*ptr_chain)->writers != NULL) {
+        link_database_shards(*ptr_chain, NULL, 0, NULL);
     }
 
-    Node *next_node = (*ptr_chain)->database->first;
+    // the chain may own an arena even if nothing was added to it yet
+    Node *next_node = ((*ptr_chain)->database != NULL)
+                      ? (*ptr_chain)->database->first : NULL;
+    bool uses_arena = (*ptr_chain)->arena != NULL;
 
     while (next_node != NULL) {
         Node *prev_node;
@@ -220,24 +1324,34 @@ void free_database(MarkovChain **ptr_chain) {
         assert(markov_node != NULL);
         assert(markov_node->data != NULL);
 
-        // free the word itself
-        (*ptr_chain)->free_data((void *) markov_node->data);
-        // free the frequencies list
-        if (markov_node->frequencies_list != NULL) {
-            free(next_node->data->frequencies_list);
+        // free the frequencies list and its sampling structures
+        if (!markov_node->packed_successors) {
+            free(markov_node->frequencies_list);
+            free(markov_node->frequency_tree);
         }
-        // free the markov node
-        free(markov_node);
+        free(markov_node->successor_index);
 
         prev_node = next_node;
         next_node = prev_node->next;
 
-        // free the linked list node
-        free(prev_node);
+        if (!uses_arena) {
+            // free the word itself, the markov node and the linked list node
+            (*ptr_chain)->free_data((void *) markov_node->data);
+            free(markov_node);
+            free(prev_node);
+        }
     }
 
-    // free the database linked list
+    // the arena holds the rest of the nodes, release them all at once
+    free_arena(&(*ptr_chain)->arena);
+
+    // free the database linked list and its index
     free((*ptr_chain)->database);
+    free((*ptr_chain)->database_index);
+    free((*ptr_chain)->start_candidates);
+    free((*ptr_chain)->packed_frequencies_lists);
+    free((*ptr_chain)->packed_frequency_trees);
+    free_epoch_domain(&(*ptr_chain)->epoch);
     free(*ptr_chain);
     *ptr_chain = NULL;
 }
@@ -246,6 +1360,49 @@ int get_random_number(int max_number) {
     return rand() % max_number;
 }
 
+static uint64_t mix_bits(uint64_t bits) {
+    bits = (bits ^ (bits >> 30)) * SPLITMIX_MULTIPLIER_1;
+    bits = (bits ^ (bits >> 27)) * SPLITMIX_MULTIPLIER_2;
+    return bits ^ (bits >> 31);
+}
+
+void init_random_state(RandomState *random_state, uint64_t seed,
+                       uint64_t stream) {
+    assert(random_state != NULL);
+
+    random_state->key =
+            mix_bits(mix_bits(seed) + (stream + 1) * SPLITMIX_INCREMENT);
+    random_state->counter = 0;
+}
+
+int get_random_number_from_state(RandomState *random_state, int max_number) {
+    if (random_state == NULL) {
+        return get_random_number(max_number);
+    }
+
+    random_state->counter++;
+    uint64_t bits = mix_bits(random_state->key +
+                             random_state->counter * SPLITMIX_INCREMENT);
+
+    // scale the high 32 bits into [0, max_number)
+    return (int) (((bits >> RANDOM_BITS_SHIFT) * (uint64_t) max_number)
+            >> RANDOM_BITS_SHIFT);
+}
+
+void get_random_numbers_from_states(const uint64_t *keys,
+                                    uint64_t *counters,
+                                    const int32_t *max_numbers,
+                                    int32_t *random_numbers, int count) {
+    for (int i = 0; i < count; ++i) {
+        counters[i]++;
+        uint64_t bits = mix_bits(keys[i] + counters[i] * SPLITMIX_INCREMENT);
+
+        random_numbers[i] = (int32_t) (((bits >> RANDOM_BITS_SHIFT) *
+                                        (uint64_t) max_numbers[i])
+                >> RANDOM_BITS_SHIFT);
+    }
+}
+
 Node *get_node_in_index(LinkedList *list, int index) {
     Node *curr_node = list->first;
     for (int i = 0; i < index; ++i) {
@@ -255,44 +1412,55 @@ Node *get_node_in_index(LinkedList *list, int index) {
 }
 
 MarkovNode *get_first_random_node(MarkovChain *markov_chain) {
+    return get_first_random_node_from_state(markov_chain, NULL);
+}
+
+MarkovNode *get_first_random_node_from_state(MarkovChain *markov_chain,
+                                             RandomState *random_state) {
     assert(markov_chain != NULL);
-    assert(markov_chain->database != NULL);
 
-    Node *node;
-    do {
-        int random_index = get_random_number(markov_chain->database->size);
-        node = get_node_in_index(markov_chain->database, random_index);
-    } while (markov_chain->is_last(node->data->data));
+    // the size first, the array it was published with is at least as big
+    int size = __atomic_load_n(&markov_chain->start_candidates_size,
+                               __ATOMIC_ACQUIRE);
+    if (size == 0) {
+        return NULL;
+    }
 
-    return node->data;
+    MarkovNode **start_candidates = __atomic_load_n(
+            &markov_chain->start_candidates, __ATOMIC_ACQUIRE);
+    int random_index = get_random_number_from_state(random_state, size);
+    return start_candidates[random_index];
 }
 
 MarkovNode *get_next_random_node(MarkovNode *state_struct_ptr) {
+    return get_next_random_node_from_state(state_struct_ptr, NULL);
+}
+
+MarkovNode *get_next_random_node_from_state(MarkovNode *state_struct_ptr,
+                                            RandomState *random_state) {
     assert(state_struct_ptr != NULL);
 
-    if (state_struct_ptr->frequencies_list_size == 0) {
+    // the writer publishes the arrays, then the size, then the total. read
+    // in the opposite order, so the arrays cover at least the total
+    int total_frequency = __atomic_load_n(&state_struct_ptr->total_frequency,
+                                          __ATOMIC_ACQUIRE);
+    if (total_frequency == 0) {
         return NULL;
     }
 
-    assert(state_struct_ptr->frequencies_list != NULL);
-
-    // calculate wights sum
-    int total_weight = 0;
-    for (int i = 0; i < state_struct_ptr->frequencies_list_size; ++i) {
-        total_weight += state_struct_ptr->frequencies_list[i].frequency;
-    }
-
-    int random_weight = get_random_number(total_weight);
+    int size = __atomic_load_n(&state_struct_ptr->frequencies_list_size,
+                               __ATOMIC_ACQUIRE);
+    const int *frequency_tree = __atomic_load_n(
+            &state_struct_ptr->frequency_tree, __ATOMIC_ACQUIRE);
+    MarkovNodeFrequency *frequencies_list = __atomic_load_n(
+            &state_struct_ptr->frequencies_list, __ATOMIC_ACQUIRE);
 
-    for (int i = 0; i < state_struct_ptr->frequencies_list_size; ++i) {
-        if (random_weight < state_struct_ptr->frequencies_list[i].frequency) {
-            return state_struct_ptr->frequencies_list[i].markov_node;
-        }
+    int random_weight = get_random_number_from_state(random_state,
+                                                     total_frequency);
 
-        random_weight -= state_struct_ptr->frequencies_list[i].frequency;
-    }
-
-    return NULL;
+    int chosen_idx = search_frequency_tree(frequency_tree, size,
+                                           random_weight);
+    return frequencies_list[chosen_idx].markov_node;
 }
 
 void generate_tweet(MarkovChain *markov_chain, MarkovNode *first_node,
@@ -303,6 +1471,12 @@ void generate_tweet(MarkovChain *markov_chain, MarkovNode *first_node,
         first_node = get_first_random_node(markov_chain);
     }
 
+    if (first_node == NULL) {
+        // there is no state a sequence can start from
+        printf("\n");
+        return;
+    }
+
     MarkovNode *prev_node;
     prev_node = first_node;
 
@@ -324,7 +1498,7 @@ void generate_tweet(MarkovChain *markov_chain, MarkovNode *first_node,
         printf(" ");
         markov_chain->print_func(next_node->data);
 
-        if (markov_chain->is_last(next_node->data)) {
+        if (next_node->is_last) {
             break;
         }
 
@@ -332,4 +1506,48 @@ void generate_tweet(MarkovChain *markov_chain, MarkovNode *first_node,
     }
 
     printf("\n");
-}
\ No newline at end of file
+}
+
+bool generate_tweet_to_buffer(MarkovChain *markov_chain,
+                              MarkovNode *first_node, int max_length,
+                              serialize_func_t serialize_func,
+                              ByteBuffer *buffer) {
+    assert(markov_chain != NULL);
+    assert(buffer != NULL);
+
+    if (first_node == NULL) {
+        first_node = get_first_random_node(markov_chain);
+    }
+
+    if (first_node == NULL) {
+        // there is no state a sequence can start from
+        return append_string_to_byte_buffer(buffer, "\n");
+    }
+
+    if (!serialize_func(first_node->data, buffer)) {
+        return false;
+    }
+
+    MarkovNode *prev_node = first_node;
+    // start i from 1 because we already have first node
+    for (int i = 1; i < max_length; ++i) {
+        MarkovNode *next_node = get_next_random_node(prev_node);
+
+        if (next_node == NULL) {
+            break;
+        }
+
+        if (!append_string_to_byte_buffer(buffer, " ") ||
+            !serialize_func(next_node->data, buffer)) {
+            return false;
+        }
+
+        if (next_node->is_last) {
+            break;
+        }
+
+        prev_node = next_node;
+    }
+
+    return append_string_to_byte_buffer(buffer, "\n");
+}
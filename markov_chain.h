@@ -3,13 +3,33 @@
 #define NDEBUG
 
 #include "linked_list.h"
+#include "arena.h"
+#include "byte_buffer.h"
+#include "epoch.h"
 #include <stdio.h>  // For printf(), sscanf()
 #include <stdlib.h> // For exit(), malloc()
 #include <stdbool.h> // for bool
+#include <stdint.h> // for uintptr_t
+#include <pthread.h> // for pthread_mutex_t
 
 #define ALLOCATION_ERROR_MASSAGE "Allocation failure: Failed to allocate"\
             "new memory\n"
 
+/** The number of shards of the database index of a chain with concurrent
+ * writers, a power of two */
+#define DATABASE_SHARDS 64
+
+/** The number of locks the frequencies lists of a chain with concurrent
+ * writers are striped over, a power of two */
+#define NODE_LOCK_STRIPES 1024
+
+/** The size of a cache line, every database shard takes lines of its own */
+#define WRITERS_CACHE_LINE_SIZE 64
+
+/** Scramble the hashes of the states before they pick their index slots */
+#define HASH_MIX_MULTIPLIER 0x9E3779B97F4A7C15ULL
+#define HASH_MIX_SHIFT 32
+
 /***************************/
 /*   insert typedefs here  */
 /***************************/
@@ -31,9 +51,12 @@ typedef void *data_ptr_t;
 
 typedef void (*print_func_t)(data_ptr_t);
 typedef int (*comp_func_t)(data_ptr_t, data_ptr_t);
+typedef unsigned long (*hash_func_t)(data_ptr_t);
 typedef data_ptr_t (*copy_func_t)(data_ptr_t);
 typedef void (*free_data_t)(data_ptr_t);
 typedef bool (*is_last_t)(data_ptr_t);
+typedef size_t (*data_size_func_t)(data_ptr_t);
+typedef bool (*serialize_func_t)(data_ptr_t, ByteBuffer *);
 
 /**
  * @brief This represents a single markov node, a word, in a possible tweet.
@@ -42,6 +65,33 @@ typedef bool (*is_last_t)(data_ptr_t);
  */
 typedef struct MarkovChain MarkovChain;
 
+/**
+ * @brief An explicit, seedable random number generator state. It is
+ * counter-based: the n-th number of the stream (seed, stream) depends only
+ * on seed, stream and n, so independent streams can be used by different
+ * threads, in any order, with reproducible results.
+ */
+typedef struct RandomState RandomState;
+
+/**
+ * @brief A single slot of the database hash index. Holds the hash of the
+ * node's data, so the index can be grown without calling hash_func again.
+ */
+typedef struct DatabaseIndexEntry DatabaseIndexEntry;
+
+/**
+ * @brief A part of the database of a chain with concurrent writers: the
+ * states whose hashes fall into this shard, with an index and a lock of
+ * their own, so writers of different shards never wait for each other.
+ */
+typedef struct DatabaseShard DatabaseShard;
+
+/**
+ * @brief The state of a chain several threads add to at once, see
+ * enable_concurrent_writers.
+ */
+typedef struct ConcurrentWriters ConcurrentWriters;
+
 /***************************/
 
 /***************************/
@@ -58,6 +108,60 @@ struct MarkovNodeFrequency
     int frequency;
 };
 
+struct RandomState
+{
+    /** Derived from the seed and the stream number */
+    uint64_t key;
+
+    /** The number of random numbers drawn so far */
+    uint64_t counter;
+};
+
+struct DatabaseIndexEntry
+{
+    /** The (unmixed) hash of the data inside `node`, as returned by
+     * hash_func */
+    unsigned long hash;
+
+    /** The database node in this slot, NULL if the slot is empty */
+    Node *node;
+};
+
+struct DatabaseShard
+{
+    /** Taken to find or add a state of this shard */
+    _Alignas(WRITERS_CACHE_LINE_SIZE) pthread_mutex_t lock;
+
+    /** Open-addressing (linear probing) hash index over the states of this
+     * shard, NULL until the first state is added */
+    DatabaseIndexEntry *index;
+
+    /** The number of slots in `index`, always a power of two */
+    int index_capacity;
+
+    /** The number of states in this shard */
+    int size;
+
+    /** The states of this shard in the order they were added, linked to
+     * each other but not to the database yet */
+    Node *first;
+    Node *last;
+
+    /** The arena the states of this shard are allocated from, if the chain
+     * has one. Merged into the chain's arena by disable_concurrent_writers. */
+    Arena *arena;
+};
+
+struct ConcurrentWriters
+{
+    /** The database, sharded by the hash of the states */
+    DatabaseShard shards[DATABASE_SHARDS];
+
+    /** Taken to change the frequencies list of a node, by the node's
+     * address */
+    pthread_mutex_t node_locks[NODE_LOCK_STRIPES];
+};
+
 struct MarkovChain
 {
     /** Pointer to a linked list of the unique words (Markov nodes) the program
@@ -74,6 +178,11 @@ struct MarkovChain
     //          - 0 if equal
     comp_func_t comp_func;
 
+    // pointer to a func that gets a pointer of generic data type and hashes it.
+    // two values that are equal by comp_func must have the same hash.
+    // returns the hash as an unsigned long.
+    hash_func_t hash_func;
+
     // a pointer to a function that gets a pointer of generic data type and frees it.
     // returns void.
     free_data_t free_data;
@@ -86,12 +195,78 @@ struct MarkovChain
     //      - true if it's the last state.
     //      - false otherwise.
     is_last_t is_last;
+
+    /** Open-addressing (linear probing) hash index over the nodes of
+     * `database`, used to find a node by its data in expected O(1).
+     * NULL until the first node is added. */
+    DatabaseIndexEntry *database_index;
+
+    /** The number of slots in `database_index`, always a power of two */
+    int database_index_capacity;
+
+    /** A contiguous array of the nodes a sequence can start from (the nodes
+     * whose data is not last). Kept up to date by add_to_database, so
+     * picking a random first node is a single indexed load. */
+    MarkovNode **start_candidates;
+
+    /** The size of the dynamic array `start_candidates` */
+    int start_candidates_size;
+
+    /** The maximum size of the dynamic array `start_candidates` */
+    int start_candidates_max_size;
+
+    /** If not NULL, the MarkovNodes, the database list Nodes and the copies
+     * of the data are bump-allocated from this arena, and released all at
+     * once by free_database. See allocate_arena. */
+    Arena *arena;
+
+    // a pointer to a function that gets a pointer of generic data type and
+    // returns the number of bytes to copy into the arena for it.
+    // only used when `arena` is not NULL, instead of copy_func and free_data.
+    data_size_func_t data_size;
+
+    /** If not NULL, the chain can be sampled by reader threads while one
+     * writer thread adds to it: arrays the readers use are grown by copying
+     * them and publishing the copy, and the old arrays are retired to this
+     * domain instead of being freed. See enable_concurrent_readers. */
+    EpochDomain *epoch;
+
+    /** If not NULL, several writer threads add to the chain at once, and its
+     * new states go to the shards of `writers` instead of `database`. See
+     * enable_concurrent_writers. */
+    ConcurrentWriters *writers;
+
+    /** If not NULL, the states of the chain are dense: the node of the state
+     * with id i is dense_nodes[i], and the nodes, their database list Nodes
+     * and their data are contiguous arrays in the chain's arena. States are
+     * found by their ids, never by their data. See allocate_dense_states. */
+    MarkovNode *dense_nodes;
+
+    /** The frequencies lists of the states, packed one after the other by
+     * reserve_dense_successors, NULL before that */
+    MarkovNodeFrequency *packed_frequencies_lists;
+
+    /** The frequency trees of the states, packed the same way */
+    int *packed_frequency_trees;
 };
 
 struct MarkovNode
 {
      data_ptr_t data;
 
+    /** The index of this node in the database, nodes are numbered densely
+     * from 0 in the order they were added */
+    int id;
+
+    /** The result of is_last on `data`, computed once when the node is
+     * created */
+    bool is_last;
+
+    /** True if `frequencies_list` and `frequency_tree` are slices of the
+     * chain's packed arrays: they are not freed with the node, and are
+     * copied out of the packed arrays once they have to grow. */
+    bool packed_successors;
+
     /** A list of the available paths from the current node (word) and the
      * frequency of each next word.
      * NULL if its the this node is the last in a sentence.
@@ -104,6 +279,25 @@ struct MarkovNode
 
     /** The maximum size of the dynamic array `frequencies_list` */
     int frequencies_list_max_size;
+
+    /** A Fenwick (binary indexed) tree over the frequencies in
+     * `frequencies_list`, 1-based: frequency_tree[i] is the sum of the
+     * frequencies in (i - lowbit(i), i]. Updated with every change to the
+     * list in O(log k), and used to sample the next node in O(log k), so the
+     * chain can be appended to and sampled in turns without rebuilds.
+     * Allocated with `frequencies_list_max_size` + 1 entries. */
+    int *frequency_tree;
+
+    /** The sum of the frequencies in `frequencies_list` */
+    int total_frequency;
+
+    /** Open-addressing hash index from a next MarkovNode to its index in
+     * `frequencies_list`, empty slots hold -1. Only built once the list is
+     * too long to scan, NULL before that. */
+    int *successor_index;
+
+    /** The number of slots in `successor_index`, always a power of two */
+    int successor_index_capacity;
 };
 
 /***************************/
@@ -118,7 +312,8 @@ struct MarkovNode
  * memory allocation failed.
  */
 MarkovChain *new_markov_chain (print_func_t print_func, comp_func_t
-comp_func, copy_func_t copy_func, free_data_t free_data, is_last_t is_last);
+comp_func, hash_func_t hash_func, copy_func_t copy_func, free_data_t
+free_data, is_last_t is_last);
 
 /**
  * @brief Allocated the database field of the markov_chain, if it is not
@@ -128,6 +323,105 @@ comp_func, copy_func_t copy_func, free_data_t free_data, is_last_t is_last);
  */
 LinkedList *allocate_database (MarkovChain *markov_chain);
 
+/**
+ * @brief Makes the markov chain allocate its nodes and the copies of their
+ * data from an arena, instead of a malloc per object. The data is copied
+ * with memcpy of data_size bytes, so copy_func and free_data are not used.
+ * Must be called before anything is added to the database.
+ * @param markov_chain The markov chain
+ * @param data_size Returns the number of bytes to copy for a given data
+ * @return NULL if allocation failed or the database is not empty, the arena
+ * otherwise
+ */
+Arena *allocate_arena (MarkovChain *markov_chain, data_size_func_t data_size);
+
+/**
+ * @brief Makes the chain safe to sample from reader threads while a single
+ * writer thread adds to it. A reader registers to the returned domain with
+ * register_epoch_reader, and wraps every walk in enter_epoch and
+ * exit_epoch; inside, it may only call get_first_random_node_from_state and
+ * get_next_random_node_from_state, and read the data of the nodes they
+ * return. Readers never block and never block the writer. The writer may
+ * add with add_to_database, append_sequence_to_markov_chain and
+ * merge_markov_chains.
+ * @param markov_chain The markov chain
+ * @return NULL if allocation failed, the chain's epoch domain otherwise
+ */
+EpochDomain *enable_concurrent_readers (MarkovChain *markov_chain);
+
+/**
+ * @brief Lets several writer threads add to the chain at once, without a
+ * global lock: the database is split into DATABASE_SHARDS shards by the hash
+ * of the states, each with a lock of its own, and every frequencies list is
+ * guarded by one of NODE_LOCK_STRIPES striped locks. Writers may call
+ * add_to_database, find_in_database, add_transition_to_markov_chain,
+ * append_sequence_to_markov_chain and merge_markov_chains. The chain can
+ * not be sampled until disable_concurrent_writers.
+ * Must be called before anything is added to the database, and can not be
+ * combined with enable_concurrent_readers.
+ * @param markov_chain The markov chain
+ * @return false if allocation failed, the database is not empty or the
+ * chain has concurrent readers, true otherwise
+ */
+bool enable_concurrent_writers (MarkovChain *markov_chain);
+
+/**
+ * @brief Ends the concurrent writes to the chain, once every writer is done:
+ * the states of the shards are appended to the database, shard by shard, so
+ * their order (and the ids given to them) depends on the hashes and on the
+ * order the writers reached them, not on the order of the input. Rebuilds
+ * the database index and the first-state candidates, after which the chain
+ * is an ordinary chain.
+ * @param markov_chain The markov chain
+ * @return false if allocation failed, the chain keeps its concurrent writers
+ * in that case, true otherwise
+ */
+bool disable_concurrent_writers (MarkovChain *markov_chain);
+
+/**
+ * @brief Gives the chain a fixed set of dense states, whose ids are 0 to
+ * num_of_states - 1, for states that map to integers, e.g. the cells of a
+ * board. The data of all the states is copied into the chain's arena with a
+ * single memcpy, and the nodes are created in one contiguous array, so
+ * neither copy_func, comp_func nor hash_func is called (they can be NULL).
+ * Afterwards, a state is found by its id with get_dense_node, and
+ * add_to_database fails: the chain can not get more states. Must be called
+ * before anything is added to the database.
+ * @param markov_chain The markov chain
+ * @param states The data of the states, state i at states + i * state_size
+ * @param state_size The size of the data of every state, in bytes
+ * @param num_of_states The number of states, at least 1
+ * @return false if allocation failed, the database is not empty or the
+ * chain has concurrent writers, true otherwise
+ */
+bool allocate_dense_states (MarkovChain *markov_chain, data_ptr_t states,
+                            size_t state_size, int num_of_states);
+
+/**
+ * @brief Returns the node of the state with the given id, in a chain with
+ * dense states.
+ * @param markov_chain The markov chain
+ * @param state_id The id of the state, 0 to the number of states - 1
+ * @return The node of the state
+ */
+MarkovNode *get_dense_node (MarkovChain *markov_chain, int state_id);
+
+/**
+ * @brief Reserves the frequencies lists of all the states of a chain with
+ * dense states at once: the lists are slices of one contiguous array, and
+ * the frequency trees of another, in the order of the ids. Transitions are
+ * then added as usual, without any allocation while a state has at most
+ * its reserved number of next states; a list that grows past it is copied
+ * out of the packed array. Must be called before any transition is added.
+ * @param markov_chain The markov chain, with dense states
+ * @param successor_counts The number of next states to reserve for every
+ * state, by its id
+ * @return false if allocation failed or transitions were already added,
+ * true otherwise
+ */
+bool reserve_dense_successors (MarkovChain *markov_chain,
+                               const int *successor_counts);
+
 /**
  * @brief A "constructor" for MarkovNode, you are resposible for freeing it
  * @return A new initialized instance (pointer) of MarkovNode. NULL if
@@ -136,10 +430,12 @@ LinkedList *allocate_database (MarkovChain *markov_chain);
 MarkovNode *new_markov_node ();
 
 /**
- * @brief Adds one new place in the MarkovNodeFrequency dynamic array, for the
- * given MarkovNode. You are in charge of freeing it.
+ * @brief Makes sure there is room for one more place in the
+ * MarkovNodeFrequency dynamic array, for the given MarkovNode. The array's
+ * capacity grows geometrically, so adding k places costs amortized O(k).
+ * You are in charge of freeing it.
  * @param markov_node The MarkovNode to allocate the MarkovFrequencyNode to.
- * @return The newly allocated MarkovNodeFrequency, NULL if allocation failed.
+ * @return The frequencies list, NULL if allocation failed.
  */
 MarkovNodeFrequency *increase_markov_node_frequency_size(MarkovNode
 *markov_node);
@@ -154,13 +450,39 @@ MarkovNodeFrequency *increase_markov_node_frequency_size(MarkovNode
  */
 Node *add_to_database (MarkovChain *markov_chain, data_ptr_t data_ptr);
 
+/**
+ * Same as add_to_database, with the hash of data_ptr already computed (it
+ * must be what hash_func returns for data_ptr).
+ * @param markov_chain the chain to look in its database
+ * @param data_ptr the state to look for
+ * @param hash the hash of data_ptr
+ * @return markov_node wrapping given data_ptr in given chain's database,
+ * returns NULL in case of memory allocation failure.
+ */
+Node *add_to_database_with_hash (MarkovChain *markov_chain,
+                                 data_ptr_t data_ptr, unsigned long hash);
+
+/**
+ * Look for a state by a key that is not necessarily of the chain's data
+ * type, e.g. a view of a word inside a larger text, so the key does not have
+ * to be copied into a data first.
+ * @param markov_chain the chain to look in its database
+ * @param key the key to look for
+ * @param hash the hash of key, must equal hash_func of the matching data
+ * @param key_comp_func compares a data (first) with a key (second), returns
+ *                      0 if they match
+ * @return Pointer to the Node of the matching state, NULL if there is none.
+ */
+Node *find_in_database (MarkovChain *markov_chain, data_ptr_t key,
+                        unsigned long hash, comp_func_t key_comp_func);
+
 /**
 * Check if data_ptr is in database. If so, return the markov_node wrapping it in
  * the markov_chain, otherwise return NULL.
  * @param markov_chain the chain to look in its database
  * @param data_ptr the state to look for
  * @return Pointer to the Node wrapping given state, NULL if state not in
- * database.
+ * database, or if the chain has dense states (see get_dense_node).
  */
 Node *get_node_from_database (MarkovChain *markov_chain, data_ptr_t data_ptr);
 
@@ -186,6 +508,64 @@ int get_node_from_frequencies_list (MarkovNode *first_node,
 bool
 add_node_to_frequencies_list (MarkovNode *first_node, MarkovNode *second_node);
 
+/**
+ * Add the second markov_node to the frequency list of the first markov_node
+ * with the given frequency. If already in list, add frequency to its
+ * occurrence frequency value.
+ * @param first_node
+ * @param second_node
+ * @param frequency How many times second_node followed first_node
+ * @return success/failure: true if the process was successful, false if in
+ * case of allocation error.
+ */
+bool add_frequency_to_frequencies_list (MarkovNode *first_node,
+                                        MarkovNode *second_node,
+                                        int frequency);
+
+/**
+ * Same as add_frequency_to_frequencies_list, for nodes of the given chain.
+ * Takes the lock of first_node if the chain has concurrent writers, and
+ * publishes the changes to its concurrent readers if it has any.
+ * @param markov_chain The chain of the nodes
+ * @param first_node
+ * @param second_node
+ * @param frequency How many times second_node followed first_node
+ * @return success/failure: true if the process was successful, false if in
+ * case of allocation error.
+ */
+bool add_transition_to_markov_chain (MarkovChain *markov_chain,
+                                     MarkovNode *first_node,
+                                     MarkovNode *second_node, int frequency);
+
+/**
+ * Add all the states and frequencies of source_chain to markov_chain. New
+ * states are added in the order they appear in source_chain, and the
+ * frequencies of existing transitions are summed, so merging the chains of
+ * consecutive parts of a corpus, in order, gives the chain of the whole
+ * corpus. Both chains must use the same data type and callbacks.
+ * @param markov_chain The chain to merge into
+ * @param source_chain The chain to merge from, it is not changed
+ * @return success/failure: true if the process was successful, false if in
+ * case of allocation error.
+ */
+bool merge_markov_chains (MarkovChain *markov_chain, MarkovChain *source_chain);
+
+/**
+ * Append a sequence of states, e.g. a new sentence, to a chain that may
+ * already be in use: new states are added to the database, and every state
+ * is linked to the state before it. The database index, the first-state
+ * candidates and the sampling trees are all updated in place, so the chain
+ * can be sampled right after, and an append costs O(length * log k) for k
+ * possible next states, regardless of the size of the chain.
+ * @param markov_chain The chain to append to
+ * @param sequence The data of the states, in order
+ * @param length The number of states in the sequence
+ * @return success/failure: true if the process was successful, false if in
+ * case of allocation error. The states before the failure are kept.
+ */
+bool append_sequence_to_markov_chain (MarkovChain *markov_chain,
+                                      data_ptr_t *sequence, int length);
+
 /**
  * Free markov_chain and all of it's content from memory
  * @param markov_chain markov_chain to free
@@ -193,14 +573,37 @@ add_node_to_frequencies_list (MarkovNode *first_node, MarkovNode *second_node);
 void free_database (MarkovChain **ptr_chain);
 
 /**
- * Get one random state from the given markov_chain's database.
+ * Get one random state from the given markov_chain's database, which is not
+ * a last state.
  * @param markov_chain
- * @return
+ * @return A random non-last MarkovNode, NULL if there is none
  */
 MarkovNode *get_first_random_node (MarkovChain *markov_chain);
 
+/**
+ * Same as get_first_random_node, drawing from the given random state. Safe
+ * to call from a reader thread of a chain with concurrent readers.
+ * @param markov_chain
+ * @param random_state The random state, NULL to use get_random_number.
+ * @return A random non-last MarkovNode, NULL if there is none
+ */
+MarkovNode *get_first_random_node_from_state (MarkovChain *markov_chain,
+                                              RandomState *random_state);
+
+/**
+ * Same as get_next_random_node, drawing from the given random state. Safe
+ * to call from a reader thread of a chain with concurrent readers.
+ * @param state_struct_ptr MarkovNode to choose from
+ * @param random_state The random state, NULL to use get_random_number.
+ * @return MarkovNode of the chosen state, NULL if it has no next states
+ */
+MarkovNode *get_next_random_node_from_state (MarkovNode *state_struct_ptr,
+                                             RandomState *random_state);
+
 /**
  * Choose randomly the next state, depend on it's occurrence frequency.
+ * Samples in O(log k) for k possible next states, by descending the node's
+ * frequency tree.
  * @param state_struct_ptr MarkovNode to choose from
  * @return MarkovNode of the chosen state
  */
@@ -217,6 +620,24 @@ MarkovNode *get_next_random_node (MarkovNode *state_struct_ptr);
 void generate_tweet (MarkovChain *markov_chain, MarkovNode *
 first_node, int max_length);
 
+/**
+ * Receive markov_chain, generate a random sentence out of it and append it
+ * to the buffer, the same way generate_tweet prints it. The caller decides
+ * when to flush the buffer, so many sentences can be written at once.
+ * @param markov_chain
+ * @param first_node markov_node to start with,
+ *                   if NULL- choose a random markov_node
+ * @param max_length maximum length of chain to generate
+ * @param serialize_func Appends the data of a node to the buffer, returns
+ *                       false if memory allocation failed
+ * @param buffer The buffer to append to
+ * @return false if memory allocation failed, true otherwise
+ */
+bool generate_tweet_to_buffer (MarkovChain *markov_chain,
+                               MarkovNode *first_node, int max_length,
+                               serialize_func_t serialize_func,
+                               ByteBuffer *buffer);
+
 /**
  * @brief Get random number between 0 and max_number [0, max_number).
  * @param max_number maximal number to return (not including).
@@ -224,6 +645,43 @@ first_node, int max_length);
  */
 int get_random_number (int max_number);
 
+/**
+ * @brief Initializes a random state to the start of the stream (seed,
+ * stream).
+ * @param random_state The state to initialize
+ * @param seed The seed
+ * @param stream The number of the stream, e.g. the index of the generated
+ * sequence
+ */
+void init_random_state (RandomState *random_state, uint64_t seed,
+                        uint64_t stream);
+
+/**
+ * @brief Get random number between 0 and max_number [0, max_number), from
+ * the given random state.
+ * @param random_state The random state, NULL to use get_random_number.
+ * @param max_number maximal number to return (not including).
+ * @return Random number
+ */
+int get_random_number_from_state (RandomState *random_state, int max_number);
+
+/**
+ * @brief Draws the next random number of every state in a batch of random
+ * states, given as a structure of arrays: state i is (keys[i], counters[i]).
+ * Draws the same numbers get_random_number_from_state would, in one loop
+ * over the batch that the compiler can vectorize.
+ * @param keys The keys of the states
+ * @param counters The counters of the states, advanced by one draw
+ * @param max_numbers The maximal number of every draw (not including), 0
+ * draws 0
+ * @param random_numbers Set to the random numbers
+ * @param count The number of states in the batch
+ */
+void get_random_numbers_from_states (const uint64_t *keys,
+                                     uint64_t *counters,
+                                     const int32_t *max_numbers,
+                                     int32_t *random_numbers, int count);
+
 /**
  * @brief Returns the node in the given index from the linked list
  * @param list The linked list
@@ -232,4 +690,57 @@ int get_random_number (int max_number);
  */
 Node *get_node_in_index(LinkedList *list, int index);
 
+/**
+ * @brief Scrambles the given hash and maps it into a slot of an index with
+ * the given capacity. This protects the index from weak hash functions
+ * (e.g. the identity on small integers).
+ * @param hash The hash as returned by hash_func
+ * @param capacity The capacity of the index, must be a power of two
+ * @return The first slot to probe for the hash
+ */
+static inline int get_database_index_slot (unsigned long hash, int capacity)
+{
+    unsigned long long mixed = hash * HASH_MIX_MULTIPLIER;
+    mixed ^= mixed >> HASH_MIX_SHIFT;
+
+    return (int) (mixed & (unsigned long long) (capacity - 1));
+}
+
+/**
+ * @brief Defines `static inline Node *NAME (MarkovChain *markov_chain,
+ * DATA_TYPE *data_ptr)`, add_to_database for a chain of DATA_TYPE states,
+ * which calls HASH_FUNC and COMP_FUNC directly instead of through the
+ * chain's function pointers. They are inlined into the lookup of an
+ * existing state, the common case of adding a state that was seen before,
+ * while a new state is added by add_to_database_with_hash. The generic
+ * add_to_database works for any chain, this one only for chains whose
+ * hash_func and comp_func are HASH_FUNC and COMP_FUNC.
+ * @param NAME The name of the function
+ * @param DATA_TYPE The type of the data of the states
+ * @param HASH_FUNC Returns the hash of a const DATA_TYPE *
+ * @param COMP_FUNC Compares two const DATA_TYPE *, returns 0 if they are
+ * equal
+ */
+#define DEFINE_ADD_TO_DATABASE(NAME, DATA_TYPE, HASH_FUNC, COMP_FUNC)        \
+static inline Node *NAME (MarkovChain *markov_chain, DATA_TYPE *data_ptr)   \
+{                                                                           \
+    unsigned long hash = HASH_FUNC(data_ptr);                               \
+    const DatabaseIndexEntry *index = markov_chain->database_index;         \
+                                                                            \
+    /* the states of concurrent writers are found under their shard lock */ \
+    if (markov_chain->writers == NULL && index != NULL) {                   \
+        int mask = markov_chain->database_index_capacity - 1;               \
+        for (int slot = get_database_index_slot(hash, mask + 1);            \
+             index[slot].node != NULL; slot = (slot + 1) & mask) {          \
+            if (index[slot].hash == hash &&                                 \
+                COMP_FUNC((const DATA_TYPE *) index[slot].node->data->data, \
+                          data_ptr) == 0) {                                 \
+                return index[slot].node;                                    \
+            }                                                               \
+        }                                                                   \
+    }                                                                       \
+                                                                            \
+    return add_to_database_with_hash(markov_chain, data_ptr, hash);         \
+}
+
 #endif /* _MARKOV_CHAIN_H_ */
\ No newline at end of file
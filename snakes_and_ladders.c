@@ -1,8 +1,12 @@
 #include <string.h> // For strlen(), strcmp(), strcpy()
 #include <assert.h>
 #include <libgen.h>
+#include <inttypes.h> // For PRIu64
+#include <unistd.h> // For sysconf()
 
 #include "markov_chain.h"
+#include "frozen_markov_chain.h"
+#include "absorbing_chain.h"
 
 #define MAX(X, Y) (((X) < (Y)) ? (Y) : (X))
 
@@ -16,14 +20,64 @@
 #define PROGRAM_NAME_ARG_INDEX  0
 #define SEED_ARG_INDEX  1
 #define NUM_OF_SENTENCES_ARG_INDEX  2
+#define BOARD_ARG_INDEX 3
 #define ARG_COUNT 3
+#define ARG_COUNT_WITH_BOARD 4
+
+// snakes_and_ladders --analyze [board_file]
+#define ANALYZE_ARG "--analyze"
+#define ANALYZE_ARG_INDEX 1
+#define ANALYZE_BOARD_ARG_INDEX 2
+#define ANALYZE_ARG_COUNT 2
+#define ANALYZE_ARG_COUNT_WITH_BOARD 3
+
+// snakes_and_ladders --simulate [seed] [num_of_walks] [board_file]
+#define SIMULATE_ARG "--simulate"
+#define SIMULATE_ARG_INDEX 1
+#define SIMULATE_SEED_ARG_INDEX 2
+#define SIMULATE_WALKS_ARG_INDEX 3
+#define SIMULATE_BOARD_ARG_INDEX 4
+#define SIMULATE_ARG_COUNT 4
+#define SIMULATE_ARG_COUNT_WITH_BOARD 5
 
 #define DECIMAL_BASE            10
 
-#define USAGE_FORMAT   "Usage: %s [seed] [num_of_sentences]"
+#define USAGE_FORMAT   "Usage: %s [seed] [num_of_sentences] [board_file]"
+#define ANALYZE_USAGE_FORMAT "\n       %s --analyze [board_file]\n"
+#define SIMULATE_USAGE_FORMAT "       %s --simulate [seed] [num_of_walks] \
+[board_file]\n"
+#define BOARD_USAGE "A board file holds the number of cells and the \
+number of faces of the die,\nthen a pair of cells for every snake and \
+ladder, e.g. \"100 6 13 4 8 30\".\nThe last cell must be reachable \
+from every cell.\n"
+#define ERROR_OPEN_FILE_FMT "Error: Failed to open file %s.\n"
+#define ERROR_LOAD_BOARD_FMT "Error: Invalid board file %s.\n"
+#define ERROR_ANALYSIS_TOO_LARGE_FMT "Error: The board is too big to \
+analyze exactly, it can have at most %d cells besides the last.\n"
+#define ERROR_ANALYSIS_NOT_ABSORBING "Error: The last cell can not be \
+reached from some cells of the board, the game may never end.\n"
+#define SIMULATION_HEADER_FORMAT "Simulated %" PRIu64 " walks of at most %d \
+cells.\n"
+#define LENGTHS_HEADER "Number of walks of every length:\n"
+#define LENGTH_COUNT_FORMAT "%d: %" PRIu64 "\n"
+#define VISITS_HEADER "Number of visits to every cell:\n"
+#define VISIT_COUNT_FORMAT "[%d] %" PRIu64 "\n"
+#define HITS_HEADER "Number of hits of every snake and ladder:\n"
+#define SNAKE_HITS_FORMAT "[%d]-snake to %d: %" PRIu64 "\n"
+#define LADDER_HITS_FORMAT "[%d]-ladder to %d: %" PRIu64 "\n"
+#define TOTAL_HITS_FORMAT "Total: %" PRIu64 " snake hits, %" PRIu64 \
+" ladder hits\n"
+#define EXPECTED_STEPS_FORMAT "Expected number of steps from cell 1 to \
+cell %d: %.6f\n"
+#define STEPS_VARIANCE_FORMAT "Variance of the number of steps: %.6f\n"
+#define VISIT_PROBABILITIES_HEADER "Probability of visiting every cell:\n"
+#define VISIT_PROBABILITY_FORMAT "[%d] %.6f\n"
+#define WALK_PREFIX_FORMAT "Random Walk %d: "
+// Enough for the longest cell description, e.g. "[100]-ladder to 100 ->"
+#define CELL_TEXT_MAX_LENGTH 64
 
 /**
- * represents the transitions by ladders and snakes in the game
+ * represents the transitions by ladders and snakes in the default board
  * each tuple (x,y) represents a ladder from x to if x<y or a snake otherwise
  */
 const int transitions[][2] = {{13, 4},
@@ -51,12 +105,27 @@ const int transitions[][2] = {{13, 4},
  * struct represents a Cell in the game board
  */
 typedef struct Cell {
-    int number; // Cell number 1-100
+    int number; // Cell number 1 to the number of cells of the board
     int ladder_to;  // ladder_to represents the jump of the ladder in case there is one from this square
     int snake_to;  // snake_to represents the jump of the snake in case there is one from this square
     //both ladder_to and snake_to should be -1 if the Cell doesn't have them
 } Cell;
 
+/**
+ * struct represents the game board, its cells are stored contiguously
+ */
+typedef struct Board {
+    int num_of_cells;
+    int dice_max; // The number of faces of the die
+    Cell *cells; // cells[i] is the Cell number i + 1
+} Board;
+
+/**
+ * The number of the last cell of the board being played. is_cell_last only
+ * gets the cell, so it is set here when the board is created.
+ */
+static int last_cell_number = BOARD_SIZE;
+
 /** Error handler **/
 static int handle_error(char *error_msg, MarkovChain **database) {
     printf("%s", error_msg);
@@ -73,74 +142,281 @@ static int handle_error(char *error_msg, MarkovChain **database) {
 void usage (char *program_name)
 {
   fprintf (stdout, USAGE_FORMAT, basename (program_name));
+  fprintf (stdout, ANALYZE_USAGE_FORMAT, basename (program_name));
+  fprintf (stdout, SIMULATE_USAGE_FORMAT, basename (program_name));
+  fprintf (stdout, BOARD_USAGE);
+}
+
+/**
+ * @brief Allocates the cells of a board, without snakes and ladders.
+ * @param board The board
+ * @param num_of_cells The number of cells
+ * @param dice_max The number of faces of the die
+ * @return EXIT_SUCCESS or EXIT_FAILURE if memory allocation failed
+ */
+static int allocate_board(Board *board, int num_of_cells, int dice_max) {
+    board->num_of_cells = num_of_cells;
+    board->dice_max = dice_max;
+    board->cells = (Cell *) malloc((size_t) num_of_cells * sizeof(Cell));
+    if (board->cells == NULL) {
+        return EXIT_FAILURE;
+    }
+
+    for (int i = 0; i < num_of_cells; i++) {
+        board->cells[i] = (Cell) {i + 1, EMPTY, EMPTY};
+    }
+    return EXIT_SUCCESS;
 }
 
-static int create_board(Cell *cells[BOARD_SIZE]) {
-    for (int i = 0; i < BOARD_SIZE; i++) {
-        cells[i] = malloc(sizeof(Cell));
-        if (cells[i] == NULL) {
-            for (int j = 0; j < i; j++) {
-                free(cells[j]);
+/**
+ * @brief Adds a snake or a ladder to the board.
+ * @param board The board
+ * @param from The cell it starts at, any cell but the last
+ * @param to The cell it leads to, a ladder if from < to or a snake otherwise
+ * @return false if the cells are out of the board, the same, or from already
+ * has a snake or a ladder, true otherwise
+ */
+static bool add_board_transition(Board *board, int from, int to) {
+    if (from < 1 || from >= board->num_of_cells || to < 1 ||
+        to > board->num_of_cells || from == to) {
+        return false;
+    }
+
+    Cell *cell = &board->cells[from - 1];
+    if (cell->snake_to != EMPTY || cell->ladder_to != EMPTY) {
+        return false;
+    }
+
+    if (from < to) {
+        cell->ladder_to = to;
+    } else {
+        cell->snake_to = to;
+    }
+    return true;
+}
+
+/**
+ * @brief Checks that the last cell can be reached from every cell of the
+ * board, so that no game gets stuck in a cycle of snakes and ladders. A
+ * search goes backwards from the last cell, in O(cells * faces): the cells a
+ * cell is reached from are the cells of a snake or a ladder that leads to it,
+ * found by target, and the cells without one at most dice_max before it.
+ * @param board The board
+ * @param ptr_reachable Set to whether the last cell is reachable from every
+ * cell
+ * @return EXIT_SUCCESS or EXIT_FAILURE if memory allocation failed
+ */
+static int check_last_cell_reachable(const Board *board, bool *ptr_reachable) {
+    int num_of_cells = board->num_of_cells;
+    // jump_sources[jump_starts[i]..jump_starts[i + 1]) jump to cell i + 1
+    int *jump_starts = (int *) calloc((size_t) num_of_cells + 1,
+                                      sizeof *jump_starts);
+    int *jump_sources = (int *) malloc(
+            (size_t) num_of_cells * sizeof *jump_sources);
+    int *queue = (int *) malloc((size_t) num_of_cells * sizeof *queue);
+    bool *reached = (bool *) calloc((size_t) num_of_cells, sizeof *reached);
+    if (jump_starts == NULL || jump_sources == NULL || queue == NULL ||
+        reached == NULL) {
+        free(jump_starts);
+        free(jump_sources);
+        free(queue);
+        free(reached);
+        return EXIT_FAILURE;
+    }
+
+    for (int i = 0; i < num_of_cells; i++) {
+        const Cell *cell = &board->cells[i];
+        if (cell->snake_to != EMPTY || cell->ladder_to != EMPTY) {
+            jump_starts[MAX(cell->snake_to, cell->ladder_to) - 1]++;
+        }
+    }
+    for (int i = 0; i < num_of_cells; i++) {
+        jump_starts[i + 1] += jump_starts[i];
+    }
+    for (int i = num_of_cells - 1; i >= 0; i--) {
+        const Cell *cell = &board->cells[i];
+        if (cell->snake_to != EMPTY || cell->ladder_to != EMPTY) {
+            int index_to = MAX(cell->snake_to, cell->ladder_to) - 1;
+            jump_sources[--jump_starts[index_to]] = i;
+        }
+    }
+
+    int queue_start = 0, queue_end = 0, num_reached = 1;
+    queue[queue_end++] = num_of_cells - 1;
+    reached[num_of_cells - 1] = true;
+    while (queue_start < queue_end) {
+        int index = queue[queue_start++];
+        for (int j = jump_starts[index]; j < jump_starts[index + 1]; j++) {
+            if (!reached[jump_sources[j]]) {
+                reached[jump_sources[j]] = true;
+                queue[queue_end++] = jump_sources[j];
+                num_reached++;
             }
+        }
+
+        int first = (index > board->dice_max) ? index - board->dice_max : 0;
+        for (int i = first; i < index; i++) {
+            const Cell *cell = &board->cells[i];
+            if (!reached[i] && cell->snake_to == EMPTY &&
+                cell->ladder_to == EMPTY) {
+                reached[i] = true;
+                queue[queue_end++] = i;
+                num_reached++;
+            }
+        }
+    }
+
+    *ptr_reachable = num_reached == num_of_cells;
+    free(jump_starts);
+    free(jump_sources);
+    free(queue);
+    free(reached);
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Reads a board from a text file: the number of cells and the number
+ * of faces of the die, followed by a (from, to) pair for every snake and
+ * ladder, all separated by whitespace. Boards on which the last cell can not
+ * be reached from some cell are rejected, as their games may never end.
+ * @param board The board
+ * @param board_path The path of the file
+ * @return EXIT_SUCCESS or EXIT_FAILURE, after printing the error
+ */
+static int load_board(Board *board, const char *board_path) {
+    FILE *board_file = fopen(board_path, "r");
+    if (board_file == NULL) {
+        printf(ERROR_OPEN_FILE_FMT, board_path);
+        return EXIT_FAILURE;
+    }
+
+    int num_of_cells = 0, dice_max = 0;
+    if (fscanf(board_file, "%d %d", &num_of_cells, &dice_max) != 2 ||
+        num_of_cells < 1 || dice_max < 1) {
+        fclose(board_file);
+        printf(ERROR_LOAD_BOARD_FMT, board_path);
+        return EXIT_FAILURE;
+    }
+
+    if (allocate_board(board, num_of_cells, dice_max) == EXIT_FAILURE) {
+        fclose(board_file);
+        handle_error(ALLOCATION_ERROR_MASSAGE, NULL);
+        return EXIT_FAILURE;
+    }
+
+    int from = 0, to = 0, result = 0;
+    bool valid = true;
+    while (valid &&
+           (result = fscanf(board_file, "%d %d", &from, &to)) == 2) {
+        valid = add_board_transition(board, from, to);
+    }
+    fclose(board_file);
+
+    bool reachable = false;
+    if (valid && result == EOF &&
+        check_last_cell_reachable(board, &reachable) == EXIT_FAILURE) {
+        free(board->cells);
+        board->cells = NULL;
+        handle_error(ALLOCATION_ERROR_MASSAGE, NULL);
+        return EXIT_FAILURE;
+    }
+
+    if (!valid || result != EOF || !reachable) {
+        free(board->cells);
+        board->cells = NULL;
+        printf(ERROR_LOAD_BOARD_FMT, board_path);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Creates the board, from the file if one is given, or the default
+ * board of BOARD_SIZE cells, a die of DICE_MAX faces and `transitions`.
+ * @param board The board
+ * @param board_path The path of the board file, NULL for the default board
+ * @return EXIT_SUCCESS or EXIT_FAILURE, after printing the error
+ */
+static int create_board(Board *board, const char *board_path) {
+    if (board_path != NULL) {
+        if (load_board(board, board_path) == EXIT_FAILURE) {
+            return EXIT_FAILURE;
+        }
+    } else {
+        if (allocate_board(board, BOARD_SIZE, DICE_MAX) == EXIT_FAILURE) {
             handle_error(ALLOCATION_ERROR_MASSAGE, NULL);
             return EXIT_FAILURE;
         }
-        *(cells[i]) = (Cell) {i + 1, EMPTY, EMPTY};
-    }
 
-    for (int i = 0; i < NUM_OF_TRANSITIONS; i++) {
-        int from = transitions[i][0];
-        int to = transitions[i][1];
-        if (from < to) {
-            cells[from - 1]->ladder_to = to;
-        } else {
-            cells[from - 1]->snake_to = to;
+        for (int i = 0; i < NUM_OF_TRANSITIONS; i++) {
+            add_board_transition(board, transitions[i][0], transitions[i][1]);
         }
     }
+
+    last_cell_number = board->num_of_cells;
     return EXIT_SUCCESS;
 }
 
 /**
- * fills database
+ * @brief Returns the number of cells a move from the given cell can lead to:
+ * one for a snake or a ladder, otherwise a cell per face of the die, as the
+ * die can not move past the last cell.
+ */
+static int get_num_of_moves(const Board *board, const Cell *cell) {
+    if (cell->snake_to != EMPTY || cell->ladder_to != EMPTY) {
+        return 1;
+    }
+
+    int num_of_moves = board->num_of_cells - cell->number;
+    return (num_of_moves < board->dice_max) ? num_of_moves : board->dice_max;
+}
+
+/**
+ * fills database with the cells of the board, in O(cells * faces): the
+ * cells are the dense states of the chain, the state of cell i is i - 1,
+ * and their next cells are reserved contiguously before they are added
  * @param markov_chain
+ * @param board
  * @return EXIT_SUCCESS or EXIT_FAILURE
  */
-static int fill_database(MarkovChain *markov_chain) {
-    Cell *cells[BOARD_SIZE];
-    if (create_board(cells) == EXIT_FAILURE) {
+static int fill_database(MarkovChain *markov_chain, const Board *board) {
+    int num_of_cells = board->num_of_cells;
+    int *successor_counts = (int *) malloc(
+            (size_t) num_of_cells * sizeof *successor_counts);
+    if (successor_counts == NULL) {
         return EXIT_FAILURE;
     }
-    MarkovNode *from_node = NULL, *to_node = NULL;
-    size_t index_to;
-    for (size_t i = 0; i < BOARD_SIZE; i++) {
-        add_to_database(markov_chain, cells[i]);
-    }
-
-    for (size_t i = 0; i < BOARD_SIZE; i++) {
-        from_node = get_node_from_database(markov_chain, cells[i])->data;
-
-        if (cells[i]->snake_to != EMPTY || cells[i]->ladder_to != EMPTY) {
-            index_to = MAX(cells[i]->snake_to, cells[i]->ladder_to) - 1;
-            to_node = get_node_from_database(markov_chain, cells[index_to])
-                    ->data;
-            add_node_to_frequencies_list(from_node, to_node);
-        } else {
-            for (int j = 1; j <= DICE_MAX; j++) {
-                index_to = ((Cell *) (from_node->data))->number + j - 1;
-                if (index_to >= BOARD_SIZE) {
-                    break;
-                }
-                to_node = get_node_from_database(markov_chain, cells[index_to])
-                        ->data;
-                add_node_to_frequencies_list(from_node, to_node);
-            }
-        }
+
+    for (int i = 0; i < num_of_cells; i++) {
+        successor_counts[i] = get_num_of_moves(board, &board->cells[i]);
     }
-    // free temp arr
-    for (size_t i = 0; i < BOARD_SIZE; i++) {
-        free(cells[i]);
+
+    bool success =
+            allocate_dense_states(markov_chain, board->cells, sizeof(Cell),
+                                  num_of_cells) &&
+            reserve_dense_successors(markov_chain, successor_counts);
+    free(successor_counts);
+
+    for (int i = 0; i < num_of_cells && success; i++) {
+        const Cell *cell = &board->cells[i];
+        MarkovNode *from_node = get_dense_node(markov_chain, i);
+
+        if (cell->snake_to != EMPTY || cell->ladder_to != EMPTY) {
+            int index_to = MAX(cell->snake_to, cell->ladder_to) - 1;
+            success = add_node_to_frequencies_list(
+                    from_node, get_dense_node(markov_chain, index_to));
+            continue;
+        }
+
+        int num_of_moves = get_num_of_moves(board, cell);
+        for (int j = 1; j <= num_of_moves && success; j++) {
+            success = add_node_to_frequencies_list(
+                    from_node,
+                    get_dense_node(markov_chain, cell->number + j - 1));
+        }
     }
-    return EXIT_SUCCESS;
+
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
 void parse_arguments(char *argv[], unsigned int *seed, int
@@ -155,7 +431,7 @@ void parse_arguments(char *argv[], unsigned int *seed, int
 }
 
 bool check_usage(int argc) {
-    if (argc != ARG_COUNT) {
+    if (argc != ARG_COUNT && argc != ARG_COUNT_WITH_BOARD) {
         return true;
     }
 
@@ -165,7 +441,7 @@ bool check_usage(int argc) {
 bool is_cell_last(Cell *cell)
 
 {
-    return cell->number == BOARD_SIZE;
+    return cell->number == last_cell_number;
 }
 
 void print_cell(Cell *cell) {
@@ -181,74 +457,288 @@ void print_cell(Cell *cell) {
     }
 }
 
-int compare_cells(Cell *a, Cell *b)
+bool serialize_cell(Cell *cell, ByteBuffer *buffer) {
+    char cell_text[CELL_TEXT_MAX_LENGTH];
+    int length = snprintf(cell_text, sizeof cell_text, "[%d]", cell->number);
+
+    if (cell->snake_to != EMPTY) {
+        length += snprintf(cell_text + length, sizeof cell_text - length,
+                           "-snake to %d", cell->snake_to);
+    } else if (cell->ladder_to != EMPTY) {
+        length += snprintf(cell_text + length, sizeof cell_text - length,
+                           "-ladder to %d", cell->ladder_to);
+    }
+
+    if (!is_cell_last(cell)) {
+        length += snprintf(cell_text + length, sizeof cell_text - length,
+                           " ->");
+    }
+
+    return append_to_byte_buffer(buffer, cell_text, length);
+}
+
+size_t cell_size(Cell *cell)
 {
-    assert(a != NULL);
-    assert(b != NULL);
+    (void) cell;
 
-    return a->number - b->number;
+    return sizeof(Cell);
 }
 
-Cell *dupcell(Cell *cell)
+bool generate_walks(int num_of_walks, MarkovChain *markov_chain,
+                    MarkovNode *first_markov_node)
 {
-    Cell *duplicated_cell = (Cell *)malloc(sizeof *duplicated_cell);
-    if (duplicated_cell == NULL)
-    {
-        return NULL;
+    ByteBuffer output;
+    if (!init_byte_buffer(&output, BYTE_BUFFER_FLUSH_SIZE)) {
+        return false;
     }
 
-    memcpy(duplicated_cell, cell, sizeof(*cell));
-    return duplicated_cell;
+    bool success = true;
+    for (int i = 0; i < num_of_walks && success; ++i) {
+        char prefix[CELL_TEXT_MAX_LENGTH];
+        snprintf(prefix, sizeof prefix, WALK_PREFIX_FORMAT, i + 1);
+
+        success = append_string_to_byte_buffer(&output, prefix) &&
+                  generate_tweet_to_buffer(markov_chain, first_markov_node,
+                                           MAX_GENERATION_LENGTH,
+                                           (serialize_func_t) serialize_cell,
+                                           &output);
+
+        if (output.size >= BYTE_BUFFER_FLUSH_SIZE) {
+            flush_byte_buffer(&output, stdout);
+        }
+    }
+
+    flush_byte_buffer(&output, stdout);
+    free_byte_buffer(&output);
+    return success;
 }
 
-void generate_walks(int num_of_walks, MarkovChain *markov_chain,
-                    MarkovNode *first_markov_node)
+/**
+ * @brief Prints the exact statistics of the game from cell 1, instead of
+ * estimating them from random walks: the expected number of steps to the
+ * last cell and its variance, and the probability of visiting every cell.
+ * Every move is a step, including a move along a snake or a ladder, and the
+ * walks are not cut at MAX_GENERATION_LENGTH.
+ * @param markov_chain The chain of the board
+ * @param first_markov_node The node of cell 1
+ * @return EXIT_SUCCESS or EXIT_FAILURE, after printing the error
+ */
+static int print_game_analysis(MarkovChain *markov_chain,
+                               MarkovNode *first_markov_node)
+{
+    AbsorbingChainAnalysis *analysis;
+    switch (analyze_absorbing_chain(markov_chain, first_markov_node,
+                                    &analysis)) {
+        case ABSORBING_CHAIN_SUCCESS:
+            break;
+        case ABSORBING_CHAIN_TOO_LARGE:
+            printf(ERROR_ANALYSIS_TOO_LARGE_FMT,
+                   MAX_ABSORBING_CHAIN_TRANSIENT_NODES);
+            return EXIT_FAILURE;
+        case ABSORBING_CHAIN_NOT_ABSORBING:
+            printf(ERROR_ANALYSIS_NOT_ABSORBING);
+            return EXIT_FAILURE;
+        default:
+            return handle_error(ALLOCATION_ERROR_MASSAGE, NULL);
+    }
+
+    printf(EXPECTED_STEPS_FORMAT, last_cell_number,
+           analysis->expected_steps[first_markov_node->id]);
+    printf(STEPS_VARIANCE_FORMAT,
+           analysis->steps_variance[first_markov_node->id]);
+
+    printf(VISIT_PROBABILITIES_HEADER);
+    for (Node *node = markov_chain->database->first; node != NULL;
+         node = node->next) {
+        printf(VISIT_PROBABILITY_FORMAT, ((Cell *) node->data->data)->number,
+               analysis->visit_probabilities[node->data->id]);
+    }
+
+    free_absorbing_chain_analysis(&analysis);
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Returns the number of threads to use, one per online core.
+ */
+static int get_num_of_threads(void) {
+    long num_of_cores = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return (num_of_cores > 0) ? (int) num_of_cores : 1;
+}
+
+/**
+ * @brief Prints the aggregates of the walks of a simulation, every visit to
+ * a cell with a snake or a ladder is a hit of it.
+ * @param markov_chain The chain of the board
+ * @param statistics The aggregates
+ */
+static void print_walk_statistics(MarkovChain *markov_chain,
+                                  const WalkStatistics *statistics)
 {
-    for (int i = 0; i < num_of_walks; ++i) {
-        printf("Random Walk %d: ", i + 1);
-        generate_tweet(markov_chain, first_markov_node,
-                       MAX_GENERATION_LENGTH);
+    printf(SIMULATION_HEADER_FORMAT, statistics->num_of_walks,
+           statistics->max_length);
+
+    printf(LENGTHS_HEADER);
+    for (int length = 0; length <= statistics->max_length; ++length) {
+        if (statistics->length_histogram[length] != 0) {
+            printf(LENGTH_COUNT_FORMAT, length,
+                   statistics->length_histogram[length]);
+        }
+    }
+
+    printf(VISITS_HEADER);
+    for (Node *node = markov_chain->database->first; node != NULL;
+         node = node->next) {
+        printf(VISIT_COUNT_FORMAT, ((Cell *) node->data->data)->number,
+               statistics->visit_counts[node->data->id]);
+    }
+
+    uint64_t snake_hits = 0, ladder_hits = 0;
+    printf(HITS_HEADER);
+    for (Node *node = markov_chain->database->first; node != NULL;
+         node = node->next) {
+        Cell *cell = (Cell *) node->data->data;
+        uint64_t hits = statistics->visit_counts[node->data->id];
+
+        if (cell->snake_to != EMPTY) {
+            printf(SNAKE_HITS_FORMAT, cell->number, cell->snake_to, hits);
+            snake_hits += hits;
+        } else if (cell->ladder_to != EMPTY) {
+            printf(LADDER_HITS_FORMAT, cell->number, cell->ladder_to, hits);
+            ladder_hits += hits;
+        }
     }
+    printf(TOTAL_HITS_FORMAT, snake_hits, ladder_hits);
+}
+
+/**
+ * @brief Simulates walks from cell 1 on all the cores, and prints only their
+ * aggregates. Walk i draws from the counter-based random stream (seed, i),
+ * so the walks do not depend on the number of threads, and are independent
+ * of the walks generate_walks prints with rand() for the same seed.
+ * @param markov_chain The chain of the board
+ * @param first_markov_node The node of cell 1
+ * @param seed The seed of the random streams
+ * @param num_of_walks The number of walks
+ * @return false if memory allocation failed, true otherwise
+ */
+static bool simulate_walks(MarkovChain *markov_chain,
+                           MarkovNode *first_markov_node, uint64_t seed,
+                           uint64_t num_of_walks)
+{
+    FrozenMarkovChain *frozen_chain =
+            freeze_markov_chain(markov_chain, (data_size_func_t) cell_size);
+    if (frozen_chain == NULL) {
+        return false;
+    }
+
+    WalkStatistics *statistics = simulate_frozen_walks(
+            frozen_chain, seed, 0, num_of_walks, first_markov_node->id,
+            MAX_GENERATION_LENGTH, get_num_of_threads());
+    free_frozen_markov_chain(&frozen_chain);
+    if (statistics == NULL) {
+        return false;
+    }
+
+    print_walk_statistics(markov_chain, statistics);
+    free_walk_statistics(&statistics);
+    return true;
 }
 
 /**
  * @param argc num of arguments
  * @param argv 1) Seed
  *             2) Number of sentences to generate
+ *             3) Optional - the board file, the default board if omitted
+ *             or --analyze, to print the exact statistics of the game
+ *             or --simulate, a seed and a number of walks, to print the
+ *             aggregates of the walks
+ *             both optionally followed by the board file
  * @return EXIT_SUCCESS or EXIT_FAILURE
  */
 int main(int argc, char *argv[]) {
-    if (check_usage(argc)) {
+    bool analyze = (argc == ANALYZE_ARG_COUNT ||
+                    argc == ANALYZE_ARG_COUNT_WITH_BOARD) &&
+                   strcmp(argv[ANALYZE_ARG_INDEX], ANALYZE_ARG) == 0;
+    bool simulate = (argc == SIMULATE_ARG_COUNT ||
+                     argc == SIMULATE_ARG_COUNT_WITH_BOARD) &&
+                    strcmp(argv[SIMULATE_ARG_INDEX], SIMULATE_ARG) == 0;
+
+    if (!analyze && !simulate && check_usage(argc)) {
         usage(argv[PROGRAM_NAME_ARG_INDEX]);
         return EXIT_FAILURE;
     }
 
-    unsigned int seed;
-    int num_of_sentences;
+    unsigned int seed = 0;
+    int num_of_sentences = 0;
+
+    if (!analyze && !simulate) {
+        parse_arguments(argv, &seed, &num_of_sentences);
+    }
 
-    parse_arguments(argv, &seed, &num_of_sentences);
+    int board_arg_index = analyze ? ANALYZE_BOARD_ARG_INDEX
+                                  : simulate ? SIMULATE_BOARD_ARG_INDEX
+                                             : BOARD_ARG_INDEX;
+    char *board_path = (argc > board_arg_index) ? argv[board_arg_index]
+                                                : NULL;
+
+    Board board;
+    if (create_board(&board, board_path) == EXIT_FAILURE) {
+        return EXIT_FAILURE;
+    }
 
+    // the cells are dense states, they are never copied, compared or hashed
     MarkovChain *markov_chain = new_markov_chain(
     (print_func_t) print_cell,
-    (comp_func_t) compare_cells,
-    (copy_func_t) dupcell,
-    (free_data_t) free,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
     (is_last_t) is_cell_last
     );
 
-    if (fill_database(markov_chain) == EXIT_FAILURE)
+    if (markov_chain == NULL ||
+        fill_database(markov_chain, &board) == EXIT_FAILURE)
     {
+        free(board.cells);
+        return handle_error(ALLOCATION_ERROR_MASSAGE, &markov_chain);
+    }
+    free(board.cells);
+
+    MarkovNode *first_markov_node = get_dense_node(markov_chain, 0);
+
+    if (analyze) {
+        int result = print_game_analysis(markov_chain, first_markov_node);
+
         free_database(&markov_chain);
-        return EXIT_FAILURE;
+        return result;
     }
 
-    Cell first_cell_data = {.number = 1};
+    if (simulate) {
+        char *end_ptr;
+        uint64_t simulation_seed =
+                strtoull(argv[SIMULATE_SEED_ARG_INDEX], &end_ptr,
+                         DECIMAL_BASE);
+        uint64_t num_of_walks =
+                strtoull(argv[SIMULATE_WALKS_ARG_INDEX], &end_ptr,
+                         DECIMAL_BASE);
 
-    Node *first_node = get_node_from_database(markov_chain,
-                                                &first_cell_data);
+        if (!simulate_walks(markov_chain, first_markov_node, simulation_seed,
+                            num_of_walks))
+        {
+            return handle_error(ALLOCATION_ERROR_MASSAGE, &markov_chain);
+        }
+
+        free_database(&markov_chain);
+        return EXIT_SUCCESS;
+    }
 
     srand(seed);
-    generate_walks(num_of_sentences, markov_chain, first_node->data);
+    if (!generate_walks(num_of_sentences, markov_chain, first_markov_node))
+    {
+        return handle_error(ALLOCATION_ERROR_MASSAGE, &markov_chain);
+    }
 
     free_database(&markov_chain);
     return EXIT_SUCCESS;
@@ -1,15 +1,47 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stddef.h> // For offsetof()
 #include <libgen.h>
+#include <pthread.h>
+#include <unistd.h> // For sysconf()
 
 #include "markov_chain.h"
+#include "frozen_markov_chain.h"
+#include "corpus_tokenizer.h"
+#include "intern_table.h"
 
 #define USAGE_FORMAT "Usage: %s [seed] [num_of_tweets] \
-[text_corpus] ?[num_of_words]\n"
+[text_corpus] ?[num_of_words] ?[model_output] ?[chain_order] \
+?[min_count,top_k,weight_bits]\n"
+#define SHARED_USAGE_FORMAT "       %s --shared [seed] [num_of_tweets] \
+[text_corpus] ?[num_of_words] ?[model_output] ?[chain_order] \
+?[min_count,top_k,weight_bits]\n"
+#define MERGE_USAGE_FORMAT "       %s --merge [model_output] [model] \
+[model]...\n"
+#define APPEND_USAGE_FORMAT "       %s --append [seed] [num_of_tweets] \
+[text_corpus] [appended_corpus] ?[model_output] ?[reader_threads]\n"
 #define ERROR_OPEN_FILE_FMT "Error: Failed to open file %s.\n"
+#define ERROR_LOAD_MODEL_FMT "Error: Invalid model file %s.\n"
+#define ERROR_SAVE_MODEL_FMT "Error: Failed to write model file %s.\n"
+#define ERROR_MERGE_MODELS_FMT "Error: Failed to merge the models into %s. \
+The models must be valid model files of chain order 1, with weights that \
+are not quantized.\n"
+#define ERROR_APPEND_TO_MODEL_FMT "Error: Can not append to the model file \
+%s, the model must be built from a text corpus.\n"
+#define ERROR_CHAIN_ORDER_FMT "Error: The chain order must be between 1 \
+and %d.\n"
+#define ERROR_COMPACTION_FMT "Error: The compaction must be \
+[min_count],[top_k],[weight_bits], with weight_bits 0, %d or %d.\n"
+#define ERROR_COMPACT_QUANTIZED "Error: The weights of the model are \
+already quantized, it can not be compacted again.\n"
+#define COMPACTION_REPORT_FMT "Compacted the model from %d states and %d \
+edges in %zu bytes to %d states and %d edges in %zu bytes.\n"
 
 
+#define ARG_COUNT_WITH_COMPACTION     8
+#define ARG_COUNT_WITH_CHAIN_ORDER    7
+#define ARG_COUNT_WITH_MODEL_OUTPUT   6
 #define ARG_COUNT_WITH_NUM_OF_WORD    5
 #define ARG_COUNT_WITHOUT_NUM_OF_WORD 4
 
@@ -18,34 +50,471 @@
 #define TWEET_COUNT_ARG_INDEX   2
 #define TEXT_CORPUS_ARG_INDEX   3
 #define WORD_COUNT_ARG_INDEX    4
+#define MODEL_OUTPUT_ARG_INDEX  5
+#define CHAIN_ORDER_ARG_INDEX   6
+#define COMPACTION_ARG_INDEX    7
+
+// tweets_generator --shared [seed] [num_of_tweets] [text_corpus] ...
+// reads the corpus into one chain shared by all the threads, see
+// fill_shared_database. The arguments after it are the usual ones
+#define SHARED_ARG                    "--shared"
+#define SHARED_ARG_INDEX              1
+
+// tweets_generator --merge [model_output] [model] [model]...
+#define MERGE_ARG                     "--merge"
+#define MERGE_ARG_INDEX               1
+#define MERGE_OUTPUT_ARG_INDEX        2
+#define MERGE_FIRST_MODEL_ARG_INDEX   3
+#define MIN_ARG_COUNT_TO_MERGE        5
+
+// tweets_generator --append [seed] [num_of_tweets] [text_corpus]
+//                           [appended_corpus] ?[model_output]
+//                           ?[reader_threads]
+#define APPEND_ARG                      "--append"
+#define APPEND_ARG_INDEX                1
+#define APPEND_SEED_ARG_INDEX           2
+#define APPEND_TWEET_COUNT_ARG_INDEX    3
+#define APPEND_TEXT_CORPUS_ARG_INDEX    4
+#define APPENDED_CORPUS_ARG_INDEX       5
+#define APPEND_MODEL_OUTPUT_ARG_INDEX   6
+#define APPEND_READERS_ARG_INDEX        7
+#define MIN_ARG_COUNT_TO_APPEND         6
+#define APPEND_ARG_COUNT_WITH_OUTPUT    7
+#define MAX_ARG_COUNT_TO_APPEND         8
+// Every reader thread of the append mode takes a slot of the epoch domain
+#define MAX_READER_THREADS              EPOCH_MAX_READERS
 
 #define READ_ALL_WORDS          (-1)
-#define MAX_SENTENCE_LENGTH     1000
+// Given as the model output to not save the model
+#define NO_MODEL_OUTPUT         "-"
+// Given as the text corpus to read it from the standard input
+#define STDIN_CORPUS            "-"
 #define MAX_TWEET_LENGTH 20
 
+#define MAX_INGESTION_THREADS   64
+// The corpus is split so that every thread gets at least this many bytes
+#define MIN_BYTES_PER_THREAD    ((size_t) 1 << 16)
+// Tweets are generated in batches of this many, the threads split a batch
+#define TWEETS_BATCH_SIZE       4096
+#define TWEET_PREFIX_FORMAT     "Tweet %d: "
+#define TWEET_PREFIX_MAX_LENGTH 32
+
 #define DECIMAL_BASE            10
+// Separates the thresholds of the compaction argument
+#define COMPACTION_SEPARATOR    ','
+
+#define FNV_OFFSET_BASIS        2166136261UL
+#define FNV_64_PRIME            0x100000001B3UL
+
+// A state of the chain is the last chain_order words of a sentence
+#define DEFAULT_CHAIN_ORDER     1
+#define MAX_CHAIN_ORDER         8
+// Stands for the words before the start of a sentence in a WordsTuple
+#define NO_WORD                 INTERN_NO_ID
+
+/**
+ * @brief A state of a chain of order k: the last k words of a sentence, by
+ * their ids in the vocabulary of the chain. Only the first `order` words are
+ * copied into the chain, see words_tuple_size.
+ */
+typedef struct WordsTuple {
+    uint16_t order; // k, the number of words in the tuple
+    uint16_t is_last; // 1 if the last word of the tuple ends a sentence
+    uint32_t words[MAX_CHAIN_ORDER]; // the oldest word first, NO_WORD for the
+                                     // words before the start of the sentence
+} WordsTuple;
+
+/**
+ * @brief The chain built from a corpus, and the words its states refer to
+ */
+typedef struct WordsModel {
+    int order; // the number of words in a state
+    MarkovChain *markov_chain; // the states and their transitions
+    InternTable *vocabulary; // the distinct words, each stored once, by the
+                             // ids used in the WordsTuples
+} WordsModel;
+
+/**
+ * @brief The context of freeze_words_tuple
+ */
+typedef struct WordsFreezer {
+    const InternTable *vocabulary; // the words of the frozen chain
+    uint64_t *data_offsets; // the offset in the frozen data pool of every
+                            // word, by its id. UINT64_MAX until it is written
+} WordsFreezer;
+
+/**
+ * @brief A part of the corpus, ingested by one thread into its own chain
+ */
+typedef struct IngestionJob {
+    const char *start; // the first byte of the part, at the start of a line
+    const char *end; // one past the last byte of the part, after a line end
+    WordsModel model; // the chains of this part only, or the shared model
+    bool shared; // true if model is shared with the other jobs
+    bool failed; // true if memory allocation failed
+} IngestionJob;
+
+/**
+ * @brief The state of adding the words of a text to a chain, passed to
+ * add_word_to_database by tokenize_corpus
+ */
+typedef struct IngestionState {
+    WordsModel *model; // the chains to add the words to
+    MarkovNode *prev_node; // the node of the previous state in the sentence
+    WordsTuple tuple; // the last words of the sentence
+    int words_to_read; // how many words are left, or READ_ALL_WORDS
+    bool shared; // true if other threads add to the model too. its
+                 // vocabulary is complete then, and only read
+    bool failed; // true if memory allocation failed
+} IngestionState;
+
+/**
+ * @brief The state of appending the sentences of a text to a model that is
+ * already built, passed to append_word_to_sentence by tokenize_stream
+ */
+typedef struct AppendState {
+    WordsModel *model; // the model to append to
+    WordsTuple *sentence; // the states of the current line, in order
+    data_ptr_t *sequence; // the states of sentence, by pointer
+    int sentence_length; // the number of states in sentence
+    int sentence_capacity; // the number of states sentence can hold
+    bool failed; // true if memory allocation failed
+} AppendState;
 
 /**
- * @brief Fills the database of the given markov chain, from the words in
- * the given file
+ * @brief A range of the tweets of the append mode, walked on a reader
+ * thread while the appended corpus is added to the chain
+ */
+typedef struct LiveWalksJob {
+    MarkovChain *markov_chain; // the chain to walk
+    EpochDomain *epoch; // the chain's readers domain, NULL to walk it on the
+                        // writer thread
+    unsigned int seed; // the seed of the random streams
+    int first_tweet; // the index of the first tweet of the range
+    int num_of_tweets; // the number of tweets in the range
+    uint32_t *walks; // MAX_TWEET_LENGTH word ids for every tweet
+    int *walk_lengths; // the number of words of every tweet
+    bool done; // true once the tweets were walked
+} LiveWalksJob;
+
+/**
+ * @brief Fills the chains of the given model, from the words in the given
+ * file. Regular files are mapped, other files (e.g. the standard input when
+ * it is a pipe) are read in chunks as they come.
  * @param fp the file's pointer
  * @param words_to_read How many words to read? READ_ALL_WORDS to read the
  * whole file
- * @param markov_chain Point to the markov chain
+ * @param model Point to the model
+ * @param shared true to read the whole file into one chain shared by all
+ * the threads, see fill_database_parallel. Files that are read in order,
+ * and up to a number of words, are never shared.
+ * @return true if memory allocation or reading failed, false on success.
+ */
+static bool fill_database(FILE *fp, int words_to_read, WordsModel *model,
+                          bool shared);
+
+/**
+ * @brief Fills the chains of the given model from all the words in the
+ * corpus. The corpus is split at line boundaries between several threads,
+ * each builds the model of its part, and the parts are merged in order, so
+ * the result is identical to reading the corpus sequentially.
+ * If shared, the threads add their parts to the one chain of the model
+ * instead, see fill_shared_database. This saves the memory of the partial
+ * chains, but the states are numbered in the order the threads reach them,
+ * so the tweets of a seed may differ between runs.
+ * @param corpus The corpus
+ * @param model Point to the model
+ * @param shared true to fill the chain of the model from all the threads
+ * @return true if memory allocation failed, false on success.
+ */
+static bool fill_database_parallel(const Corpus *corpus, WordsModel *model,
+                                   bool shared);
+
+/**
+ * @brief Adds the words of the text in [start, end) to the model, and links
+ * the state of every word to the state of the word before it in its line.
+ * @param model Point to the model
+ * @param start The first byte of the text
+ * @param end One past the last byte of the text
+ * @param words_to_read How many words to read? READ_ALL_WORDS to read the
+ * whole text
+ * @param shared true if other threads add to the model at the same time
+ * @return true if memory allocation failed, false on success.
+ */
+static bool add_text_to_database(WordsModel *model, const char *start,
+                                 const char *end, int words_to_read,
+                                 bool shared);
+
+/**
+ * @brief Adds the words of the text read from the given file descriptor to
+ * the model, like add_text_to_database. The text is read in chunks, so it
+ * can come from a pipe and be of any length.
+ * @param model Point to the model
+ * @param fd The file descriptor
+ * @param words_to_read How many words to read? READ_ALL_WORDS to read
+ * until the end of the file
+ * @return true if memory allocation or reading failed, false on success.
+ */
+static bool add_stream_to_database(WordsModel *model, int fd,
+                                   int words_to_read);
+
+/**
+ * @brief The word_handler_t of add_text_to_database, adds one word to the
+ * chain of an IngestionState.
+ * @param word The word
+ * @param starts_sentence true if the word is the first in its line
+ * @param context The IngestionState
+ * @return false to stop, when there are no words left to read or memory
+ * allocation failed, true otherwise
+ */
+static bool add_word_to_database(const WordView *word, bool starts_sentence,
+                                 void *context);
+
+/**
+ * @brief Slides a WordsTuple by one word: the oldest word is dropped and the
+ * given word becomes its last.
+ * @param tuple The tuple
+ * @param word_id The id of the word in the vocabulary
+ * @param word The word
+ */
+static void slide_words_tuple(WordsTuple *tuple, uint32_t word_id,
+                              const WordView *word);
+
+/**
+ * @brief Returns the state of the given word and the words before it in the
+ * sentence, adding the word and the state to the model if they are new.
+ * @param state The IngestionState, its tuple holds the words before word
+ * @param word The word
+ * @return The node of the state, NULL if memory allocation failed.
+ */
+static Node *add_words_tuple_to_database(IngestionState *state,
+                                         const WordView *word);
+
+/**
+ * @brief The thread routine of fill_database_parallel, fills the model of
+ * an IngestionJob from its part of the corpus.
+ * @param job The IngestionJob
+ * @return NULL
+ */
+static void *ingest_corpus_part(void *job);
+
+/**
+ * @brief The thread routine of the first pass of fill_shared_database,
+ * interns the words of an IngestionJob's part into the vocabulary of its
+ * model.
+ * @param job The IngestionJob
+ * @return NULL
+ */
+static void *collect_corpus_part_words(void *job);
+
+/**
+ * @brief The word_handler_t of collect_corpus_part_words.
+ * @param word The word
+ * @param starts_sentence Unused
+ * @param context The InternTable to add the word to
+ * @return false if memory allocation failed, true otherwise
+ */
+static bool intern_word(const WordView *word, bool starts_sentence,
+                        void *context);
+
+/**
+ * @brief Splits the corpus into parts of about the same size, at line ends,
+ * one for every job.
+ * @param corpus The corpus
+ * @param jobs The jobs to fill, with empty models of the given order
+ * @param num_of_jobs The number of jobs
+ * @param order The order of the models
+ */
+static void split_corpus(const Corpus *corpus, IngestionJob *jobs,
+                         size_t num_of_jobs, int order);
+
+/**
+ * @brief Runs the given routine on every job, each on a thread of its own.
+ * Jobs whose thread could not be started are run on the calling thread.
+ * @param jobs The jobs
+ * @param num_of_jobs The number of jobs
+ * @param routine The thread routine, given a job
+ */
+static void run_ingestion_jobs(IngestionJob *jobs, size_t num_of_jobs,
+                               void *(*routine)(void *));
+
+/**
+ * @brief Fills the model from the parts of the jobs, all the threads adding
+ * to its chain at once. The words of all the parts are interned first, in
+ * order, then the vocabulary is only read while the states and transitions
+ * are added, see enable_concurrent_writers.
+ * @param jobs The jobs, one for every part of the corpus
+ * @param num_of_jobs The number of jobs
+ * @param model Point to the model, empty
+ * @return true if memory allocation failed, false on success.
+ */
+static bool fill_shared_database(IngestionJob *jobs, size_t num_of_jobs,
+                                 WordsModel *model);
+
+/**
+ * @brief Interns all the words of source_vocabulary into vocabulary, in the
+ * order of their ids.
+ * @param vocabulary The table to intern into
+ * @param source_vocabulary The table to intern from
+ * @param merged_ids If not NULL, filled with the id in vocabulary of every
+ * word, by its id in source_vocabulary
+ * @return true if memory allocation failed, false on success.
+ */
+static bool merge_vocabularies(InternTable *vocabulary,
+                               const InternTable *source_vocabulary,
+                               uint32_t *merged_ids);
+
+/**
+ * @brief Adds all the words, states and transitions of source_model to
+ * model, the same way merge_markov_chains does.
+ * @param model The model to merge into
+ * @param source_model The model to merge from. Its word ids are changed to
+ * the ids in model, so it can only be freed afterwards.
  * @return true if memory allocation failed, false on success.
  */
-static bool fill_database(FILE *fp, int words_to_read, MarkovChain
-*markov_chain);
+static bool merge_words_models(WordsModel *model, WordsModel *source_model);
+
+/**
+ * @brief Creates an empty markov chain of WordsTuples, backed by an arena.
+ * @return The chain, NULL if memory allocation failed.
+ */
+static MarkovChain *new_tuples_chain(void);
+
+/**
+ * @brief Initializes an empty model of the given order.
+ * @param model The model
+ * @param order The number of words in a state
+ * @return false if memory allocation failed, true otherwise
+ */
+static bool init_words_model(WordsModel *model, int order);
+
+/**
+ * @brief Frees the chains of the model.
+ * @param model The model
+ */
+static void free_words_model(WordsModel *model);
+
+/**
+ * @brief Freezes the chain of the model. The frozen chain holds the last
+ * word of every state, every word is written once.
+ * @param model The model
+ * @return The frozen chain, NULL if memory allocation failed.
+ */
+static FrozenMarkovChain *freeze_words_model(const WordsModel *model);
+
+/**
+ * @brief Builds a markov chain of the given order from the words in the
+ * given file, and freezes it. The frozen chain holds the last word of every
+ * state, so it is printed the same way for every order.
+ * @param fp the file's pointer
+ * @param words_to_read How many words to read? READ_ALL_WORDS to read the
+ * whole file
+ * @param chain_order The number of words in a state
+ * @param shared_ingestion true to read the file into one chain shared by
+ * all the threads, see fill_database_parallel
+ * @return The frozen chain, NULL if memory allocation failed.
+ */
+static FrozenMarkovChain *build_frozen_chain(FILE *fp, int words_to_read,
+                                             int chain_order,
+                                             bool shared_ingestion);
 
 /**
  * @brief Parses the arguments and sets the respective variables. prints a
- * respective message if openning file failed.
+ * respective message if openning file failed or the chain order or the
+ * compaction is invalid.
  * @param argc
  * @param argv
- * @return true if file opening failed, false otherwise
+ * @return true if file opening failed or the chain order or the compaction
+ * is invalid, false otherwise
  */
 static bool parse_arguments(int argc, char *argv[], unsigned int *seed, int
-*num_of_tweets, int *num_of_words, FILE **text_corpus_fp);
+*num_of_tweets, int *num_of_words, int *chain_order,
+CompactionOptions *compaction, FILE **text_corpus_fp);
+
+/**
+ * @brief Parses the compaction argument, "min_count,top_k,weight_bits".
+ * @param argument The argument
+ * @param compaction Set to the thresholds
+ * @return true if the argument is invalid, false otherwise
+ */
+static bool parse_compaction(const char *argument,
+                             CompactionOptions *compaction);
+
+/**
+ * @brief Compacts the model with the given thresholds, and prints its size
+ * before and after.
+ * @param frozen_chain Pointer to the model, replaced by the compacted one
+ * @param compaction The thresholds
+ * @return true if the model can not be compacted or memory allocation
+ * failed, false otherwise
+ */
+static bool compact_model(FrozenMarkovChain **frozen_chain,
+                          const CompactionOptions *compaction);
+
+/**
+ * @brief Merges the model files given in the arguments into the model
+ * output, e.g. the models of the parts of a corpus, built one by one.
+ * Streams the models, see merge_frozen_markov_chain_files.
+ * @param argc
+ * @param argv
+ * @return EXIT_SUCCESS if the models were merged, EXIT_FAILURE otherwise
+ * with a helpful error message.
+ */
+static int merge_models(int argc, char *argv[]);
+
+/**
+ * @brief Builds the model of the text corpus given in the arguments, then
+ * appends the lines of the appended corpus to it one by one, the way a live
+ * model is kept up to date with new sentences without rebuilding it (see
+ * append_sequence_to_markov_chain). Generates the tweets from the updated
+ * model, and saves it to the model output if one is given. The model, and
+ * so the tweets, are the same as if both corpora were read as one.
+ * With reader threads, the tweets are generated by them while the lines are
+ * appended instead, so every tweet sees the lines appended before its walk,
+ * and the tweets of a seed may differ between runs.
+ * @param argc
+ * @param argv
+ * @return EXIT_SUCCESS if everything succeeded, EXIT_FAILURE otherwise with
+ * a helpful error message.
+ */
+static int append_to_model(int argc, char *argv[]);
+
+/**
+ * @brief Appends every line of the text read from the given file descriptor
+ * to the model, see append_sentence.
+ * @param model Point to the model
+ * @param fd The file descriptor
+ * @return true if memory allocation or reading failed, false on success.
+ */
+static bool append_stream_to_model(WordsModel *model, int fd);
+
+/**
+ * @brief The word_handler_t of append_stream_to_model, adds the state of one
+ * word to the current line of an AppendState, and appends the line before it
+ * when the word starts a new one.
+ * @param word The word
+ * @param starts_sentence true if the word is the first in its line
+ * @param context The AppendState
+ * @return false if memory allocation failed, true otherwise
+ */
+static bool append_word_to_sentence(const WordView *word,
+                                    bool starts_sentence, void *context);
+
+/**
+ * @brief Appends the states of the current line of an AppendState to its
+ * model with append_sequence_to_markov_chain, and empties the line.
+ * @param state The AppendState
+ * @return true if memory allocation failed, false on success.
+ */
+static bool append_sentence(AppendState *state);
+
+/**
+ * @brief Opens a text corpus, or returns the standard input for
+ * STDIN_CORPUS. prints a respective message if openning the file failed.
+ * @param path The path of the corpus
+ * @return The file, NULL if it could not be opened
+ */
+static FILE *open_text_corpus(const char *path);
 
 /*
  * @brief Prints the usage message for the program
@@ -54,25 +523,118 @@ static bool parse_arguments(int argc, char *argv[], unsigned int *seed, int
 static void usage (char *program_name);
 
 /**
- * @brief Generates the specified amount of tweets from the markov chain.
+ * @brief Generates the specified amount of tweets from the frozen chain, on
+ * all the cores. Tweet i is generated from the random stream (seed, i), so
+ * the output does not depend on the number of threads.
+ * @param num_of_tweets
+ * @param frozen_chain
+ * @param seed The seed of the random streams
+ * @return true if memory allocation failed, false on success.
+ */
+static bool generate_tweets(int num_of_tweets,
+                            const FrozenMarkovChain *frozen_chain,
+                            unsigned int seed);
+
+/**
+ * @brief Generates the specified amount of tweets from the chain of the
+ * model, as it is, without freezing it. Tweet i is generated from the random
+ * stream (seed, i), and the walks are the same as generate_tweets makes on
+ * the frozen chain.
  * @param num_of_tweets
- * @param markov_chain
+ * @param model The model
+ * @param seed The seed of the random streams
+ * @return true if memory allocation failed, false on success.
+ */
+static bool generate_live_tweets(int num_of_tweets, const WordsModel *model,
+                                 unsigned int seed);
+
+/**
+ * @brief Appends the lines of the text read from the given file descriptor
+ * to the model, like append_stream_to_model, while reader threads generate
+ * the tweets from its chain (see enable_concurrent_readers). Tweet i is
+ * walked from the random stream (seed, i), on the chain as it is at the
+ * time. The tweets are printed once all the lines are appended.
+ * @param num_of_tweets
+ * @param model Point to the model
+ * @param seed The seed of the random streams
+ * @param num_of_readers The number of reader threads, at least 1
+ * @param fd The file descriptor of the appended text
+ * @return true if memory allocation or reading failed, false on success.
+ */
+static bool generate_tweets_while_appending(int num_of_tweets,
+                                            WordsModel *model,
+                                            unsigned int seed,
+                                            int num_of_readers, int fd);
+
+/**
+ * @brief The thread routine of generate_tweets_while_appending, walks the
+ * tweets of a LiveWalksJob, each walk in a read section of its own.
+ * @param job The LiveWalksJob
+ * @return NULL
+ */
+static void *generate_live_walks_job(void *job);
+
+/**
+ * @brief Appends a tweet to the buffer, the same way generate_tweets writes
+ * it.
+ * @param buffer The buffer
+ * @param vocabulary The words of the walk
+ * @param tweet_index The index of the tweet, from 0
+ * @param words The ids of the words of the walk
+ * @param length The number of words
+ * @return false if memory allocation failed, true otherwise
+ */
+static bool append_live_tweet(ByteBuffer *buffer,
+                              const InternTable *vocabulary, int tweet_index,
+                              const uint32_t *words, int length);
+
+/**
+ * @brief Walks the chain from a random first state, the same way
+ * generate_frozen_walk does.
+ * @param markov_chain The chain, of WordsTuples
+ * @param random_state The random state to draw from
+ * @param words Filled with the ids of the last words of the states of the
+ * walk, at least MAX_TWEET_LENGTH of them
+ * @return The number of states in the walk
+ */
+static int walk_live_chain(MarkovChain *markov_chain,
+                           RandomState *random_state, uint32_t *words);
+
+/**
+ * @brief Returns the number of threads to use, one per online core.
  */
-static void generate_tweets(int num_of_tweets, MarkovChain *markov_chain);
+static int get_num_of_threads(void);
 
-static bool ends_with_dot(const char *string);
+static bool ends_with_dot(const WordView *word);
 
 static void print_word(const char *word);
 
-static char *duplicate_string(const char *str) {
-    char *duplicated_str = (char *) malloc(strlen(str) + 1);
-    if (duplicated_str == NULL) {
-        return NULL;
-    }
+static bool serialize_word(const char *word, ByteBuffer *buffer);
 
-    strcpy(duplicated_str, str);
-    return duplicated_str;
-}
+static size_t word_size(const char *word);
+
+static unsigned long hash_word(const char *word);
+
+static int compare_words_tuples(const WordsTuple *first,
+                                const WordsTuple *second);
+
+static unsigned long hash_words_tuple(const WordsTuple *tuple);
+
+static WordsTuple *duplicate_words_tuple(const WordsTuple *tuple);
+
+static bool is_last_words_tuple(const WordsTuple *tuple);
+
+static size_t words_tuple_size(const WordsTuple *tuple);
+
+/**
+ * @brief add_to_database for the chains of WordsTuples, with the hash and the
+ * comparison of the tuples inlined into the lookup of the state
+ */
+DEFINE_ADD_TO_DATABASE(add_words_tuple_state, WordsTuple, hash_words_tuple,
+                       compare_words_tuples)
+
+static bool freeze_words_tuple(const WordsTuple *tuple, ByteBuffer *data_pool,
+                               uint64_t *data_offset, WordsFreezer *freezer);
 
 /**
  * @brief The main function of the program. The program will generate random
@@ -83,154 +645,1164 @@ static char *duplicate_string(const char *str) {
  * a helpful error message.
  */
 int main(int argc, char *argv[]) {
-    int num_of_tweets, num_of_words;
+    int num_of_tweets, num_of_words, chain_order;
     unsigned int seed;
+    CompactionOptions compaction;
     FILE *text_corpus_fp;
-    MarkovChain *markov_chain;
+    FrozenMarkovChain *frozen_chain;
+
+    if (argc > MERGE_ARG_INDEX &&
+        strcmp(argv[MERGE_ARG_INDEX], MERGE_ARG) == 0) {
+        return merge_models(argc, argv);
+    }
+
+    if (argc > APPEND_ARG_INDEX &&
+        strcmp(argv[APPEND_ARG_INDEX], APPEND_ARG) == 0) {
+        return append_to_model(argc, argv);
+    }
+
+    bool shared_ingestion = argc > SHARED_ARG_INDEX &&
+                            strcmp(argv[SHARED_ARG_INDEX], SHARED_ARG) == 0;
+    if (shared_ingestion) {
+        // drop the flag, the arguments after it are at their usual indices
+        argv[SHARED_ARG_INDEX] = argv[PROGRAM_NAME_ARG_INDEX];
+        argv++;
+        argc--;
+    }
 
     /** input validation */
     if (argc != ARG_COUNT_WITHOUT_NUM_OF_WORD
-        && argc != ARG_COUNT_WITH_NUM_OF_WORD) {
+        && argc != ARG_COUNT_WITH_NUM_OF_WORD
+        && argc != ARG_COUNT_WITH_MODEL_OUTPUT
+        && argc != ARG_COUNT_WITH_CHAIN_ORDER
+        && argc != ARG_COUNT_WITH_COMPACTION) {
         usage(argv[PROGRAM_NAME_ARG_INDEX]);
         return EXIT_FAILURE;
     }
 
     /** we have to check that the file could open */
     if (parse_arguments(argc, argv, &seed, &num_of_tweets, &num_of_words,
-                        &text_corpus_fp)) {
+                        &chain_order, &compaction, &text_corpus_fp)) {
         return EXIT_FAILURE;
     }
 
     /** main program flow, fill database then generate tweets */
 
-    // initialize random
-    srand(seed);
+    // a model is loaded by its path, the standard input is always a corpus
+    if (text_corpus_fp != stdin &&
+        is_frozen_markov_chain_file(text_corpus_fp)) {
+        // a prebuilt model, use it in place instead of parsing a corpus. it
+        // was built with its own chain order
+        frozen_chain = load_frozen_markov_chain(argv[TEXT_CORPUS_ARG_INDEX],
+                                                (print_func_t) print_word);
+        if (frozen_chain == NULL) {
+            printf(ERROR_LOAD_MODEL_FMT, argv[TEXT_CORPUS_ARG_INDEX]);
+            fclose(text_corpus_fp);
+            return EXIT_FAILURE;
+        }
+    } else {
+        frozen_chain = build_frozen_chain(text_corpus_fp, num_of_words,
+                                          chain_order, shared_ingestion);
+        if (frozen_chain == NULL) {
+            printf(ALLOCATION_ERROR_MASSAGE);
+            fclose(text_corpus_fp);
+            return EXIT_FAILURE;
+        }
+    }
 
-    markov_chain = new_markov_chain((print_func_t) print_word,
-                                    (comp_func_t) strcmp,
-                                    (copy_func_t) duplicate_string,
-                                    (free_data_t) free,
-                                    (is_last_t) ends_with_dot);
+    fclose(text_corpus_fp);
 
-    if (fill_database(text_corpus_fp, num_of_words, markov_chain)) {
-        printf(ALLOCATION_ERROR_MASSAGE);
-        return true;
+    if (argc >= ARG_COUNT_WITH_COMPACTION &&
+        compact_model(&frozen_chain, &compaction)) {
+        free_frozen_markov_chain(&frozen_chain);
+        return EXIT_FAILURE;
     }
 
-    generate_tweets(num_of_tweets, markov_chain);
+    if (argc >= ARG_COUNT_WITH_MODEL_OUTPUT &&
+        strcmp(argv[MODEL_OUTPUT_ARG_INDEX], NO_MODEL_OUTPUT) != 0 &&
+        !save_frozen_markov_chain(frozen_chain,
+                                  argv[MODEL_OUTPUT_ARG_INDEX])) {
+        printf(ERROR_SAVE_MODEL_FMT, argv[MODEL_OUTPUT_ARG_INDEX]);
+        free_frozen_markov_chain(&frozen_chain);
+        return EXIT_FAILURE;
+    }
 
-    // free the database and the chain
-    free_database(&markov_chain);
-    free(markov_chain);
+    bool failed = generate_tweets(num_of_tweets, frozen_chain, seed);
+    free_frozen_markov_chain(&frozen_chain);
+
+    if (failed) {
+        printf(ALLOCATION_ERROR_MASSAGE);
+        return EXIT_FAILURE;
+    }
 
-    fclose(text_corpus_fp);
     return EXIT_SUCCESS;
 }
 
-static void generate_tweets(int num_of_tweets, MarkovChain *markov_chain) {
-    for (int i = 0; i < num_of_tweets; ++i) {
-        printf("Tweet %d: ", i + 1);
-        generate_tweet(markov_chain, NULL, MAX_TWEET_LENGTH);
+static int merge_models(int argc, char *argv[]) {
+    if (argc < MIN_ARG_COUNT_TO_MERGE) {
+        usage(argv[PROGRAM_NAME_ARG_INDEX]);
+        return EXIT_FAILURE;
     }
-}
 
-/**
- * @brief Prints the usage message for the program
- * @param program_name The program's name. should be in argv[0]
- */
-static void usage (char *program_name)
-{
-  fprintf (stdout, USAGE_FORMAT, basename (program_name));
+    // the models hold one word per state only for chains of order 1, so
+    // words tell their states apart and the merge fails for other orders
+    if (!merge_frozen_markov_chain_files(
+            argv[MERGE_OUTPUT_ARG_INDEX],
+            (const char *const *) argv + MERGE_FIRST_MODEL_ARG_INDEX,
+            argc - MERGE_FIRST_MODEL_ARG_INDEX, (hash_func_t) hash_word,
+            (comp_func_t) strcmp, (data_size_func_t) word_size)) {
+        printf(ERROR_MERGE_MODELS_FMT, argv[MERGE_OUTPUT_ARG_INDEX]);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
 }
 
+static int append_to_model(int argc, char *argv[]) {
+    if (argc < MIN_ARG_COUNT_TO_APPEND || argc > MAX_ARG_COUNT_TO_APPEND) {
+        usage(argv[PROGRAM_NAME_ARG_INDEX]);
+        return EXIT_FAILURE;
+    }
 
+    char *end_ptr;
+    unsigned int seed = (unsigned int) strtol(argv[APPEND_SEED_ARG_INDEX],
+                                              &end_ptr, DECIMAL_BASE);
+    int num_of_tweets = (int) strtol(argv[APPEND_TWEET_COUNT_ARG_INDEX],
+                                     &end_ptr, DECIMAL_BASE);
+    int num_of_readers = (argc == MAX_ARG_COUNT_TO_APPEND)
+                         ? (int) strtol(argv[APPEND_READERS_ARG_INDEX],
+                                        &end_ptr, DECIMAL_BASE)
+                         : 0;
 
+    FILE *text_corpus_fp = open_text_corpus(
+            argv[APPEND_TEXT_CORPUS_ARG_INDEX]);
+    if (text_corpus_fp == NULL) {
+        return EXIT_FAILURE;
+    }
 
-bool ends_with_dot(const char *string) {
-    if (string[strlen(string) - 1] == '.') {
-        return true;
+    // a frozen model can not change, only the chain of a corpus can
+    if (text_corpus_fp != stdin &&
+        is_frozen_markov_chain_file(text_corpus_fp)) {
+        printf(ERROR_APPEND_TO_MODEL_FMT, argv[APPEND_TEXT_CORPUS_ARG_INDEX]);
+        fclose(text_corpus_fp);
+        return EXIT_FAILURE;
     }
 
-    return false;
-}
+    WordsModel model;
+    if (!init_words_model(&model, DEFAULT_CHAIN_ORDER)) {
+        printf(ALLOCATION_ERROR_MASSAGE);
+        fclose(text_corpus_fp);
+        return EXIT_FAILURE;
+    }
 
-void print_word(const char *word) {
-    printf("%s", word);
-}
+    bool failed = fill_database(text_corpus_fp, READ_ALL_WORDS, &model,
+                                false);
+    // the standard input stays open, the appended corpus may be read from it
+    if (text_corpus_fp != stdin) {
+        fclose(text_corpus_fp);
+    }
+    if (failed) {
+        printf(ALLOCATION_ERROR_MASSAGE);
+        free_words_model(&model);
+        return EXIT_FAILURE;
+    }
 
+    FILE *appended_corpus_fp = open_text_corpus(
+            argv[APPENDED_CORPUS_ARG_INDEX]);
+    if (appended_corpus_fp == NULL) {
+        free_words_model(&model);
+        return EXIT_FAILURE;
+    }
 
-bool
-add_sentence_to_database(MarkovChain *markov_chain, char *sentence_buffer,
-                         int *words_to_read) {
-    char *word_pointer = strtok(sentence_buffer, " ");
-    Node *prev_word = NULL;
+    if (num_of_readers > 0) {
+        failed = generate_tweets_while_appending(
+                num_of_tweets, &model, seed, num_of_readers,
+                fileno(appended_corpus_fp));
+    } else {
+        failed = append_stream_to_model(&model,
+                                        fileno(appended_corpus_fp)) ||
+                 generate_live_tweets(num_of_tweets, &model, seed);
+    }
+    fclose(appended_corpus_fp);
 
-    while (word_pointer != NULL && ((*words_to_read > 0) || (*words_to_read ==
-                                                             READ_ALL_WORDS))) {
-        Node *current_node = add_to_database(markov_chain, word_pointer);
-        if (current_node == NULL) {
-            return true;
-        }
+    if (!failed && argc >= APPEND_ARG_COUNT_WITH_OUTPUT &&
+        strcmp(argv[APPEND_MODEL_OUTPUT_ARG_INDEX], NO_MODEL_OUTPUT) != 0) {
+        FrozenMarkovChain *frozen_chain = freeze_words_model(&model);
+        failed = frozen_chain == NULL;
 
-        if (prev_word != NULL) {
-            add_node_to_frequencies_list(prev_word->data, current_node->data);
+        if (!failed && !save_frozen_markov_chain(
+                frozen_chain, argv[APPEND_MODEL_OUTPUT_ARG_INDEX])) {
+            printf(ERROR_SAVE_MODEL_FMT, argv[APPEND_MODEL_OUTPUT_ARG_INDEX]);
+            free_frozen_markov_chain(&frozen_chain);
+            free_words_model(&model);
+            return EXIT_FAILURE;
         }
+        free_frozen_markov_chain(&frozen_chain);
+    }
 
-        prev_word = current_node;
-        word_pointer = strtok(NULL, " ");
+    free_words_model(&model);
 
-        if (*words_to_read != READ_ALL_WORDS) {
-            (*words_to_read)--;
-        }
+    if (failed) {
+        printf(ALLOCATION_ERROR_MASSAGE);
+        return EXIT_FAILURE;
     }
 
-    return false;
+    return EXIT_SUCCESS;
+}
+
+static bool append_stream_to_model(WordsModel *model, int fd) {
+    AppendState state = {model, NULL, NULL, 0, 0, false};
+
+    bool completed = tokenize_stream(fd, append_word_to_sentence, &state);
+    // the end of the text also ends its last line
+    bool failed = state.failed || !completed || append_sentence(&state);
+
+    free(state.sentence);
+    free(state.sequence);
+    return failed;
 }
 
-bool fill_database(FILE *fp, int words_to_read, MarkovChain *markov_chain) {
-    char sentence_buffer[MAX_SENTENCE_LENGTH + 1];
+static bool append_word_to_sentence(const WordView *word,
+                                    bool starts_sentence, void *context) {
+    AppendState *state = (AppendState *) context;
+
+    if (starts_sentence && append_sentence(state)) {
+        state->failed = true;
+        return false;
+    }
+
+    if (state->sentence_length == state->sentence_capacity) {
+        int capacity = (state->sentence_capacity == 0)
+                       ? MAX_TWEET_LENGTH : state->sentence_capacity * 2;
+        WordsTuple *sentence = (WordsTuple *) realloc(
+                state->sentence, capacity * sizeof *sentence);
+        if (sentence != NULL) {
+            state->sentence = sentence;
+        }
 
-    while (fgets(sentence_buffer, MAX_SENTENCE_LENGTH, fp) != NULL &&
-           ((words_to_read > 0) || words_to_read == READ_ALL_WORDS)) {
-        if (sentence_buffer[strlen(sentence_buffer) - 1] == '\n') {
-            sentence_buffer[strlen(sentence_buffer) - 1] = '\0';
+        data_ptr_t *sequence = (data_ptr_t *) realloc(
+                state->sequence, capacity * sizeof *sequence);
+        if (sequence != NULL) {
+            state->sequence = sequence;
         }
 
-        if (add_sentence_to_database(markov_chain, sentence_buffer,
-                                     &words_to_read)) {
-            return true;
+        if (sentence == NULL || sequence == NULL) {
+            state->failed = true;
+            return false;
         }
+        state->sentence_capacity = capacity;
     }
 
-    return false;
-}
+    uint32_t word_id = intern_string(state->model->vocabulary, word->start,
+                                     word->length);
+    if (word_id == INTERN_NO_ID) {
+        state->failed = true;
+        return false;
+    }
 
-bool parse_arguments(int argc, char *argv[], unsigned int *seed, int
-*num_of_tweets, int *num_of_words, FILE **text_corpus_fp) {
-    char *end_ptr, *text_corpus_path;
-    // we don't check the following arguments, because we can assume they are
-    // valid
-    *seed = (unsigned int) strtol(argv[SEED_ARG_INDEX], &end_ptr,
-                                  DECIMAL_BASE);
-    *num_of_tweets =
-            (int) strtol(argv[TWEET_COUNT_ARG_INDEX], &end_ptr, DECIMAL_BASE);
+    // the state of a word is the state before it, slid by the word
+    WordsTuple *tuple = &state->sentence[state->sentence_length];
+    if (state->sentence_length == 0) {
+        tuple->order = (uint16_t) state->model->order;
+        for (int i = 0; i < tuple->order; ++i) {
+            tuple->words[i] = NO_WORD;
+        }
+    } else {
+        *tuple = tuple[-1];
+    }
+    slide_words_tuple(tuple, word_id, word);
+    state->sentence_length++;
 
-    *num_of_words = READ_ALL_WORDS;
+    return true;
+}
 
-    if (argc == ARG_COUNT_WITH_NUM_OF_WORD) {
-        *num_of_words =
-                (int) strtol(argv[WORD_COUNT_ARG_INDEX], &end_ptr,
-                             DECIMAL_BASE);
+static bool append_sentence(AppendState *state) {
+    for (int i = 0; i < state->sentence_length; ++i) {
+        state->sequence[i] = &state->sentence[i];
     }
 
-    text_corpus_path = argv[TEXT_CORPUS_ARG_INDEX];
-    *text_corpus_fp = fopen(text_corpus_path, "r");
+    bool failed = !append_sequence_to_markov_chain(
+            state->model->markov_chain, state->sequence,
+            state->sentence_length);
 
-    /** we have to check that the file could open */
-    if (*text_corpus_fp == NULL) {
-        printf(ERROR_OPEN_FILE_FMT, text_corpus_path);
+    state->sentence_length = 0;
+    return failed;
+}
+
+static bool compact_model(FrozenMarkovChain **frozen_chain,
+                          const CompactionOptions *compaction) {
+    if ((*frozen_chain)->weight_bits != 0) {
+        printf(ERROR_COMPACT_QUANTIZED);
         return true;
     }
 
-    return false;
-}
\ No newline at end of file
+    FrozenMarkovChain *compact_chain =
+            compact_frozen_markov_chain(*frozen_chain, compaction);
+    if (compact_chain == NULL) {
+        printf(ALLOCATION_ERROR_MASSAGE);
+        return true;
+    }
+
+    printf(COMPACTION_REPORT_FMT, (*frozen_chain)->node_count,
+           (*frozen_chain)->edge_count,
+           get_frozen_markov_chain_size(*frozen_chain),
+           compact_chain->node_count, compact_chain->edge_count,
+           get_frozen_markov_chain_size(compact_chain));
+
+    free_frozen_markov_chain(frozen_chain);
+    *frozen_chain = compact_chain;
+    return false;
+}
+
+static MarkovChain *new_tuples_chain(void) {
+    // the mutable chain is never printed, the frozen one holds the words
+    MarkovChain *markov_chain =
+            new_markov_chain(NULL,
+                             (comp_func_t) compare_words_tuples,
+                             (hash_func_t) hash_words_tuple,
+                             (copy_func_t) duplicate_words_tuple,
+                             (free_data_t) free,
+                             (is_last_t) is_last_words_tuple);
+
+    if (markov_chain == NULL) {
+        return NULL;
+    }
+
+    // the corpus can have millions of states, allocate them from an arena
+    if (allocate_arena(markov_chain,
+                       (data_size_func_t) words_tuple_size) == NULL) {
+        free_database(&markov_chain);
+        return NULL;
+    }
+
+    return markov_chain;
+}
+
+static bool init_words_model(WordsModel *model, int order) {
+    model->order = order;
+    model->markov_chain = new_tuples_chain();
+    model->vocabulary = new_intern_table();
+
+    if (model->markov_chain == NULL || model->vocabulary == NULL) {
+        free_words_model(model);
+        return false;
+    }
+
+    return true;
+}
+
+static void free_words_model(WordsModel *model) {
+    free_database(&model->markov_chain);
+    free_intern_table(&model->vocabulary);
+}
+
+static FrozenMarkovChain *build_frozen_chain(FILE *fp, int words_to_read,
+                                             int chain_order,
+                                             bool shared_ingestion) {
+    WordsModel model;
+    if (!init_words_model(&model, chain_order)) {
+        return NULL;
+    }
+
+    if (fill_database(fp, words_to_read, &model, shared_ingestion)) {
+        free_words_model(&model);
+        return NULL;
+    }
+
+    // the chain is read-only from here, generate from its compact layout
+    FrozenMarkovChain *frozen_chain = freeze_words_model(&model);
+
+    // free the database, the chain and the words
+    free_words_model(&model);
+
+    return frozen_chain;
+}
+
+static FrozenMarkovChain *freeze_words_model(const WordsModel *model) {
+    FrozenMarkovChain *frozen_chain = NULL;
+    WordsFreezer freezer = {
+            model->vocabulary,
+            (uint64_t *) malloc((model->vocabulary->size + 1) *
+                                sizeof *freezer.data_offsets)};
+
+    if (freezer.data_offsets != NULL) {
+        for (uint32_t i = 0; i < model->vocabulary->size; ++i) {
+            freezer.data_offsets[i] = UINT64_MAX;
+        }
+
+        frozen_chain = freeze_markov_chain_with(
+                model->markov_chain, (freeze_data_func_t) freeze_words_tuple,
+                &freezer, (print_func_t) print_word);
+        free(freezer.data_offsets);
+    }
+
+    return frozen_chain;
+}
+
+static bool generate_tweets(int num_of_tweets,
+                            const FrozenMarkovChain *frozen_chain,
+                            unsigned int seed) {
+    int batch_size = (num_of_tweets < TWEETS_BATCH_SIZE) ? num_of_tweets
+                                                         : TWEETS_BATCH_SIZE;
+    if (batch_size <= 0) {
+        return false;
+    }
+
+    int32_t *walks = (int32_t *) malloc(
+            (size_t) batch_size * MAX_TWEET_LENGTH * sizeof *walks);
+    int *walk_lengths = (int *) malloc(batch_size * sizeof *walk_lengths);
+    if (walks == NULL || walk_lengths == NULL) {
+        free(walks);
+        free(walk_lengths);
+        return true;
+    }
+
+    ByteBuffer output;
+    if (!init_byte_buffer(&output, BYTE_BUFFER_FLUSH_SIZE)) {
+        free(walks);
+        free(walk_lengths);
+        return true;
+    }
+
+    bool failed = false;
+    int num_of_threads = get_num_of_threads();
+    for (int first = 0; first < num_of_tweets && !failed; first += batch_size) {
+        int count = (num_of_tweets - first < batch_size)
+                    ? num_of_tweets - first : batch_size;
+
+        generate_frozen_walks(frozen_chain, seed, (uint64_t) first, count,
+                              FROZEN_NO_NODE, MAX_TWEET_LENGTH, walks,
+                              walk_lengths, num_of_threads);
+
+        for (int i = 0; i < count && !failed; ++i) {
+            char prefix[TWEET_PREFIX_MAX_LENGTH];
+            snprintf(prefix, sizeof prefix, TWEET_PREFIX_FORMAT,
+                     first + i + 1);
+
+            failed = !append_string_to_byte_buffer(&output, prefix) ||
+                     !serialize_frozen_walk(
+                             frozen_chain,
+                             walks + (size_t) i * MAX_TWEET_LENGTH,
+                             walk_lengths[i],
+                             (serialize_func_t) serialize_word, &output);
+
+            if (output.size >= BYTE_BUFFER_FLUSH_SIZE) {
+                flush_byte_buffer(&output, stdout);
+            }
+        }
+    }
+
+    flush_byte_buffer(&output, stdout);
+    free_byte_buffer(&output);
+    free(walks);
+    free(walk_lengths);
+    return failed;
+}
+
+static bool generate_live_tweets(int num_of_tweets, const WordsModel *model,
+                                 unsigned int seed) {
+    ByteBuffer output;
+    if (!init_byte_buffer(&output, BYTE_BUFFER_FLUSH_SIZE)) {
+        return true;
+    }
+
+    bool failed = false;
+    for (int i = 0; i < num_of_tweets && !failed; ++i) {
+        RandomState random_state;
+        init_random_state(&random_state, seed, (uint64_t) i);
+
+        uint32_t words[MAX_TWEET_LENGTH];
+        int length = walk_live_chain(model->markov_chain, &random_state,
+                                     words);
+        failed = !append_live_tweet(&output, model->vocabulary, i, words,
+                                    length);
+
+        if (output.size >= BYTE_BUFFER_FLUSH_SIZE) {
+            flush_byte_buffer(&output, stdout);
+        }
+    }
+
+    flush_byte_buffer(&output, stdout);
+    free_byte_buffer(&output);
+    return failed;
+}
+
+static bool generate_tweets_while_appending(int num_of_tweets,
+                                            WordsModel *model,
+                                            unsigned int seed,
+                                            int num_of_readers, int fd) {
+    if (num_of_tweets <= 0) {
+        return append_stream_to_model(model, fd);
+    }
+
+    if (num_of_readers > MAX_READER_THREADS) {
+        num_of_readers = MAX_READER_THREADS;
+    }
+    if (num_of_readers > num_of_tweets) {
+        num_of_readers = num_of_tweets;
+    }
+
+    uint32_t *walks = (uint32_t *) malloc(
+            (size_t) num_of_tweets * MAX_TWEET_LENGTH * sizeof *walks);
+    int *walk_lengths = (int *) malloc(
+            (size_t) num_of_tweets * sizeof *walk_lengths);
+    EpochDomain *epoch = enable_concurrent_readers(model->markov_chain);
+    ByteBuffer output;
+    if (walks == NULL || walk_lengths == NULL || epoch == NULL ||
+        !init_byte_buffer(&output, BYTE_BUFFER_FLUSH_SIZE)) {
+        free(walks);
+        free(walk_lengths);
+        return true;
+    }
+
+    LiveWalksJob jobs[MAX_READER_THREADS];
+    pthread_t threads[MAX_READER_THREADS];
+    bool started[MAX_READER_THREADS];
+
+    int tweets_done = 0;
+    for (int i = 0; i < num_of_readers; ++i) {
+        // split the tweets as evenly as possible between the readers
+        int job_size = (num_of_tweets - tweets_done) / (num_of_readers - i);
+
+        jobs[i] = (LiveWalksJob) {
+                model->markov_chain, epoch, seed, tweets_done, job_size,
+                walks + (size_t) tweets_done * MAX_TWEET_LENGTH,
+                walk_lengths + tweets_done, false};
+        started[i] = pthread_create(&threads[i], NULL,
+                                    generate_live_walks_job, &jobs[i]) == 0;
+        tweets_done += job_size;
+    }
+
+    // the readers walk the chain while this thread appends to it
+    bool failed = append_stream_to_model(model, fd);
+
+    for (int i = 0; i < num_of_readers; ++i) {
+        if (started[i]) {
+            pthread_join(threads[i], NULL);
+        }
+
+        // tweets whose reader could not start are walked here, after the
+        // appends
+        if (!jobs[i].done) {
+            jobs[i].epoch = NULL;
+            generate_live_walks_job(&jobs[i]);
+        }
+    }
+
+    // the vocabulary is only read once the writer is done with it
+    for (int i = 0; i < num_of_tweets && !failed; ++i) {
+        failed = !append_live_tweet(&output, model->vocabulary, i,
+                                    walks + (size_t) i * MAX_TWEET_LENGTH,
+                                    walk_lengths[i]);
+
+        if (output.size >= BYTE_BUFFER_FLUSH_SIZE) {
+            flush_byte_buffer(&output, stdout);
+        }
+    }
+
+    flush_byte_buffer(&output, stdout);
+    free_byte_buffer(&output);
+    free(walks);
+    free(walk_lengths);
+    return failed;
+}
+
+static void *generate_live_walks_job(void *job) {
+    LiveWalksJob *walks_job = (LiveWalksJob *) job;
+
+    int reader = EPOCH_NO_READER;
+    if (walks_job->epoch != NULL) {
+        reader = register_epoch_reader(walks_job->epoch);
+        if (reader == EPOCH_NO_READER) {
+            return NULL;
+        }
+    }
+
+    for (int i = 0; i < walks_job->num_of_tweets; ++i) {
+        RandomState random_state;
+        init_random_state(&random_state, walks_job->seed,
+                          (uint64_t) (walks_job->first_tweet + i));
+
+        if (reader != EPOCH_NO_READER) {
+            enter_epoch(walks_job->epoch, reader);
+        }
+        walks_job->walk_lengths[i] = walk_live_chain(
+                walks_job->markov_chain, &random_state,
+                walks_job->walks + (size_t) i * MAX_TWEET_LENGTH);
+        if (reader != EPOCH_NO_READER) {
+            exit_epoch(walks_job->epoch, reader);
+        }
+    }
+
+    if (reader != EPOCH_NO_READER) {
+        unregister_epoch_reader(walks_job->epoch, reader);
+    }
+
+    walks_job->done = true;
+    return NULL;
+}
+
+static bool append_live_tweet(ByteBuffer *buffer,
+                              const InternTable *vocabulary, int tweet_index,
+                              const uint32_t *words, int length) {
+    char prefix[TWEET_PREFIX_MAX_LENGTH];
+    snprintf(prefix, sizeof prefix, TWEET_PREFIX_FORMAT, tweet_index + 1);
+    if (!append_string_to_byte_buffer(buffer, prefix)) {
+        return false;
+    }
+
+    for (int i = 0; i < length; ++i) {
+        if ((i > 0 && !append_string_to_byte_buffer(buffer, " ")) ||
+            !serialize_word(get_interned_string(vocabulary, words[i]),
+                            buffer)) {
+            return false;
+        }
+    }
+
+    return append_string_to_byte_buffer(buffer, "\n");
+}
+
+static int walk_live_chain(MarkovChain *markov_chain,
+                           RandomState *random_state, uint32_t *words) {
+    MarkovNode *node = get_first_random_node_from_state(markov_chain,
+                                                        random_state);
+    int length = 0;
+
+    while (node != NULL) {
+        const WordsTuple *tuple = (const WordsTuple *) node->data;
+        words[length++] = tuple->words[tuple->order - 1];
+
+        if (length == MAX_TWEET_LENGTH || node->is_last) {
+            break;
+        }
+
+        node = get_next_random_node_from_state(node, random_state);
+    }
+
+    return length;
+}
+
+static int get_num_of_threads(void) {
+    long num_of_cores = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return (num_of_cores > 0) ? (int) num_of_cores : 1;
+}
+
+/**
+ * @brief Prints the usage message for the program
+ * @param program_name The program's name. should be in argv[0]
+ */
+static void usage (char *program_name)
+{
+  fprintf (stdout, USAGE_FORMAT, basename (program_name));
+  fprintf (stdout, SHARED_USAGE_FORMAT, basename (program_name));
+  fprintf (stdout, MERGE_USAGE_FORMAT, basename (program_name));
+  fprintf (stdout, APPEND_USAGE_FORMAT, basename (program_name));
+}
+
+
+
+
+/**
+ * @brief Returns true if the word ends a sentence
+ */
+bool ends_with_dot(const WordView *word) {
+    if (word->start[word->length - 1] == '.') {
+        return true;
+    }
+
+    return false;
+}
+
+void print_word(const char *word) {
+    printf("%s", word);
+}
+
+/**
+ * @brief Appends the word to the buffer, the buffered version of print_word
+ */
+bool serialize_word(const char *word, ByteBuffer *buffer) {
+    return append_string_to_byte_buffer(buffer, word);
+}
+
+/**
+ * @brief The number of bytes a word takes, including its null-terminator
+ */
+size_t word_size(const char *word) {
+    return strlen(word) + 1;
+}
+
+/**
+ * @brief FNV-1a hash of a word, the hash of a word in a frozen chain
+ */
+unsigned long hash_word(const char *word) {
+    unsigned long hash = FNV_OFFSET_BASIS;
+    for (const char *character = word; *character != '\0'; ++character) {
+        hash ^= (unsigned char) *character;
+        hash *= FNV_64_PRIME;
+    }
+
+    return hash;
+}
+
+/**
+ * @brief Compares two WordsTuples of the same order, returns 0 if they are
+ * the same words
+ */
+int compare_words_tuples(const WordsTuple *first, const WordsTuple *second) {
+    return memcmp(first, second, words_tuple_size(first));
+}
+
+/**
+ * @brief FNV-1a hash of the word ids of a WordsTuple
+ */
+unsigned long hash_words_tuple(const WordsTuple *tuple) {
+    unsigned long hash = FNV_OFFSET_BASIS;
+    for (int i = 0; i < tuple->order; ++i) {
+        hash ^= tuple->words[i];
+        hash *= FNV_64_PRIME;
+    }
+
+    return hash;
+}
+
+WordsTuple *duplicate_words_tuple(const WordsTuple *tuple) {
+    WordsTuple *duplicated_tuple =
+            (WordsTuple *) malloc(words_tuple_size(tuple));
+    if (duplicated_tuple == NULL) {
+        return NULL;
+    }
+
+    memcpy(duplicated_tuple, tuple, words_tuple_size(tuple));
+    return duplicated_tuple;
+}
+
+bool is_last_words_tuple(const WordsTuple *tuple) {
+    return tuple->is_last != 0;
+}
+
+/**
+ * @brief The number of bytes a WordsTuple takes, up to its last word
+ */
+size_t words_tuple_size(const WordsTuple *tuple) {
+    return offsetof(WordsTuple, words) + tuple->order * sizeof *tuple->words;
+}
+
+/**
+ * @brief The freeze_data_func_t of chains of WordsTuples, writes the last
+ * word of the tuple, unless an earlier state already wrote it
+ */
+bool freeze_words_tuple(const WordsTuple *tuple, ByteBuffer *data_pool,
+                        uint64_t *data_offset, WordsFreezer *freezer) {
+    uint32_t word_id = tuple->words[tuple->order - 1];
+
+    if (freezer->data_offsets[word_id] == UINT64_MAX) {
+        const char *word = get_interned_string(freezer->vocabulary, word_id);
+
+        freezer->data_offsets[word_id] = data_pool->size;
+        if (!append_to_byte_buffer(data_pool, word, word_size(word))) {
+            return false;
+        }
+    }
+
+    *data_offset = freezer->data_offsets[word_id];
+    return true;
+}
+
+static Node *add_words_tuple_to_database(IngestionState *state,
+                                         const WordView *word) {
+    WordsTuple *tuple = &state->tuple;
+
+    // a shared vocabulary already holds every word of the corpus
+    uint32_t word_id = state->shared
+                       ? find_interned_string(state->model->vocabulary,
+                                              word->start, word->length)
+                       : intern_string(state->model->vocabulary, word->start,
+                                       word->length);
+    if (word_id == INTERN_NO_ID) {
+        return NULL;
+    }
+
+    slide_words_tuple(tuple, word_id, word);
+
+    return add_words_tuple_state(state->model->markov_chain, tuple);
+}
+
+static void slide_words_tuple(WordsTuple *tuple, uint32_t word_id,
+                              const WordView *word) {
+    memmove(tuple->words, tuple->words + 1,
+            (tuple->order - 1) * sizeof *tuple->words);
+    tuple->words[tuple->order - 1] = word_id;
+    tuple->is_last = ends_with_dot(word);
+}
+
+static bool add_word_to_database(const WordView *word, bool starts_sentence,
+                                 void *context) {
+    IngestionState *state = (IngestionState *) context;
+
+    if (state->words_to_read == 0) {
+        return false;
+    }
+
+    if (starts_sentence) {
+        state->prev_node = NULL;
+        for (int i = 0; i < state->tuple.order; ++i) {
+            state->tuple.words[i] = NO_WORD;
+        }
+    }
+
+    Node *current_node = add_words_tuple_to_database(state, word);
+    if (current_node == NULL) {
+        state->failed = true;
+        return false;
+    }
+
+    if (state->prev_node != NULL &&
+        !add_transition_to_markov_chain(state->model->markov_chain,
+                                        state->prev_node, current_node->data,
+                                        1)) {
+        state->failed = true;
+        return false;
+    }
+
+    state->prev_node = current_node->data;
+
+    if (state->words_to_read != READ_ALL_WORDS) {
+        state->words_to_read--;
+    }
+
+    return true;
+}
+
+static bool add_text_to_database(WordsModel *model, const char *start,
+                                 const char *end, int words_to_read,
+                                 bool shared) {
+    IngestionState state = {model, NULL, {(uint16_t) model->order, 0, {0}},
+                            words_to_read, shared, false};
+
+    tokenize_corpus(start, end, add_word_to_database, &state);
+
+    return state.failed;
+}
+
+static bool add_stream_to_database(WordsModel *model, int fd,
+                                   int words_to_read) {
+    IngestionState state = {model, NULL, {(uint16_t) model->order, 0, {0}},
+                            words_to_read, false, false};
+
+    bool completed = tokenize_stream(fd, add_word_to_database, &state);
+
+    // only the words limit may stop the stream before its end
+    return state.failed || (!completed && state.words_to_read != 0);
+}
+
+bool fill_database(FILE *fp, int words_to_read, WordsModel *model,
+                   bool shared) {
+    Corpus corpus;
+    if (!open_corpus(fp, &corpus)) {
+        // a pipe, its text can only be read once and in order
+        return add_stream_to_database(model, fileno(fp), words_to_read);
+    }
+
+    bool failed;
+    if (words_to_read == READ_ALL_WORDS) {
+        failed = fill_database_parallel(&corpus, model, shared);
+    } else {
+        // the words limit depends on the reading order, read sequentially
+        failed = add_text_to_database(model, corpus.text,
+                                      corpus.text + corpus.size,
+                                      words_to_read, false);
+    }
+
+    close_corpus(&corpus);
+    return failed;
+}
+
+static void *ingest_corpus_part(void *job) {
+    IngestionJob *ingestion_job = (IngestionJob *) job;
+
+    if (ingestion_job->shared) {
+        ingestion_job->failed =
+                add_text_to_database(&ingestion_job->model,
+                                     ingestion_job->start, ingestion_job->end,
+                                     READ_ALL_WORDS, true);
+        return NULL;
+    }
+
+    ingestion_job->failed =
+            !init_words_model(&ingestion_job->model,
+                              ingestion_job->model.order) ||
+            add_text_to_database(&ingestion_job->model,
+                                 ingestion_job->start, ingestion_job->end,
+                                 READ_ALL_WORDS, false);
+
+    return NULL;
+}
+
+static void *collect_corpus_part_words(void *job) {
+    IngestionJob *ingestion_job = (IngestionJob *) job;
+
+    ingestion_job->model.vocabulary = new_intern_table();
+    ingestion_job->failed =
+            ingestion_job->model.vocabulary == NULL ||
+            !tokenize_corpus(ingestion_job->start, ingestion_job->end,
+                             intern_word, ingestion_job->model.vocabulary);
+
+    return NULL;
+}
+
+static bool intern_word(const WordView *word, bool starts_sentence,
+                        void *context) {
+    (void) starts_sentence;
+
+    return intern_string((InternTable *) context, word->start,
+                         word->length) != INTERN_NO_ID;
+}
+
+static bool merge_vocabularies(InternTable *vocabulary,
+                               const InternTable *source_vocabulary,
+                               uint32_t *merged_ids) {
+    for (uint32_t id = 0; id < source_vocabulary->size; ++id) {
+        uint32_t merged_id = intern_string(
+                vocabulary, get_interned_string(source_vocabulary, id),
+                get_interned_length(source_vocabulary, id));
+        if (merged_id == INTERN_NO_ID) {
+            return true;
+        }
+
+        if (merged_ids != NULL) {
+            merged_ids[id] = merged_id;
+        }
+    }
+
+    return false;
+}
+
+static bool merge_words_models(WordsModel *model, WordsModel *source_model) {
+    const InternTable *source_words = source_model->vocabulary;
+
+    if (source_words->size > 0) {
+        // the id in model of every word, by its id in source_model. new
+        // words are interned in their order in source_model
+        uint32_t *merged_ids =
+                (uint32_t *) malloc(source_words->size * sizeof *merged_ids);
+        if (merged_ids == NULL ||
+            merge_vocabularies(model->vocabulary, source_words, merged_ids)) {
+            free(merged_ids);
+            return true;
+        }
+
+        // the hashes of the source states are stale after this, but
+        // merge_markov_chains only hashes the states of model
+        for (Node *node = source_model->markov_chain->database->first;
+             node != NULL; node = node->next) {
+            WordsTuple *tuple = (WordsTuple *) node->data->data;
+            for (int i = 0; i < tuple->order; ++i) {
+                if (tuple->words[i] != NO_WORD) {
+                    tuple->words[i] = merged_ids[tuple->words[i]];
+                }
+            }
+        }
+
+        free(merged_ids);
+    }
+
+    return !merge_markov_chains(model->markov_chain,
+                                source_model->markov_chain);
+}
+
+static void split_corpus(const Corpus *corpus, IngestionJob *jobs,
+                         size_t num_of_jobs, int order) {
+    const char *corpus_start = corpus->text;
+    const char *corpus_end = corpus->text + corpus->size;
+    const char *part_start = corpus_start;
+
+    for (size_t i = 0; i < num_of_jobs; ++i) {
+        const char *part_end =
+                corpus_start + corpus->size / num_of_jobs * (i + 1);
+        if (i == num_of_jobs - 1 || part_end < part_start) {
+            part_end = (i == num_of_jobs - 1) ? corpus_end : part_start;
+        }
+
+        while (part_end < corpus_end && part_end > corpus_start &&
+               part_end[-1] != '\n') {
+            part_end++;
+        }
+
+        jobs[i] = (IngestionJob) {part_start, part_end, {order, NULL, NULL},
+                                  false, false};
+        part_start = part_end;
+    }
+}
+
+static void run_ingestion_jobs(IngestionJob *jobs, size_t num_of_jobs,
+                               void *(*routine)(void *)) {
+    pthread_t threads[MAX_INGESTION_THREADS];
+
+    size_t num_of_started = 0;
+    for (; num_of_started < num_of_jobs; ++num_of_started) {
+        if (pthread_create(&threads[num_of_started], NULL, routine,
+                           &jobs[num_of_started]) != 0) {
+            break;
+        }
+    }
+
+    // parts whose thread could not be started are ingested here
+    for (size_t i = num_of_started; i < num_of_jobs; ++i) {
+        routine(&jobs[i]);
+    }
+
+    for (size_t i = 0; i < num_of_started; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+}
+
+static bool fill_database_parallel(const Corpus *corpus, WordsModel *model,
+                                   bool shared) {
+    size_t num_of_threads = corpus->size / MIN_BYTES_PER_THREAD;
+    if (num_of_threads > (size_t) get_num_of_threads()) {
+        num_of_threads = (size_t) get_num_of_threads();
+    }
+    if (num_of_threads > MAX_INGESTION_THREADS) {
+        num_of_threads = MAX_INGESTION_THREADS;
+    }
+
+    if (num_of_threads <= 1) {
+        return add_text_to_database(model, corpus->text,
+                                    corpus->text + corpus->size,
+                                    READ_ALL_WORDS, false);
+    }
+
+    IngestionJob jobs[MAX_INGESTION_THREADS];
+    split_corpus(corpus, jobs, num_of_threads, model->order);
+
+    if (shared) {
+        return fill_shared_database(jobs, num_of_threads, model);
+    }
+
+    run_ingestion_jobs(jobs, num_of_threads, ingest_corpus_part);
+
+    // merge the parts in order, so the model is the same as a sequential one
+    bool failed = false;
+    for (size_t i = 0; i < num_of_threads; ++i) {
+        failed = failed || jobs[i].failed ||
+                 merge_words_models(model, &jobs[i].model);
+        free_words_model(&jobs[i].model);
+    }
+
+    return failed;
+}
+
+static bool fill_shared_database(IngestionJob *jobs, size_t num_of_jobs,
+                                 WordsModel *model) {
+    // intern the words of the parts in order, so the words get the same ids
+    // as in a sequential run
+    run_ingestion_jobs(jobs, num_of_jobs, collect_corpus_part_words);
+
+    bool failed = false;
+    for (size_t i = 0; i < num_of_jobs; ++i) {
+        failed = failed || jobs[i].failed ||
+                 merge_vocabularies(model->vocabulary,
+                                    jobs[i].model.vocabulary, NULL);
+        free_intern_table(&jobs[i].model.vocabulary);
+    }
+
+    if (failed || !enable_concurrent_writers(model->markov_chain)) {
+        return true;
+    }
+
+    // every thread adds its part to the one chain, and only reads the words
+    for (size_t i = 0; i < num_of_jobs; ++i) {
+        jobs[i].model = *model;
+        jobs[i].shared = true;
+    }
+
+    run_ingestion_jobs(jobs, num_of_jobs, ingest_corpus_part);
+
+    for (size_t i = 0; i < num_of_jobs; ++i) {
+        failed = failed || jobs[i].failed;
+    }
+
+    return !disable_concurrent_writers(model->markov_chain) || failed;
+}
+
+bool parse_arguments(int argc, char *argv[], unsigned int *seed, int
+*num_of_tweets, int *num_of_words, int *chain_order,
+CompactionOptions *compaction, FILE **text_corpus_fp) {
+    char *end_ptr, *text_corpus_path;
+    // we don't check the following arguments, because we can assume they are
+    // valid
+    *seed = (unsigned int) strtol(argv[SEED_ARG_INDEX], &end_ptr,
+                                  DECIMAL_BASE);
+    *num_of_tweets =
+            (int) strtol(argv[TWEET_COUNT_ARG_INDEX], &end_ptr, DECIMAL_BASE);
+
+    *num_of_words = READ_ALL_WORDS;
+
+    if (argc >= ARG_COUNT_WITH_NUM_OF_WORD) {
+        *num_of_words =
+                (int) strtol(argv[WORD_COUNT_ARG_INDEX], &end_ptr,
+                             DECIMAL_BASE);
+    }
+
+    *chain_order = DEFAULT_CHAIN_ORDER;
+
+    if (argc >= ARG_COUNT_WITH_CHAIN_ORDER) {
+        *chain_order =
+                (int) strtol(argv[CHAIN_ORDER_ARG_INDEX], &end_ptr,
+                             DECIMAL_BASE);
+        if (*chain_order < 1 || *chain_order > MAX_CHAIN_ORDER) {
+            printf(ERROR_CHAIN_ORDER_FMT, MAX_CHAIN_ORDER);
+            return true;
+        }
+    }
+
+    if (argc >= ARG_COUNT_WITH_COMPACTION &&
+        parse_compaction(argv[COMPACTION_ARG_INDEX], compaction)) {
+        printf(ERROR_COMPACTION_FMT, QUANTIZED_WEIGHT_BITS_8,
+               QUANTIZED_WEIGHT_BITS_16);
+        return true;
+    }
+
+    text_corpus_path = argv[TEXT_CORPUS_ARG_INDEX];
+    *text_corpus_fp = open_text_corpus(text_corpus_path);
+
+    /** we have to check that the file could open */
+    return *text_corpus_fp == NULL;
+}
+
+static FILE *open_text_corpus(const char *path) {
+    FILE *fp = (strcmp(path, STDIN_CORPUS) == 0) ? stdin : fopen(path, "r");
+
+    if (fp == NULL) {
+        printf(ERROR_OPEN_FILE_FMT, path);
+    }
+
+    return fp;
+}
+
+static bool parse_compaction(const char *argument,
+                             CompactionOptions *compaction) {
+    char *end_ptr;
+
+    compaction->min_count = (int32_t) strtol(argument, &end_ptr,
+                                             DECIMAL_BASE);
+    if (*end_ptr != COMPACTION_SEPARATOR) {
+        return true;
+    }
+
+    compaction->top_k = (int32_t) strtol(end_ptr + 1, &end_ptr,
+                                         DECIMAL_BASE);
+    if (*end_ptr != COMPACTION_SEPARATOR) {
+        return true;
+    }
+
+    compaction->weight_bits = (int32_t) strtol(end_ptr + 1, &end_ptr,
+                                               DECIMAL_BASE);
+
+    return *end_ptr != '\0' || compaction->min_count < 0 ||
+           compaction->top_k < 0 ||
+           (compaction->weight_bits != 0 &&
+            compaction->weight_bits != QUANTIZED_WEIGHT_BITS_8 &&
+            compaction->weight_bits != QUANTIZED_WEIGHT_BITS_16);
+}